@@ -2454,6 +2454,65 @@ static bool RemoveFileForBootstrapLinking(std::string &ErrorText, std::string co
    return true;
 }
 									/*}}}*/
+static std::vector<DiffInfo> ParseJumpPatches(pkgTagSection const &Tags, HashStringList const &LocalHashes)/*{{{*/
+{
+   // jump patches are listed like the others, just in fields with an X-Jump- prefix
+   struct
+   {
+      char const *const suffix;
+      HashStringList DiffInfo::*const hashes;
+   } const fields[] = {
+      {"-History", &DiffInfo::result_hashes},
+      {"-Patches", &DiffInfo::patch_hashes},
+      {"-Download", &DiffInfo::download_hashes},
+   };
+   std::vector<DiffInfo> jumps;
+   auto const &posix = std::locale::classic();
+   for (char const * const * type = HashString::SupportedHashes(); *type != NULL; ++type)
+   {
+      if (LocalHashes.find(*type) == NULL)
+	 continue;
+      for (auto const &field : fields)
+      {
+	 std::string tagname = "X-Jump-";
+	 tagname.append(*type).append(field.suffix);
+	 std::stringstream ss(std::string{Tags.Find(tagname)});
+	 ss.imbue(posix);
+
+	 string hash, filename;
+	 unsigned long long size;
+	 while (ss >> hash >> size >> filename)
+	 {
+	    if (field.hashes == &DiffInfo::download_hashes)
+	    {
+	       if (unlikely(APT::String::Endswith(filename, ".gz") == false))
+		  continue;
+	       filename.erase(filename.length() - 3);
+	    }
+	    auto cur = std::find_if(jumps.begin(), jumps.end(), [&](DiffInfo const &J) { return J.file == filename; });
+	    if (cur == jumps.end())
+	    {
+	       if (field.hashes != &DiffInfo::result_hashes)
+		  continue;
+	       DiffInfo next;
+	       next.file = filename;
+	       jumps.push_back(next);
+	       cur = std::prev(jumps.end());
+	    }
+	    HashStringList &hashes = (*cur).*field.hashes;
+	    if (hashes.empty())
+	       hashes.FileSize(size);
+	    hashes.push_back(HashString(*type, hash));
+	 }
+      }
+   }
+   jumps.erase(std::remove_if(jumps.begin(), jumps.end(), [](DiffInfo const &J) {
+		  return not J.result_hashes.usable() || not J.patch_hashes.usable() || not J.download_hashes.usable();
+	       }),
+	       jumps.end());
+   return jumps;
+}
+									/*}}}*/
 bool pkgAcqDiffIndex::ParseDiffIndex(string const &IndexDiffFile)	/*{{{*/
 {
    available_patches.clear();
@@ -2706,6 +2765,50 @@ bool pkgAcqDiffIndex::ParseDiffIndex(string const &IndexDiffFile)	/*{{{*/
       }
    }
 
+   /* jump patches lead from one of the states on the way directly to the
+      current one, so a jump can replace all patches from that state on.
+      Pick the way which downloads the least bytes. */
+   if (Tags.Find("X-Patch-Precedence") != "merged" && _config->FindB("Acquire::PDiffs::Jumps", true))
+   {
+      auto const jumps = ParseJumpPatches(Tags, LocalHashes);
+      unsigned long long const chainSize = std::accumulate(available_patches.begin(), available_patches.end(), 0llu,
+							   [](unsigned long long const T, DiffInfo const &I) {
+							      return T + I.download_hashes.FileSize();
+							   });
+      unsigned long long bestSize = chainSize;
+      unsigned long long prefixSize = 0;
+      DiffInfo const *bestJump = nullptr;
+      size_t bestPrefix = 0;
+      for (size_t prefix = 0; prefix < available_patches.size(); ++prefix)
+      {
+	 for (auto const &jump : jumps)
+	 {
+	    if (jump.result_hashes != available_patches[prefix].result_hashes ||
+		prefixSize + jump.download_hashes.FileSize() >= bestSize)
+	       continue;
+	    // rred applies merged patches in the order of their filenames
+	    if (not std::all_of(available_patches.begin(), available_patches.begin() + prefix, [&](DiffInfo const &I) {
+		   return I.file + ".gz" < jump.file + ".gz";
+		}))
+	       continue;
+	    bestSize = prefixSize + jump.download_hashes.FileSize();
+	    bestJump = &jump;
+	    bestPrefix = prefix;
+	 }
+	 prefixSize += available_patches[prefix].download_hashes.FileSize();
+      }
+      if (bestJump != nullptr)
+      {
+	 if (Debug)
+	    std::clog << "pkgAcqDiffIndex: " << IndexDiffFile << ": Jump with " << bestJump->file
+		      << " after " << bestPrefix << " of " << available_patches.size() << " patches: "
+		      << bestSize << " instead of " << chainSize << " bytes" << std::endl;
+	 DiffInfo const jump = *bestJump;
+	 available_patches.erase(available_patches.begin() + bestPrefix, available_patches.end());
+	 available_patches.push_back(jump);
+      }
+   }
+
    // patching with too many files is rather slow compared to a fast download
    unsigned long const fileLimit = _config->FindI("Acquire::PDiffs::FileLimit", 0);
    if (fileLimit != 0 && fileLimit < available_patches.size())
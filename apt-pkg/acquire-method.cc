@@ -51,6 +51,19 @@ static void try_emplace(std::unordered_map<std::string, std::string> &fields, st
 // ---------------------------------------------------------------------
 /* This constructs the initialization text */
 pkgAcqMethod::pkgAcqMethod(const char *Ver,unsigned long Flags)
+{
+   SendCapabilities(Ver, Flags);
+
+   SetNonBlock(STDIN_FILENO,true);
+
+   Queue = 0;
+   QueueBack = 0;
+}
+									/*}}}*/
+// AcqMethod::SendCapabilities - Introduce ourselves to APT		/*{{{*/
+// ---------------------------------------------------------------------
+/* This is the first message APT expects from a method. */
+void pkgAcqMethod::SendCapabilities(const char *Ver, unsigned long Flags)
 {
    std::unordered_map<std::string, std::string> fields;
    try_emplace(fields, "Version", Ver);
@@ -79,11 +92,6 @@ pkgAcqMethod::pkgAcqMethod(const char *Ver,unsigned long Flags)
       try_emplace(fields, "Send-URI-Encoded", "true");
 
    SendMessage("100 Capabilities", std::move(fields));
-
-   SetNonBlock(STDIN_FILENO,true);
-
-   Queue = 0;
-   QueueBack = 0;
 }
 									/*}}}*/
 void pkgAcqMethod::SendMessage(std::string const &header, std::unordered_map<std::string, std::string> &&fields) /*{{{*/
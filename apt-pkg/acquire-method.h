@@ -98,6 +98,7 @@ class APT_PUBLIC pkgAcqMethod
    virtual void URIStart(FetchResult &Res);
    virtual void URIDone(FetchResult &Res,FetchResult *Alt = 0);
    void SendMessage(std::string const &header, std::unordered_map<std::string, std::string> &&fields);
+   void SendCapabilities(const char *Ver, unsigned long Flags);
 
    bool MediaFail(std::string Required,std::string Drive);
    virtual void Exit() {};
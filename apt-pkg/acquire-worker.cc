@@ -33,8 +33,13 @@
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <sstream>
+#include <sys/file.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <apti18n.h>
@@ -42,9 +47,151 @@
 
 using namespace std;
 
+class pkgAcquire::Worker::Private
+{
+   public:
+   // Held while we talk to a method daemon, so that other workers use another
+   int LockFd = -1;
+
+   int ConnectDaemon(std::string const &Name, std::string const &Method, std::string const &Calling, bool const Debug);
+
+   ~Private()
+   {
+      if (LockFd != -1)
+	 close(LockFd);
+   }
+};
+static int ConnectSocket(std::string const &Path)			/*{{{*/
+{
+   struct sockaddr_un Addr;
+   memset(&Addr, 0, sizeof(Addr));
+   Addr.sun_family = AF_UNIX;
+   if (Path.length() >= sizeof(Addr.sun_path))
+      return -1;
+   strcpy(Addr.sun_path, Path.c_str());
+
+   int const Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (Fd != -1 && connect(Fd, reinterpret_cast<struct sockaddr *>(&Addr), sizeof(Addr)) != 0)
+   {
+      close(Fd);
+      return -1;
+   }
+   return Fd;
+}
+									/*}}}*/
+// DaemonIdent - What a daemon has to share with its clients		/*{{{*/
+// ---------------------------------------------------------------------
+/* A daemon keeps the proxy settings from the environment it was started
+   with and reads the auth.conf files only once, so clients which differ
+   in either get a daemon of their own. */
+static std::string DaemonIdent()
+{
+   Hashes Hash(Hashes::MD5SUM);
+   for (auto const Env : {"http_proxy", "https_proxy", "no_proxy"})
+   {
+      char const *const Value = getenv(Env);
+      std::string const S = std::string(Env) + '=' + (Value == nullptr ? "-" : Value);
+      Hash.Add(S.c_str(), S.length() + 1);
+   }
+
+   std::vector<std::string> AuthConfs;
+   _error->PushToStack();
+   auto const netrc = _config->FindFile("Dir::Etc::netrc");
+   if (netrc.empty() == false)
+      AuthConfs.push_back(netrc);
+   auto const netrcparts = _config->FindDir("Dir::Etc::netrcparts");
+   if (netrcparts.empty() == false)
+      for (auto &&netrcpart : GetListOfFilesInDir(netrcparts, "conf", true, true))
+	 AuthConfs.push_back(std::move(netrcpart));
+   _error->RevertToStack();
+   for (auto const &AuthConf : AuthConfs)
+   {
+      std::string S;
+      struct stat Buf;
+      if (stat(AuthConf.c_str(), &Buf) == 0)
+	 strprintf(S, "%s %llu %lld %lld.%09ld", AuthConf.c_str(), static_cast<unsigned long long>(Buf.st_ino),
+		   static_cast<long long>(Buf.st_size), static_cast<long long>(Buf.st_mtim.tv_sec), Buf.st_mtim.tv_nsec);
+      else
+	 S = AuthConf;
+      Hash.Add(S.c_str(), S.length() + 1);
+   }
+   // the socket path has to stay short, so a part of the hash has to do
+   return Hash.GetHashString(Hashes::MD5SUM).HashValue().substr(0, 16);
+}
+									/*}}}*/
+// Worker::Private::ConnectDaemon - Talk to a long-running method	/*{{{*/
+// ---------------------------------------------------------------------
+/* Each queue gets its own daemons, so that they are likely to have an open
+   connection to the right host already, and so does each DaemonIdent. A
+   daemon serves one worker at a time, which holds the lock of its slot
+   while doing so. If there is no daemon in the free slot yet, the method
+   is started as one. Any error here just means we start the method the
+   usual way, so none is reported. */
+int pkgAcquire::Worker::Private::ConnectDaemon(std::string const &Name, std::string const &Method, std::string const &Calling, bool const Debug)
+{
+   // like for the archives, the cache directory itself might not exist yet
+   std::string const Cache = _config->FindDir("Dir::Cache");
+   std::string const Dir = _config->FindDir("Dir::Cache::methods");
+   if (CreateAPTDirectoryIfNeeded(Cache, Cache) == false ||
+       (mkdir(Dir.c_str(), 0700) != 0 && errno != EEXIST))
+      return -1;
+
+   std::string Key = Name;
+   std::replace_if(Key.begin(), Key.end(), [](char const c) { return isalnum(c) == 0 && strchr("+-.", c) == nullptr; }, '_');
+   Key.append(".").append(DaemonIdent());
+
+   int const Slots = _config->FindI("Acquire::Daemon::Slots", 16);
+   for (int Slot = 0; Slot < Slots; ++Slot)
+   {
+      std::string const Base = flCombine(Dir, Key + "." + std::to_string(Slot));
+      LockFd = open((Base + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+      if (LockFd == -1)
+	 return -1;
+      if (flock(LockFd, LOCK_EX | LOCK_NB) != 0)
+      {
+	 close(LockFd);
+	 LockFd = -1;
+	 continue;
+      }
+
+      std::string const Socket = Base + ".socket";
+      int Fd = ConnectSocket(Socket);
+      if (Fd == -1)
+      {
+	 if (Debug == true)
+	    std::clog << "Starting method '" << Calling << "' as daemon on " << Socket << std::endl;
+	 // the method exits once it listens on the socket
+	 pid_t const Process = ExecFork();
+	 if (Process == 0)
+	 {
+	    // nobody would read our output once this run is over
+	    int const Null = open("/dev/null", O_RDWR);
+	    dup2(Null, STDIN_FILENO);
+	    dup2(Null, STDOUT_FILENO);
+	    dup2(Null, STDERR_FILENO);
+	    close(Null);
+	    setenv("APT_METHOD_DAEMON", Socket.c_str(), 1);
+	    const char * const Args[] = { Calling.c_str(), nullptr };
+	    execv(Method.c_str(), const_cast<char **>(Args));
+	    _exit(100);
+	 }
+	 ExecWait(Process, Calling.c_str(), true);
+	 Fd = ConnectSocket(Socket);
+      }
+      if (Fd == -1)
+      {
+	 close(LockFd);
+	 LockFd = -1;
+      }
+      return Fd;
+   }
+   return -1;
+}
+									/*}}}*/
+
 // Worker::Worker - Constructor for Queue startup			/*{{{*/
 pkgAcquire::Worker::Worker(Queue *Q, MethodConfig *Cnf, pkgAcquireStatus *log) :
-   d(NULL), OwnerQ(Q), Log(log), Config(Cnf), Access(Cnf->Access),
+   d(new Private()), OwnerQ(Q), Log(log), Config(Cnf), Access(Cnf->Access),
    CurrentItem(nullptr)
 {
    Construct();
@@ -86,6 +233,7 @@ pkgAcquire::Worker::~Worker()
 	 kill(Process,SIGINT);
       ExecWait(Process,Access.c_str(),true);
    }   
+   delete d;
 }
 									/*}}}*/
 // Worker::Start - Start the worker process				/*{{{*/
@@ -127,6 +275,35 @@ bool pkgAcquire::Worker::Start()
       std::clog << endl;
    }
 
+   auto const Handshake = [&]() {
+      // Read the configuration data
+      if (WaitFd(InFd) == false ||
+	  ReadMessages() == false)
+	 return _error->Error(_("Method %s did not start correctly"),Method.c_str());
+
+      RunMessages();
+      if (OwnerQ != 0)
+	 SendConfiguration();
+
+      return true;
+   };
+
+   // Reuse a long-running method which might have warm connections
+   if (OwnerQ != nullptr && _config->FindB("Acquire::" + Access + "::Daemon", false))
+   {
+      int const Fd = d->ConnectDaemon(OwnerQ->Name, Method, Calling, Debug);
+      if (Fd != -1)
+      {
+	 InFd = Fd;
+	 OutFd = dup(Fd);
+	 SetCloseExec(OutFd, true);
+	 SetNonBlock(InFd, true);
+	 OutReady = false;
+	 InReady = true;
+	 return Handshake();
+      }
+   }
+
    // Create the pipes
    int Pipes[4] = {-1,-1,-1,-1};
    if (pipe(Pipes) != 0 || pipe(Pipes+2) != 0)
@@ -166,16 +343,7 @@ bool pkgAcquire::Worker::Start()
    OutReady = false;
    InReady = true;
 
-   // Read the configuration data
-   if (WaitFd(InFd) == false ||
-       ReadMessages() == false)
-      return _error->Error(_("Method %s did not start correctly"),Method.c_str());
-
-   RunMessages();
-   if (OwnerQ != 0)
-      SendConfiguration();
-
-   return true;
+   return Handshake();
 }
 									/*}}}*/
 // Worker::ReadMessages - Read all pending messages into the list	/*{{{*/
@@ -46,8 +46,8 @@
  */
 class APT_PUBLIC pkgAcquire::Worker : public WeakPointable
 {
-   /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   class Private;
+   Private * const d;
   
    friend class pkgAcquire;
    
@@ -20,6 +20,7 @@
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/reactor.h>
 #include <apt-pkg/strutl.h>
 
 #include <algorithm>
@@ -34,6 +35,8 @@
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <cerrno>
@@ -280,6 +283,90 @@ void pkgAcquire::Remove(Worker *Work)
    }
 }
 									/*}}}*/
+class pkgAcquire::Queue::Private					/*{{{*/
+{
+   public:
+   /** \brief How many workers (connections) this queue may use */
+   unsigned long MaxWorkers = 1;
+
+   static unsigned long long ExpectedSize(QItem const * const I)
+   {
+      if (I->Owner->FileSize != 0)
+	 return I->Owner->FileSize;
+      return I->Owner->GetExpectedHashes().FileSize();
+   }
+   /** \brief the largest idle item which could be fetched instead of \a First */
+   static QItem *LargestIdleItem(QItem *First, time_point const Now)
+   {
+      QItem *Largest = First;
+      auto LargestSize = ExpectedSize(First);
+      auto const Priority = First->GetPriority();
+      for (QItem *I = First->Next; I != nullptr; I = I->Next)
+      {
+	 if (I->Owner->Status != pkgAcquire::Item::StatIdle || I->GetPriority() != Priority ||
+	     I->GetFetchAfter() > Now)
+	    continue;
+	 if (auto const Size = ExpectedSize(I); Size > LargestSize)
+	 {
+	    Largest = I;
+	    LargestSize = Size;
+	 }
+      }
+      return Largest;
+   }
+   /** \brief the worker with the least bytes outstanding and room in its
+    *  pipeline; a new one is started instead if all are busy and we may */
+   static pkgAcquire::Worker *LeastBusyWorker(Queue * const Q)
+   {
+      struct Load
+      {
+	 pkgAcquire::Worker *Worker;
+	 unsigned long Depth;
+	 unsigned long long Bytes;
+      };
+      std::vector<Load> Loads;
+      for (pkgAcquire::Worker *W = Q->Workers; W != nullptr; W = W->NextQueue)
+	 Loads.push_back({W, 0, 0});
+      for (QItem const *I = Q->Items; I != nullptr; I = I->Next)
+      {
+	 if (I->Owner->Status != pkgAcquire::Item::StatFetching)
+	    continue;
+	 auto const L = std::find_if(Loads.begin(), Loads.end(), [&](auto const &L) { return L.Worker == I->Worker; });
+	 if (L == Loads.end())
+	    continue;
+	 ++L->Depth;
+	 auto const Size = ExpectedSize(I);
+	 L->Bytes += Size > I->CurrentSize ? Size - I->CurrentSize : 0;
+      }
+
+      Load const *Best = nullptr;
+      for (auto const &L : Loads)
+	 if (L.Depth < Q->MaxPipeDepth && (Best == nullptr || L.Bytes < Best->Bytes))
+	    Best = &L;
+      if (Best != nullptr && Best->Depth == 0)
+	 return Best->Worker;
+      if (Loads.size() >= Q->d->MaxWorkers)
+	 return Best == nullptr ? nullptr : Best->Worker;
+
+      /* An additional connection is only an optimisation, so if it can't be
+	 started we stay with the workers we have instead of failing */
+      auto const W = new pkgAcquire::Worker(Q, Q->Owner->GetConfig(Q->Workers->GetConf()->Access), Q->Owner->Log);
+      _error->PushToStack();
+      if (W->Start() == false)
+      {
+	 _error->RevertToStack();
+	 delete W;
+	 Q->d->MaxWorkers = Loads.size();
+	 return Best == nullptr ? nullptr : Best->Worker;
+      }
+      _error->MergeWithStack();
+      W->NextQueue = Q->Workers;
+      Q->Workers = W;
+      Q->Owner->Add(W);
+      return W;
+   }
+};
+									/*}}}*/
 // Acquire::Enqueue - Queue an URI for fetching				/*{{{*/
 // ---------------------------------------------------------------------
 /* This is the entry point for an item. An item calls this function when
@@ -347,6 +434,10 @@ void pkgAcquire::Enqueue(ItemDesc &Item)
       I = new Queue(Name,this);
       I->Next = Queues;
       Queues = I;
+
+      // Queues for a remote host may open multiple connections to it
+      if (QueueMode == QueueHost && not Config->SingleInstance && not URI(Item.URI).Host.empty())
+	 I->d->MaxWorkers = std::max(1, _config->FindI("Acquire::QueueHost::Connections", 1));
       
       if (Running == true)
 	 I->Startup();
@@ -575,7 +666,7 @@ bool pkgAcquire::RunFds(fd_set *RSet,fd_set *WSet)
 									/*}}}*/
 // Acquire::Run - Run the fetch sequence				/*{{{*/
 // ---------------------------------------------------------------------
-/* This runs the queues. It manages a select loop for all of the
+/* This runs the queues. It manages an event loop for all of the
    Worker tasks. The workers interact with the queues and items to
    manage the actual fetch. */
 static bool IsAccessibleBySandboxUser(std::string const &filename, bool const ReadWrite)
@@ -713,19 +804,38 @@ pkgAcquire::RunResult pkgAcquire::Run(int PulseInterval)
    bool WasCancelled = false;
 
    // Run till all things have been acquired
-   struct timeval tv = SteadyDurationToTimeVal(std::chrono::microseconds(PulseInterval));
+   APT::Reactor Events;
+   std::vector<APT::Reactor::Event> Ready;
+   std::unordered_map<Worker const *, std::pair<int, int>> WatchedFds;
+   auto pulse = clock::now() + std::chrono::microseconds(PulseInterval);
    while (ToFetch > 0)
    {
-      fd_set RFds;
-      fd_set WFds;
-      int Highest = 0;
-      FD_ZERO(&RFds);
-      FD_ZERO(&WFds);
-      SetFds(Highest,&RFds,&WFds);
-
-      // Shorten the select() cycle in case we have items about to become ready
+      /* A failing worker closes its descriptors, so they have to be
+	 forgotten before another worker watches a reused number. */
+      for (Worker *I = Workers; I != nullptr; I = I->NextAcquire)
+      {
+	 auto const Fds = WatchedFds.find(I);
+	 if (Fds == WatchedFds.end())
+	    continue;
+	 if (Fds->second.first != -1 && Fds->second.first != I->InFd)
+	    Events.Forget(Fds->second.first);
+	 if (Fds->second.second != -1 && Fds->second.second != I->OutFd)
+	    Events.Forget(Fds->second.second);
+      }
+      /* A reply might not be read in one go, so we watch level-triggered;
+	 the Worker itself identifies the owner of an event. */
+      for (Worker *I = Workers; I != nullptr; I = I->NextAcquire)
+      {
+	 if (I->InReady && not Events.Watch(I->InFd, APT::Reactor::Read, I))
+	    goto stop;
+	 if (I->OutReady && not Events.Watch(I->OutFd, APT::Reactor::Write, I))
+	    goto stop;
+	 WatchedFds[I] = {I->InReady ? I->InFd : -1, I->OutReady ? I->OutFd : -1};
+      }
+
+      // Shorten the wait in case we have items about to become ready
       auto now = clock::now();
-      auto fetchAfter = time_point{};
+      auto deadline = pulse;
       for (Queue *I = Queues; I != nullptr; I = I->Next)
       {
 	 if (I->Items == nullptr)
@@ -740,41 +850,36 @@ pkgAcquire::RunResult pkgAcquire::Run(int PulseInterval)
 	 {
 	    if (not I->Cycle()) // Queue got stuck, unstuck it.
 	       goto stop;
-	    fetchAfter = now; // need to time out in select() below
+	    deadline = now; // need to time out in the wait below
 	    if (Debug && I->Items->Owner->Status == pkgAcquire::Item::StatIdle)
 	       clog << "Tried to start delayed item but failed:" << I->Items->Description.c_str() << std::endl;
 	 }
-	 else if (f < fetchAfter || fetchAfter == time_point{})
+	 else if (f < deadline)
 	 {
-	    fetchAfter = f;
+	    deadline = f;
 	 }
       }
 
-      if (fetchAfter != time_point{} && (fetchAfter - now) < std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec))
-      {
-	 tv = SteadyDurationToTimeVal(fetchAfter - now);
-      }
+      if (not Events.Wait(Ready, deadline))
+	 break;
 
-      int Res;
-      do
+      bool Res = true;
+      for (auto const &Event : Ready)
       {
-	 Res = select(Highest+1,&RFds,&WFds,0,&tv);
+	 // a failing worker closes both of its descriptors
+	 auto const I = static_cast<Worker *>(Event.data);
+	 if ((Event.events & APT::Reactor::Read) && I->InFd == Event.fd)
+	    Res &= I->InFdReady();
+	 if ((Event.events & APT::Reactor::Write) && I->OutFd == Event.fd && I->OutReady)
+	    Res &= I->OutFdReady();
       }
-      while (Res < 0 && errno == EINTR);
-      
-      if (Res < 0)
-      {
-	 _error->Errno("select","Select has failed");
+      if (not Res)
 	 break;
-      }
-
-      if(RunFds(&RFds,&WFds) == false)
-         break;
 
       // Timeout, notify the log class
-      if (Res == 0 || (Log != 0 && Log->Update == true))
+      if (Ready.empty() || (Log != 0 && Log->Update == true))
       {
-	 tv = SteadyDurationToTimeVal(std::chrono::microseconds(PulseInterval));
+	 pulse = clock::now() + std::chrono::microseconds(PulseInterval);
 
 	 for (Worker *I = Workers; I != 0; I = I->NextAcquire)
 	    I->Pulse();
@@ -783,13 +888,18 @@ pkgAcquire::RunResult pkgAcquire::Run(int PulseInterval)
 	    WasCancelled = true;
 	    break;
 	 }
-      }      
+      }
    }
 stop:
    if (Log != 0)
       Log->Stop();
-   
+
    // Shut down the acquire bits
+   for (Worker *I = Workers; I != nullptr; I = I->NextAcquire)
+   {
+      Events.Forget(I->InFd);
+      Events.Forget(I->OutFd);
+   }
    Running = false;
    for (Queue *I = Queues; I != 0; I = I->Next)
       I->Shutdown(false);
@@ -990,7 +1100,7 @@ void pkgAcquire::MethodConfig::SetSendURIEncoded(bool const value)	/*{{{*/
 // Queue::Queue - Constructor						/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-pkgAcquire::Queue::Queue(string const &name,pkgAcquire * const owner) : d(NULL), Next(0),
+pkgAcquire::Queue::Queue(string const &name,pkgAcquire * const owner) : d(new Private()), Next(0),
    Name(name), Items(0), Workers(0), Owner(owner), PipeDepth(0), MaxPipeDepth(1)
 {
 }
@@ -1008,6 +1118,7 @@ pkgAcquire::Queue::~Queue()
       Items = Items->Next;
       delete Jnk;
    }
+   delete d;
 }
 									/*}}}*/
 // Queue::Enqueue - Queue an item to the queue				/*{{{*/
@@ -1228,7 +1339,7 @@ bool pkgAcquire::Queue::Cycle()
    QItem *I = Items;
    int ActivePriority = 0;
    auto currentTime = clock::now();
-   while (PipeDepth < static_cast<decltype(PipeDepth)>(MaxPipeDepth))
+   while (d->MaxWorkers > 1 || PipeDepth < static_cast<decltype(PipeDepth)>(MaxPipeDepth))
    {
       for (; I != 0; I = I->Next) {
 	 if (I->Owner->Status == pkgAcquire::Item::StatFetching)
@@ -1250,11 +1361,23 @@ bool pkgAcquire::Queue::Cycle()
       if (I->GetFetchAfter() > currentTime)
 	 return true;
 
-      I->Worker = Workers;
-      for (auto const &O: I->Owners)
+      // Spread the items over multiple connections, largest first, so
+      // that they all finish at about the same time
+      pkgAcquire::Worker *W = Workers;
+      QItem *Next = I;
+      if (d->MaxWorkers > 1)
+      {
+	 W = Private::LeastBusyWorker(this);
+	 if (W == nullptr)
+	    return not _error->PendingError();
+	 Next = Private::LargestIdleItem(I, currentTime);
+      }
+
+      Next->Worker = W;
+      for (auto const &O: Next->Owners)
 	 O->Status = pkgAcquire::Item::StatFetching;
       PipeDepth++;
-      if (Workers->QueueItem(I) == false)
+      if (W->QueueItem(Next) == false)
 	 return false;
    }
 
@@ -409,8 +409,8 @@ class APT_PUBLIC pkgAcquire::Queue
    friend class pkgAcquire::UriIterator;
    friend class pkgAcquire::Worker;
 
-   /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   class Private;
+   Private * const d;
 
    /** \brief The next queue in the pkgAcquire object's list of queues. */
    Queue *Next;
@@ -486,10 +486,9 @@ class APT_PUBLIC pkgAcquire::Queue
 
    /** \brief The head of the list of workers associated with this queue.
     *
-    *  \todo This is plural because support exists in Queue for
-    *  multiple workers.  However, it does not appear that there is
-    *  any way to actually associate more than one worker with a
-    *  queue.
+    *  Queues for a host can open up to Acquire::QueueHost::Connections
+    *  connections to it, each with its own worker. Additional workers
+    *  are started by Cycle() once all existing ones are busy.
     *
     *  \todo Why not just use a std::set?
     */
@@ -499,12 +498,12 @@ class APT_PUBLIC pkgAcquire::Queue
    pkgAcquire *Owner;
 
    /** \brief The number of entries in this queue that are currently
-    *  being downloaded.
+    *  being downloaded by all of its workers.
     */
    signed long PipeDepth;
 
-   /** \brief The maximum number of entries that this queue will
-    *  attempt to download at once.
+   /** \brief The maximum number of entries that each worker of this queue
+    *  will attempt to download at once.
     */
    unsigned long MaxPipeDepth;
    
@@ -571,9 +570,11 @@ class APT_PUBLIC pkgAcquire::Queue
     */
    bool Shutdown(bool Final);
 
-   /** \brief Send idle items to the worker process.
+   /** \brief Send idle items to the worker processes.
     *
     *  Fills up the pipeline by inserting idle items into the worker's queue.
+    *  With multiple workers the largest idle item is handed to the worker
+    *  with the fewest bytes outstanding.
     */
    bool Cycle();
 
@@ -10,6 +10,9 @@
 
 #include <apt-pkg/cachefilter-patterns.h>
 
+#include <algorithm>
+#include <numeric>
+
 #include <apti18n.h>
 
 using namespace std::literals;
@@ -423,6 +426,47 @@ bool PatternTreeParser::PatternNode::matches(std::string_view name, int min, int
    return true;
 }
 
+static size_t patternCost(PatternTreeParser::Node const *const nodeP, PatternParser::Costs &costs);
+// Rough cost of evaluating a pattern, so ?and and ?or can try cheap ones first
+static size_t estimatePatternCost(PatternTreeParser::Node const *const nodeP, PatternParser::Costs &costs)
+{
+   auto node = dynamic_cast<PatternTreeParser::PatternNode const *>(nodeP);
+   if (node == nullptr)
+      return 0;
+   size_t arguments = 0;
+   for (auto const &arg : node->arguments)
+      arguments += patternCost(arg.get(), costs);
+
+   auto const term = node->term;
+   // flags and states stored with the package
+   for (auto const cheap : {"?automatic"sv, "?broken"sv, "?config-files"sv, "?essential"sv, "?exact-name"sv,
+			    "?false"sv, "?garbage"sv, "?installed"sv, "?true"sv, "?upgradable"sv, "?virtual"sv})
+      if (term == cheap)
+	 return 1;
+   if (term == "?not"sv || term == "?and"sv || term == "?or"sv)
+      return std::max<size_t>(arguments, 1);
+   if (term == "?all-versions"sv || term == "?any-version"sv || term == "?narrow"sv)
+      return 2 * std::max<size_t>(arguments, 1);
+   // regular expressions on strings shared by many packages and versions
+   for (auto const shared : {"?architecture"sv, "?archive"sv, "?codename"sv, "?name"sv, "?origin"sv, "?priority"sv, "?section"sv})
+      if (term == shared)
+	 return 4;
+   // walking the dependencies
+   if (term.find("depends"sv) != std::string_view::npos || term.starts_with("?reverse-"sv) ||
+       arguments != 0)
+      return 50 + 10 * arguments;
+   return 8;
+}
+// nested ?and and ?or ask again for the arguments already estimated for their parent
+static size_t patternCost(PatternTreeParser::Node const *const nodeP, PatternParser::Costs &costs)
+{
+   if (auto const known = costs.find(nodeP); known != costs.end())
+      return known->second;
+   auto const cost = estimatePatternCost(nodeP, costs);
+   costs.emplace(nodeP, cost);
+   return cost;
+}
+
 std::unique_ptr<APT::CacheFilter::Matcher> PatternParser::aPattern(std::unique_ptr<PatternTreeParser::Node> &nodeP)
 {
    assert(nodeP != nullptr);
@@ -495,7 +539,7 @@ std::unique_ptr<APT::CacheFilter::Matcher> PatternParser::aPattern(std::unique_p
    if (node->matches("?installed", 0, 0))
       return std::make_unique<Patterns::PackageIsInstalled>(file);
    if (node->matches("?name", 1, 1))
-      return std::make_unique<APT::CacheFilter::PackageNameMatchesRegEx>(aWord(node->arguments[0]));
+      return std::make_unique<Patterns::PackageNameMatchesRegEx>(aWord(node->arguments[0]));
    if (node->matches("?not", 1, 1))
       return std::make_unique<APT::CacheFilter::NOTMatcher>(aPattern(node->arguments[0]).release());
    if (node->matches("?obsolete", 0, 0))
@@ -524,11 +568,20 @@ std::unique_ptr<APT::CacheFilter::Matcher> PatternParser::aPattern(std::unique_p
       return std::make_unique<APT::CacheFilter::PackageNameMatchesFnmatch>(aWord(node->arguments[0]));
 
    // Variable argument patterns
+   // the result doesn't depend on the order, so evaluate the cheap arguments first
+   auto const byCost = [&](auto &arguments) {
+      std::vector<size_t> cost(arguments.size());
+      std::transform(arguments.begin(), arguments.end(), cost.begin(), [&](auto const &arg) { return patternCost(arg.get(), costs); });
+      std::vector<size_t> order(arguments.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(), [&](size_t const a, size_t const b) { return cost[a] < cost[b]; });
+      return order;
+   };
    if (node->matches("?and", 0, -1) || node->matches("?narrow", 0, -1))
    {
       auto pattern = std::make_unique<APT::CacheFilter::ANDMatcher>();
-      for (auto &arg : node->arguments)
-	 pattern->AND(aPattern(arg).release());
+      for (auto const i : byCost(node->arguments))
+	 pattern->AND(aPattern(node->arguments[i]).release());
       if (node->term == "?narrow")
 	 return std::make_unique<Patterns::VersionIsAnyVersion>(std::move(pattern));
       return pattern;
@@ -537,8 +590,8 @@ std::unique_ptr<APT::CacheFilter::Matcher> PatternParser::aPattern(std::unique_p
    {
       auto pattern = std::make_unique<APT::CacheFilter::ORMatcher>();
 
-      for (auto &arg : node->arguments)
-	 pattern->OR(aPattern(arg).release());
+      for (auto const i : byCost(node->arguments))
+	 pattern->OR(aPattern(node->arguments[i]).release());
       return pattern;
    }
 
@@ -561,6 +614,21 @@ namespace Patterns
 
 BaseRegexMatcher::BaseRegexMatcher(std::string const &Pattern)
 {
+   std::string_view word{Pattern};
+   anchorStart = word.starts_with('^');
+   if (anchorStart)
+      word.remove_prefix(1);
+   anchorEnd = word.ends_with('$');
+   if (anchorEnd)
+      word.remove_suffix(1);
+   if (word.empty() == false && std::all_of(word.begin(), word.end(), [](char const c) {
+	  return isalpha_ascii(c) || (c >= '0' && c <= '9') || c == '-' || c == '_';
+       }))
+   {
+      literal.emplace(word);
+      std::transform(literal->begin(), literal->end(), literal->begin(), tolower_ascii);
+   }
+
    pattern.emplace();
    int const Res = regcomp(&*pattern, Pattern.c_str(), REG_EXTENDED | REG_ICASE | REG_NOSUB);
    if (Res == 0)
@@ -576,8 +644,19 @@ bool BaseRegexMatcher::operator()(const char *string)
 {
    if (unlikely(pattern == std::nullopt) || string == nullptr)
       return false;
-   else
-      return regexec(&*pattern, string, 0, 0, 0) == 0;
+   if (literal)
+   {
+      std::string_view const s{string};
+      auto const equal = [](char const a, char const b) { return tolower_ascii(a) == b; };
+      if (anchorStart && anchorEnd)
+	 return s.size() == literal->size() && std::equal(s.begin(), s.end(), literal->begin(), equal);
+      if (anchorStart)
+	 return s.size() >= literal->size() && std::equal(literal->begin(), literal->end(), s.begin(), [&](char const l, char const c) { return equal(c, l); });
+      if (anchorEnd)
+	 return s.size() >= literal->size() && std::equal(literal->begin(), literal->end(), s.end() - literal->size(), [&](char const l, char const c) { return equal(c, l); });
+      return std::search(s.begin(), s.end(), literal->begin(), literal->end(), equal) != s.end();
+   }
+   return regexec(&*pattern, string, 0, 0, 0) == 0;
 }
 BaseRegexMatcher::~BaseRegexMatcher()
 {
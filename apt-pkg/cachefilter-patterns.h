@@ -20,6 +20,7 @@
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace APT
@@ -137,6 +138,8 @@ struct APT_PUBLIC PatternTreeParser
 struct APT_HIDDEN PatternParser
 {
    pkgCacheFile *file;
+   using Costs = std::unordered_map<PatternTreeParser::Node const *, size_t>;
+   Costs costs{};
 
    std::unique_ptr<APT::CacheFilter::Matcher> aPattern(std::unique_ptr<PatternTreeParser::Node> &nodeP);
    std::string aWord(std::unique_ptr<PatternTreeParser::Node> &nodeP);
@@ -147,9 +150,13 @@ namespace Patterns
 using namespace APT::CacheFilter;
 
 /** \brief Basic helper class for matching regex */
-class BaseRegexMatcher
+class APT_PUBLIC BaseRegexMatcher
 {
    std::optional<regex_t> pattern;
+   // a regex which is just a word, maybe anchored, is matched without regexec
+   std::optional<std::string> literal;
+   bool anchorStart = false;
+   bool anchorEnd = false;
 
    public:
    BaseRegexMatcher(std::string const &string);
@@ -161,6 +168,28 @@ class BaseRegexMatcher
    }
 };
 
+/** \brief Regex matcher remembering its results per item of the cache
+ *
+ * Many versions share the strings the patterns look at, like all versions
+ * from an archive share its package file or all packages in a group share
+ * its name, so the regex only runs once for each of those items.
+ */
+class CachedRegexMatcher : public BaseRegexMatcher
+{
+   std::vector<signed char> results;
+
+   public:
+   using BaseRegexMatcher::BaseRegexMatcher;
+   bool operator()(size_t const id, const char *string)
+   {
+      if (id >= results.size())
+	 results.resize(id + 1, -1);
+      if (results[id] == -1)
+	 results[id] = BaseRegexMatcher::operator()(string);
+      return results[id] == 1;
+   }
+};
+
 struct APT_HIDDEN PackageIsAutomatic : public PackageMatcher
 {
    pkgCacheFile *Cache;
@@ -210,6 +239,20 @@ struct APT_HIDDEN PackageIsEssential : public PackageMatcher
    }
 };
 
+struct APT_HIDDEN PackageNameMatchesRegEx : public PackageMatcher
+{
+   CachedRegexMatcher matcher;
+   explicit PackageNameMatchesRegEx(std::string const &pattern) : matcher(pattern) {}
+   bool operator()(pkgCache::PkgIterator const &Pkg) override
+   {
+      return matcher(Pkg.Group()->ID, Pkg.Name());
+   }
+   bool operator()(pkgCache::GrpIterator const &Grp) override
+   {
+      return matcher(Grp->ID, Grp.Name());
+   }
+};
+
 struct APT_HIDDEN PackageHasExactName : public PackageMatcher
 {
    std::string name;
@@ -376,13 +419,14 @@ struct APT_HIDDEN VersionIsAnyVersion : public VersionAnyMatcher
 
 struct APT_HIDDEN VersionIsArchive : public VersionAnyMatcher
 {
-   BaseRegexMatcher matcher;
+   CachedRegexMatcher matcher;
    VersionIsArchive(std::string const &pattern) : matcher(pattern) {}
    bool operator()(pkgCache::VerIterator const &Ver) override
    {
       for (auto VF = Ver.FileList(); not VF.end(); VF++)
       {
-	 if (VF.File().Archive() && matcher(VF.File().Archive()))
+	 auto const File = VF.File();
+	 if (File.Archive() && matcher(File->ID, File.Archive()))
 	    return true;
       }
       return false;
@@ -391,13 +435,14 @@ struct APT_HIDDEN VersionIsArchive : public VersionAnyMatcher
 
 struct APT_HIDDEN VersionIsCodename : public VersionAnyMatcher
 {
-   BaseRegexMatcher matcher;
+   CachedRegexMatcher matcher;
    VersionIsCodename(std::string const &pattern) : matcher(pattern) {}
    bool operator()(pkgCache::VerIterator const &Ver) override
    {
       for (auto VF = Ver.FileList(); not VF.end(); VF++)
       {
-	 if (VF.File().Codename() && matcher(VF.File().Codename()))
+	 auto const File = VF.File();
+	 if (File.Codename() && matcher(File->ID, File.Codename()))
 	    return true;
       }
       return false;
@@ -406,13 +451,14 @@ struct APT_HIDDEN VersionIsCodename : public VersionAnyMatcher
 
 struct APT_HIDDEN VersionIsOrigin : public VersionAnyMatcher
 {
-   BaseRegexMatcher matcher;
+   CachedRegexMatcher matcher;
    VersionIsOrigin(std::string const &pattern) : matcher(pattern) {}
    bool operator()(pkgCache::VerIterator const &Ver) override
    {
       for (auto VF = Ver.FileList(); not VF.end(); VF++)
       {
-	 if (VF.File().Origin() && matcher(VF.File().Origin()))
+	 auto const File = VF.File();
+	 if (File.Origin() && matcher(File->ID, File.Origin()))
 	    return true;
       }
       return false;
@@ -422,10 +468,15 @@ struct APT_HIDDEN VersionIsOrigin : public VersionAnyMatcher
 struct APT_HIDDEN VersionIsSection : public VersionAnyMatcher
 {
    BaseRegexMatcher matcher;
+   // sections are stored once in the cache, so their offset identifies them
+   std::unordered_map<uint32_t, bool> results;
    VersionIsSection(std::string const &pattern) : matcher(pattern) {}
    bool operator()(pkgCache::VerIterator const &Ver) override
    {
-      return matcher(Ver.Section());
+      auto const R = results.try_emplace(uint32_t(Ver->Section), false);
+      if (R.second)
+	 R.first->second = matcher(Ver.Section());
+      return R.first->second;
    }
 };
 
@@ -62,6 +62,7 @@
 #include <array>
 #include <memory>
 #include <set>
+#include <thread>
 
 #ifdef HAVE_ZLIB
 #include <zlib.h>
@@ -1797,6 +1798,25 @@ bool InternalOpen(int const iFd, unsigned int const Mode) override
 #endif
 };
 									/*}}}*/
+#if defined(HAVE_ZSTD) || defined(HAVE_LZMA)
+/* The number of threads to compress with, requested like for the xz and zstd
+   binaries with a -T option in the CompressArg list; 0 means one per core */
+static unsigned int findCompressThreads(std::vector<std::string> const &Args) /*{{{*/
+{
+   for (auto a = Args.rbegin(); a != Args.rend(); ++a)
+   {
+      if (a->size() < 3 || a->compare(0, 2, "-T") != 0 ||
+	  a->find_first_not_of("0123456789", 2) != std::string::npos)
+	 continue;
+      unsigned long const Threads = strtoul(a->c_str() + 2, nullptr, 10);
+      if (Threads == 0)
+	 return std::max(1u, std::thread::hardware_concurrency());
+      return std::min(Threads, 256ul);
+   }
+   return 1;
+}
+									/*}}}*/
+#endif
 class APT_HIDDEN ZstdFileFdPrivate : public FileFdPrivate		/*{{{*/
 {
 #ifdef HAVE_ZSTD
@@ -1818,6 +1838,11 @@ class APT_HIDDEN ZstdFileFdPrivate : public FileFdPrivate		/*{{{*/
       {
 	 cctx = ZSTD_createCStream();
 	 res = ZSTD_initCStream(cctx, findLevel(compressor.CompressArgs));
+#if ZSTD_VERSION_NUMBER >= 10400
+	 // libraries built without thread support refuse this, so ignore it
+	 if (unsigned int const threads = findCompressThreads(compressor.CompressArgs); ZSTD_isError(res) == false && threads > 1)
+	    ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, threads);
+#endif
 	 zstd_buffer.reset(APT_BUFFER_SIZE);
       }
       else
@@ -2052,7 +2077,7 @@ class APT_HIDDEN LzmaFileFdPrivate: public FileFdPrivate {		/*{{{*/
    static uint32_t findXZlevel(std::vector<std::string> const &Args)
    {
       for (auto a = Args.rbegin(); a != Args.rend(); ++a)
-	 if (a->empty() == false && (*a)[0] == '-' && (*a)[1] != '-')
+	 if (a->empty() == false && (*a)[0] == '-' && (*a)[1] != '-' && (*a)[1] != 'T')
 	 {
 	    auto const number = a->find_last_of("0123456789");
 	    if (number == std::string::npos)
@@ -2099,6 +2124,18 @@ bool InternalOpen(int const iFd, unsigned int const Mode) override
       uint32_t const xzlevel = findXZlevel(compressor.CompressArgs);
       if (compressor.Name == "xz")
       {
+#if LZMA_VERSION >= 50020002
+	 if (unsigned int const threads = findCompressThreads(compressor.CompressArgs); threads > 1)
+	 {
+	    lzma_mt mt = {};
+	    mt.threads = threads;
+	    mt.preset = xzlevel;
+	    mt.check = LZMA_CHECK_CRC64;
+	    if (lzma_stream_encoder_mt(&lzma->stream, &mt) != LZMA_OK)
+	       return false;
+	 }
+	 else
+#endif
 	 if (lzma_easy_encoder(&lzma->stream, xzlevel, LZMA_CHECK_CRC64) != LZMA_OK)
 	    return false;
       }
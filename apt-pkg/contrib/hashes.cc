@@ -23,12 +23,19 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <span>
 #include <string>
+#include <thread>
+#include <vector>
 #include <unistd.h>
 
 #include <openssl/err.h>
@@ -316,6 +323,106 @@ static APT_PURE std::string HexDigest(std::span<unsigned char> const &Sum)
    return Result;
 };
 
+// ParallelHashes - Update contexts on worker threads			/*{{{*/
+/* Each given context is updated on a thread of its own, so that hashing
+   costs about as much as the slowest algorithm instead of the sum of all.
+   The data is copied into a small ring of buffers which every worker walks
+   through in order; a buffer is refilled once all workers are done with it. */
+class ParallelHashes
+{
+   static constexpr size_t SlotSize = 4 * APT_BUFFER_SIZE;
+   struct Slot
+   {
+      std::unique_ptr<unsigned char[]> Data{new unsigned char[SlotSize]};
+      size_t Size{0};
+      size_t Pending{0};
+   };
+
+   std::mutex Lock;
+   std::condition_variable Changed;
+   std::array<Slot, 4> Ring;
+   unsigned long long Produced{0};
+   size_t Filled{0};
+   bool Stop{false};
+   std::vector<std::thread> Workers;
+
+   void Work(EVP_MD_CTX *const Context)
+   {
+      unsigned long long Consumed = 0;
+      std::unique_lock<std::mutex> Guard(Lock);
+      while (true)
+      {
+	 Changed.wait(Guard, [&] { return Consumed != Produced || Stop; });
+	 if (Consumed == Produced)
+	    return;
+	 Slot &S = Ring[Consumed % Ring.size()];
+	 Guard.unlock();
+	 EVP_DigestUpdate(Context, S.Data.get(), S.Size);
+	 Guard.lock();
+	 if (--S.Pending == 0)
+	    Changed.notify_all();
+	 ++Consumed;
+      }
+   }
+
+   void Publish()
+   {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Slot &S = Ring[Produced % Ring.size()];
+      S.Size = Filled;
+      S.Pending = Workers.size();
+      ++Produced;
+      Filled = 0;
+      Changed.notify_all();
+   }
+
+   public:
+   void Write(unsigned char const *Data, size_t Size)
+   {
+      while (Size != 0)
+      {
+	 Slot &S = Ring[Produced % Ring.size()];
+	 if (Filled == 0)
+	 {
+	    std::unique_lock<std::mutex> Guard(Lock);
+	    Changed.wait(Guard, [&] { return S.Pending == 0; });
+	 }
+	 size_t const n = std::min(Size, SlotSize - Filled);
+	 memcpy(S.Data.get() + Filled, Data, n);
+	 Filled += n;
+	 Data += n;
+	 Size -= n;
+	 if (Filled == SlotSize)
+	    Publish();
+      }
+   }
+
+   // wait until the workers have hashed all data written so far
+   void Drain()
+   {
+      if (Filled != 0)
+	 Publish();
+      std::unique_lock<std::mutex> Guard(Lock);
+      Changed.wait(Guard, [&] { return std::all_of(Ring.begin(), Ring.end(), [](Slot const &S) { return S.Pending == 0; }); });
+   }
+
+   explicit ParallelHashes(std::vector<EVP_MD_CTX *> const &Contexts)
+   {
+      for (auto const Context : Contexts)
+	 Workers.emplace_back(&ParallelHashes::Work, this, Context);
+   }
+   ~ParallelHashes()
+   {
+      {
+	 std::lock_guard<std::mutex> Guard(Lock);
+	 Stop = true;
+	 Changed.notify_all();
+      }
+      for (auto &W : Workers)
+	 W.join();
+   }
+};
+									/*}}}*/
 // PrivateHashes							/*{{{*/
 class PrivateHashes
 {
@@ -324,6 +431,26 @@ class PrivateHashes
 
    private:
    std::array<EVP_MD_CTX *, 4> contexts{};
+   /* Threads are only worth it for big inputs with more than one algorithm;
+      the context not handed to the workers is updated by the caller. */
+   static constexpr unsigned long long ParallelThreshold = 1024 * 1024;
+   std::unique_ptr<ParallelHashes> Parallel;
+   EVP_MD_CTX *Serial{nullptr};
+   bool ParallelChecked{false};
+
+   void StartParallel()
+   {
+      ParallelChecked = true;
+      if (std::thread::hardware_concurrency() < 2 || _config->FindB("APT::Hashes::Parallel", true) == false)
+	 return;
+      std::vector<EVP_MD_CTX *> Contexts;
+      std::copy_if(contexts.begin(), contexts.end(), std::back_inserter(Contexts), [](auto const ctx) { return ctx != nullptr; });
+      if (Contexts.size() < 2)
+	 return;
+      Serial = Contexts.front();
+      Contexts.erase(Contexts.begin());
+      Parallel = std::make_unique<ParallelHashes>(Contexts);
+   }
 
    public:
    struct HashAlgo
@@ -343,6 +470,14 @@ class PrivateHashes
 
    bool Write(unsigned char const *Data, size_t Size)
    {
+      if (not ParallelChecked && FileSize + Size >= ParallelThreshold)
+	 StartParallel();
+      if (Parallel != nullptr)
+      {
+	 Parallel->Write(Data, Size);
+	 EVP_DigestUpdate(Serial, Data, Size);
+	 return true;
+      }
       for (auto &context : contexts)
       {
 	 if (context)
@@ -358,6 +493,8 @@ class PrivateHashes
       // dereference it, so bail out with an empty digest instead of crashing.
       if (contexts[algo.index] == nullptr)
 	 return std::string();
+      if (Parallel != nullptr)
+	 Parallel->Drain();
 
       auto Size = EVP_MD_size(algo.evpLink());
       unsigned char Sum[Size];
@@ -396,6 +533,7 @@ class PrivateHashes
    explicit PrivateHashes() {}
    ~PrivateHashes()
    {
+      Parallel.reset();
       for (auto ctx : contexts)
 	 if (ctx != nullptr)
 	    EVP_MD_CTX_free(ctx);
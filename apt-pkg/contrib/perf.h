@@ -17,6 +17,9 @@
 #include <cstdlib>
 #include <cstring>
 #include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <fcntl.h>
 #include <linux/perf_event.h>
@@ -62,6 +65,8 @@ class PerformanceContext
    std::string name;
    /// FDs to communicate with the kernel
    std::array<int, measurements.size()> fds;
+   /// Counters provided by the code being measured
+   std::vector<std::pair<std::string, long long>> counters;
 
    // Wrapper for the system call
    static long perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
@@ -101,6 +106,12 @@ class PerformanceContext
       for (auto fd : fds)
 	 must_succeed(fd == -1 || ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) != -1);
    }
+   /// Record a counter of the code being measured, such as the number of conflicts in the solver
+   void Set(std::string name, long long value)
+   {
+      if (unlikely(not out.empty()))
+	 counters.emplace_back(std::move(name), value);
+   }
    /// Collect the results and store them in the specified performance file
    ~PerformanceContext()
    {
@@ -123,6 +134,8 @@ class PerformanceContext
 	 ss << ", ";
 	 ss << '"' << measurements[i].name << '"' << ": " << values[i];
       }
+      for (auto const &[name, value] : counters)
+	 ss << ", " << '"' << name << '"' << ": " << value;
 
       ss << "}\n";
 
@@ -147,6 +160,7 @@ struct PerformanceContext
 {
    PerformanceContext(const char *) {};
    ~PerformanceContext() {};
+   void Set(const char *, long long) {};
 };
 } // namespace APT
 #endif
@@ -0,0 +1,283 @@
+/*
+ * reactor.cc - Wait for file descriptors to become ready
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#include <config.h>
+
+#include <apt-pkg/error.h>
+#include <apt-pkg/reactor.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+#include <unistd.h>
+
+#include <apti18n.h>
+
+namespace APT
+{
+
+struct Reactor::Private
+{
+   struct Entry
+   {
+      unsigned events;
+      void *data;
+      // watched since the last Wait()
+      bool watched;
+      // not supported by epoll (regular files), always ready
+      bool always;
+   };
+   std::unordered_map<int, Entry> entries;
+
+#ifdef __linux__
+   int epfd{-1};
+   int timerfd{-1};
+   clock::time_point armed{};
+   std::vector<epoll_event> buffer;
+
+   static uint32_t ToEpoll(unsigned events)
+   {
+      uint32_t res = 0;
+      if (events & Read)
+	 res |= EPOLLIN;
+      if (events & Write)
+	 res |= EPOLLOUT;
+      if (events & EdgeTriggered)
+	 res |= EPOLLET;
+      return res;
+   }
+   static unsigned FromEpoll(uint32_t revents, unsigned requested)
+   {
+      unsigned res = 0;
+      if (revents & EPOLLIN)
+	 res |= Read;
+      if (revents & EPOLLOUT)
+	 res |= Write;
+      if (revents & (EPOLLERR | EPOLLHUP))
+	 res |= requested;
+      return res & (Read | Write);
+   }
+   bool Arm(clock::time_point deadline)
+   {
+      if (armed == deadline)
+	 return true;
+      auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+      struct itimerspec spec{};
+      spec.it_value.tv_sec = ns / 1000000000;
+      spec.it_value.tv_nsec = ns % 1000000000;
+      // steady_clock is CLOCK_MONOTONIC, so the deadline can be absolute
+      if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, nullptr) != 0)
+	 return _error->Errno("timerfd_settime", "Failed to set up the timer");
+      armed = deadline;
+      return true;
+   }
+#endif
+};
+
+Reactor::Reactor() : d(new Private())					/*{{{*/
+{
+#ifdef __linux__
+   d->epfd = epoll_create1(EPOLL_CLOEXEC);
+   d->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (d->epfd != -1 && d->timerfd != -1)
+   {
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.fd = d->timerfd;
+      if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->timerfd, &ev) != 0)
+      {
+	 close(d->timerfd);
+	 d->timerfd = -1;
+      }
+   }
+#endif
+}
+									/*}}}*/
+Reactor::~Reactor()							/*{{{*/
+{
+#ifdef __linux__
+   if (d->timerfd != -1)
+      close(d->timerfd);
+   if (d->epfd != -1)
+      close(d->epfd);
+#endif
+}
+									/*}}}*/
+bool Reactor::Watch(int fd, unsigned events, void *data)		/*{{{*/
+{
+   if (fd < 0 || (events & (Read | Write)) == 0)
+      return true;
+
+   auto [it, inserted] = d->entries.try_emplace(fd, Private::Entry{events, data, true, false});
+   auto &entry = it->second;
+   if (not inserted && entry.events == events && entry.data == data)
+   {
+      entry.watched = true;
+      return true;
+   }
+#ifdef __linux__
+   if (d->epfd == -1 || d->timerfd == -1)
+   {
+      d->entries.erase(it);
+      return _error->Errno("epoll_create", "Failed to create an event loop");
+   }
+
+   // A new owner may well mean a new file behind the same number, so
+   // register it from scratch rather than modifying the old one.
+   int op = EPOLL_CTL_ADD;
+   if (not inserted && not entry.always)
+   {
+      if (entry.data == data)
+	 op = EPOLL_CTL_MOD;
+      else
+	 epoll_ctl(d->epfd, EPOLL_CTL_DEL, fd, nullptr);
+   }
+   entry = Private::Entry{events, data, true, false};
+
+   epoll_event ev{};
+   ev.events = Private::ToEpoll(events);
+   ev.data.fd = fd;
+   int res = epoll_ctl(d->epfd, op, fd, &ev);
+   if (res != 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+      res = epoll_ctl(d->epfd, EPOLL_CTL_ADD, fd, &ev);
+   if (res != 0)
+   {
+      if (errno == EPERM)
+	 entry.always = true;
+      else
+      {
+	 d->entries.erase(it);
+	 return _error->Errno("epoll_ctl", "Failed to watch file descriptor %d", fd);
+      }
+   }
+#else
+   entry = Private::Entry{events, data, true, false};
+#endif
+   return true;
+}
+									/*}}}*/
+void Reactor::Forget(int fd)						/*{{{*/
+{
+   auto it = d->entries.find(fd);
+   if (it == d->entries.end())
+      return;
+#ifdef __linux__
+   if (not it->second.always)
+      epoll_ctl(d->epfd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+   d->entries.erase(it);
+}
+									/*}}}*/
+bool Reactor::Wait(std::vector<Event> &ready, clock::time_point deadline) /*{{{*/
+{
+   ready.clear();
+   for (auto it = d->entries.begin(); it != d->entries.end();)
+   {
+      if (not it->second.watched)
+      {
+#ifdef __linux__
+	 if (not it->second.always)
+	    epoll_ctl(d->epfd, EPOLL_CTL_DEL, it->first, nullptr);
+#endif
+	 it = d->entries.erase(it);
+	 continue;
+      }
+      it->second.watched = false;
+      if (it->second.always)
+	 ready.push_back(Event{it->first, it->second.events & (Read | Write), it->second.data});
+      ++it;
+   }
+
+#ifdef __linux__
+   if (d->epfd == -1 || d->timerfd == -1)
+      return _error->Errno("epoll_create", "Failed to create an event loop");
+
+   d->buffer.resize(d->entries.size() + 1);
+   while (true)
+   {
+      int timeout = -1;
+      if (not ready.empty() || deadline <= clock::now())
+	 timeout = 0;
+      else if (deadline != clock::time_point::max() && not d->Arm(deadline))
+	 return false;
+
+      int const Res = epoll_wait(d->epfd, d->buffer.data(), d->buffer.size(), timeout);
+      if (Res < 0 && errno == EINTR)
+	 continue;
+      if (Res < 0)
+	 return _error->Errno("epoll_wait", _("Select failed"));
+
+      for (int i = 0; i < Res; ++i)
+      {
+	 auto const &ev = d->buffer[i];
+	 if (ev.data.fd == d->timerfd)
+	 {
+	    uint64_t expirations;
+	    if (read(d->timerfd, &expirations, sizeof(expirations)) == sizeof(expirations))
+	       d->armed = clock::time_point{};
+	    continue;
+	 }
+	 auto const entry = d->entries.find(ev.data.fd);
+	 if (entry == d->entries.end())
+	    continue;
+	 auto const events = Private::FromEpoll(ev.events, entry->second.events);
+	 if (events != 0)
+	    ready.push_back(Event{ev.data.fd, events, entry->second.data});
+      }
+
+      // Only the timer fired, but it was set for an earlier deadline
+      if (ready.empty() && timeout != 0 && clock::now() < deadline)
+	 continue;
+      return true;
+   }
+#else
+   std::vector<pollfd> fds;
+   fds.reserve(d->entries.size());
+   for (auto const &[fd, entry] : d->entries)
+      fds.push_back(pollfd{fd, static_cast<short>(((entry.events & Read) ? POLLIN : 0) | ((entry.events & Write) ? POLLOUT : 0)), 0});
+   while (true)
+   {
+      int timeout = -1;
+      if (deadline != clock::time_point::max())
+      {
+	 auto const now = clock::now();
+	 // round up, we do not want to wake up right before the deadline
+	 timeout = deadline <= now ? 0 : std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+      }
+      int const Res = poll(fds.data(), fds.size(), timeout);
+      if (Res < 0 && errno == EINTR)
+	 continue;
+      if (Res < 0)
+	 return _error->Errno("poll", _("Select failed"));
+      for (auto const &pfd : fds)
+      {
+	 if (pfd.revents == 0)
+	    continue;
+	 auto const &entry = d->entries[pfd.fd];
+	 unsigned events = 0;
+	 if (pfd.revents & POLLIN)
+	    events |= Read;
+	 if (pfd.revents & POLLOUT)
+	    events |= Write;
+	 if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+	    events |= entry.events;
+	 ready.push_back(Event{pfd.fd, events & (Read | Write), entry.data});
+      }
+      return true;
+   }
+#endif
+}
+									/*}}}*/
+
+} // namespace APT
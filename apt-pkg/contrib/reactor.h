@@ -0,0 +1,75 @@
+/*
+ * reactor.h - Wait for file descriptors to become ready
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#ifndef APT_REACTOR_H
+#define APT_REACTOR_H
+#include <apt-pkg/header-is-private.h>
+#include <apt-pkg/macros.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace APT
+{
+
+/**
+ * \brief A persistent set of watched file descriptors
+ *
+ * This replaces the select() loops: Instead of building a new fd_set in
+ * each iteration, callers tell the reactor which descriptors they are
+ * interested in for the next Wait() and the reactor only tells the kernel
+ * about the differences to the previous iteration. On Linux this is backed
+ * by epoll with a timerfd for the deadline, elsewhere by poll().
+ *
+ * Descriptors not passed to Watch() again before a Wait() are dropped
+ * automatically. If a watched descriptor is closed and its number reused
+ * before the next Wait(), the owner has to Forget() it first.
+ */
+class APT_PUBLIC Reactor
+{
+   public:
+   using clock = std::chrono::steady_clock;
+
+   enum Flags : unsigned
+   {
+      Read = 1 << 0,
+      Write = 1 << 1,
+      /// Only report new data; the reader must consume until EAGAIN
+      EdgeTriggered = 1 << 2,
+   };
+
+   struct Event
+   {
+      int fd;
+      /// Read and/or Write; errors and hangups are reported as the requested events
+      unsigned events;
+      void *data;
+   };
+
+   /// \brief Watch \a fd for \a events in the next Wait(), reporting \a data
+   bool Watch(int fd, unsigned events, void *data = nullptr);
+   /// \brief Stop watching \a fd, e.g. because it is about to be closed
+   void Forget(int fd);
+   /**
+    * \brief Wait until watched descriptors are ready or \a deadline passed
+    *
+    * Ready descriptors are stored in \a ready, which is empty if the wait
+    * timed out. Regular files cannot be waited for and are always ready.
+    */
+   bool Wait(std::vector<Event> &ready, clock::time_point deadline = clock::time_point::max());
+
+   Reactor();
+   ~Reactor();
+
+   private:
+   struct Private;
+   std::unique_ptr<Private> d;
+};
+
+} // namespace APT
+
+#endif
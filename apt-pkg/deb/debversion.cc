@@ -200,6 +200,106 @@ int debVersioningSystem::DoCmpVersion(const char *A,const char *AEnd,
       return 0;
 }
 									/*}}}*/
+// debVS::ComparisonKey - Comparable form of a version			/*{{{*/
+// ---------------------------------------------------------------------
+/* Each fragment is encoded as its runs of non-digits and digits. A
+   non-digit is mapped to a byte ordered like in CmpFragment, a run of
+   digits to a byte for the number of its significant digits followed by
+   them, so a longer number is larger. A run of only zeros gets a byte of
+   its own below all numbers. As trailing zeros equal the end of the
+   fragment, they are dropped and the end is marked by a zero followed by
+   a byte which sorts between a tilde and everything else after it.
+   An empty fragment is special in CmpFragment and gets a byte of its own. */
+namespace
+{
+enum ComparisonKeyByte : unsigned char
+{
+   KeyTilde = 1,
+   KeyEmpty = 2,
+   KeyZero = 3,
+   KeyEnd = 4,
+   // followed by the count of significant digits and them
+   KeyNumber = KeyEnd,
+   KeyMaxDigits = 'A' - 1 - KeyNumber,
+};
+}
+static bool AppendFragmentKey(std::string &Key, const char *A, const char *AEnd)
+{
+   // CmpFragment has an empty fragment only above those starting with a tilde
+   if (A == AEnd)
+   {
+      Key.push_back(KeyEmpty);
+      return true;
+   }
+   size_t const Start = Key.size();
+   while (A != AEnd)
+   {
+      for (; A != AEnd && isdigit(*A) == 0; ++A)
+      {
+	 auto const c = static_cast<unsigned char>(*A);
+	 if (c == '~')
+	    Key.push_back(KeyTilde);
+	 else if (isalpha_ascii(c))
+	    Key.push_back(c);
+	 else if (c > ' ' && c < 0x7f)
+	    Key.push_back(c + 128);
+	 else
+	    return false;
+      }
+      for (; A != AEnd && *A == '0'; ++A)
+	 ;
+      auto const Digits = A;
+      for (; A != AEnd && isdigit(*A) != 0; ++A)
+	 ;
+      if (A == Digits)
+	 Key.push_back(KeyZero);
+      else if (A - Digits > KeyMaxDigits)
+	 return false;
+      else
+      {
+	 Key.push_back(KeyNumber + (A - Digits));
+	 Key.append(Digits, A);
+      }
+   }
+   if (Key.size() != Start && Key.back() == KeyZero)
+      Key.pop_back();
+   Key.push_back(KeyZero);
+   Key.push_back(KeyEnd);
+   return true;
+}
+bool debVersioningSystem::ComparisonKey(std::string &Key, const char *A, const char *AEnd)
+{
+   // split the version like DoCmpVersion does
+   const char *Colon = static_cast<const char *>(memchr(A, ':', AEnd - A));
+   if (Colon == nullptr)
+      Colon = A;
+   if (Colon != A)
+   {
+      for (; *A == '0'; ++A)
+	 ;
+      if (A == Colon)
+      {
+	 ++A;
+	 ++Colon;
+      }
+   }
+   if (AppendFragmentKey(Key, A, Colon) == false)
+      return false;
+   A = (Colon != A) ? Colon + 1 : Colon;
+
+   const char *Dash = static_cast<const char *>(memrchr(A, '-', AEnd - A));
+   // the special cases of an empty upstream version are left to DoCmpVersion
+   if (Dash == A || A == AEnd)
+      return false;
+   if (Dash == nullptr)
+   {
+      // no revision is treated like -0
+      char const *const null = "0";
+      return AppendFragmentKey(Key, A, AEnd) && AppendFragmentKey(Key, null, null + 1);
+   }
+   return AppendFragmentKey(Key, A, Dash) && AppendFragmentKey(Key, Dash + 1, AEnd);
+}
+									/*}}}*/
 // debVS::CheckDep - Check a single dependency				/*{{{*/
 // ---------------------------------------------------------------------
 /* This simply performs the version comparison and switch based on 
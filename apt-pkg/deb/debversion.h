@@ -33,6 +33,16 @@ class APT_PUBLIC debVersioningSystem : public pkgVersioningSystem
    }
    std::string UpstreamVersion(const char *A) override;
 
+   /** \brief Appends a key for the version to Key
+    *
+    *  Compared with memcmp(), keys of two versions are ordered like the
+    *  versions are by DoCmpVersion(). No key is a prefix of another one.
+    *
+    *  \return \b false if the version can't be encoded, e.g. for a number
+    *  with too many digits or characters outside of printable ASCII.
+    */
+   static bool ComparisonKey(std::string &Key, const char *A, const char *AEnd);
+
    debVersioningSystem();
 };
 
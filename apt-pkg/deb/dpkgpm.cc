@@ -1176,6 +1176,13 @@ void pkgDPkgPM::BuildPackagesProgressMap()
    }};
    static_assert(Item::Purge == 3, "Enum item has unexpected index for mapping array");
 
+   // the progress only covers this run: we are called again for each
+   // part of the installation after a media change or while fetching
+   PackageOps.clear();
+   PackageOpsDone.clear();
+   PackagesDone = 0;
+   PackagesTotal = 0;
+
    // init the PackageOps map, go over the list of packages that
    // that will be [installed|configured|removed|purged] and add
    // them to the PackageOps map (the dpkg states it goes through)
@@ -1454,6 +1461,97 @@ bool pkgDPkgPM::ExpandPendingCalls(std::vector<Item> &List, pkgDepCache &Cache)
    }
    return true;
 }
+// BatchDpkgCalls - Merge the operations into as few dpkg calls as possible /*{{{*/
+// ---------------------------------------------------------------------
+/* The ordering interleaves unpacks and configures of unrelated packages,
+   e.g. for immediate configuration, and each change of the operation is
+   a dpkg call of its own. Each operation is moved into the earliest call
+   of the same kind which comes after all calls with operations on
+   packages it is related to by a dependency of any type (in either
+   direction, of the installed or the candidate version), so those keep
+   their relative order. Dependencies within one call of the same kind
+   are fine as dpkg orders --configure itself and unpacks in the order
+   given. The pending calls at the end are left alone. */
+static std::pair<size_t, size_t> BatchDpkgCalls(std::vector<pkgDPkgPM::Item> &List, pkgDepCache &Cache)
+{
+   auto const Kind = [](pkgDPkgPM::Item const &I) {
+      return I.Op == pkgDPkgPM::Item::Purge ? pkgDPkgPM::Item::Remove : I.Op;
+   };
+   auto const Calls = [&](auto const Begin, auto const End) {
+      size_t Count = 0;
+      for (auto I = Begin; I != End; ++I)
+	 if (I == Begin || Kind(*std::prev(I)) != Kind(*I))
+	    ++Count;
+      return Count;
+   };
+   auto const Tail = std::find_if(List.begin(), List.end(), [](pkgDPkgPM::Item const &I) { return I.Pkg.end(); });
+   size_t const Before = Calls(List.begin(), Tail);
+
+   // for each package the latest call per kind with an operation on the package or related to it
+   constexpr size_t Kinds = pkgDPkgPM::Item::Remove + 1;
+   std::vector<std::array<long, Kinds>> Own(Cache.Head().PackageCount), Touched(Cache.Head().PackageCount);
+   for (auto &O : Own)
+      O.fill(-1);
+   for (auto &T : Touched)
+      T.fill(-1);
+
+   std::vector<std::vector<pkgDPkgPM::Item>> Groups;
+   std::vector<pkgDPkgPM::Item::Ops> GroupKind;
+   std::vector<map_id_t> Related;
+   for (auto I = List.begin(); I != Tail; ++I)
+   {
+      Related.clear();
+      for (auto G = I->Pkg.Group().PackageList(); G.end() == false; G = I->Pkg.Group().NextPkg(G))
+	 Related.push_back(G->ID);
+      for (auto const &Ver : {I->Pkg.CurrentVer(), Cache[I->Pkg].InstVerIter(Cache)})
+      {
+	 if (Ver.end())
+	    continue;
+	 for (auto D = Ver.DependsList(); D.end() == false; ++D)
+	 {
+	    auto const Target = D.TargetPkg();
+	    Related.push_back(Target->ID);
+	    for (auto Prv = Target.ProvidesList(); Prv.end() == false; ++Prv)
+	       Related.push_back(Prv.OwnerPkg()->ID);
+	 }
+      }
+
+      auto const K = Kind(*I);
+      long Bound = 0;
+      auto const Require = [&](std::array<long, Kinds> const &Latest, bool const SameCall) {
+	 for (size_t k = 0; k < Kinds; ++k)
+	    if (Latest[k] != -1)
+	       Bound = std::max(Bound, Latest[k] + ((SameCall && k == K) ? 0 : 1));
+      };
+      Require(Own[I->Pkg->ID], false);
+      Require(Touched[I->Pkg->ID], true);
+      for (auto const ID : Related)
+	 Require(Own[ID], true);
+
+      long Group = Bound;
+      while (Group < static_cast<long>(Groups.size()) && GroupKind[Group] != K)
+	 ++Group;
+      if (Group == static_cast<long>(Groups.size()))
+      {
+	 Groups.emplace_back();
+	 GroupKind.push_back(K);
+      }
+      Groups[Group].push_back(std::move(*I));
+
+      Own[Groups[Group].back().Pkg->ID][K] = std::max(Own[Groups[Group].back().Pkg->ID][K], Group);
+      for (auto const ID : Related)
+	 Touched[ID][K] = std::max(Touched[ID][K], Group);
+   }
+
+   std::vector<pkgDPkgPM::Item> Batched;
+   Batched.reserve(List.size());
+   for (auto &G : Groups)
+      std::move(G.begin(), G.end(), std::back_inserter(Batched));
+   std::move(Tail, List.end(), std::back_inserter(Batched));
+   List = std::move(Batched);
+   return {Before, Groups.size()};
+}
+									/*}}}*/
 class APT_HIDDEN BuildDpkgCall {
    std::vector<char*> args;
    std::vector<bool> to_free;
@@ -1762,12 +1860,21 @@ bool pkgDPkgPM::Go(APT::Progress::PackageManager *progress)
       if (_config->FindB("DPkg::ConfigurePending", true))
 	 List.emplace_back(Item::ConfigurePending, pkgCache::PkgIterator());
    }
+   std::pair<size_t, size_t> BatchedCalls{0, 0};
+   if (_config->FindB("DPkg::Batch-Calls", false))
+   {
+      BatchedCalls = BatchDpkgCalls(List, Cache);
+      if (_config->FindB("Debug::pkgDPkgPM::Batch", false))
+	 std::clog << "Batched " << BatchedCalls.first << " dpkg calls into " << BatchedCalls.second << std::endl;
+   }
    bool const TriggersPending = _config->FindB("DPkg::TriggersPending", false);
 
    d->stdin_is_dev_null = false;
 
    // create log
    OpenLog();
+   if (d->term_out != nullptr && BatchedCalls.first != BatchedCalls.second)
+      fprintf(d->term_out, "Batched %zu dpkg calls into %zu\n", BatchedCalls.first, BatchedCalls.second);
 
    bool dpkgMultiArch = _system->MultiArchSupported();
    bool dpkgProtectedField = debSystem::AssertFeature("protected-field");
@@ -106,12 +106,100 @@ int pkgDepCache::DecreaseActionGroupLevel()
 // ---------------------------------------------------------------------
 /* */
 
+namespace
+{
+/* The outcome of following a dependency in the mark phase depends only on
+   the states of its target and the packages providing it. It is kept per
+   dependency until one of these changes, as most of them don't between
+   two runs. */
+struct MarkedDepCache
+{
+   struct Entry
+   {
+      uint32_t Offset{0};
+      uint32_t Count{0};
+      bool Valid{false};
+      // the target is marked as nothing of it is installed
+      bool MarkTarget{false};
+      // no choice of the dependency is unsatisfied
+      bool Explored{false};
+   };
+   std::vector<Entry> Deps;
+   // the versions to follow for each valid entry, in order
+   std::vector<pkgCache::Version *> Follow;
+
+   void Invalidate(pkgCache::DepIterator D)
+   {
+      for (; not D.end(); ++D)
+	 Deps[D->ID].Valid = false;
+   }
+};
+} // namespace
+
 struct pkgDepCache::Private
 {
    std::unique_ptr<InRootSetFunc> inRootSetFunc;
    std::unique_ptr<APT::CacheFilter::Matcher> IsAVersionedKernelPackage, IsProtectedKernelPackage;
    std::string machineID;
    unsigned long iUpgradeCount{0};
+
+   /* What the counters need to know about a package besides its StateCache.
+      It can't change while the cache is open, so it is collected once into
+      an array of its own, sparing the counting a visit to the package. */
+   enum PkgFact : unsigned char
+   {
+      Installed = (1 << 0),
+      BadState = (1 << 1),
+      Purged = (1 << 2),
+   };
+   std::vector<unsigned char> PkgFacts;
+
+   /* What the last mark phase depended on: the packages which are installed
+      or to be installed, their versions and flags, and the configuration.
+      Boring packages, i.e. neither installed nor to be installed, only count
+      as such. A package whose input changed invalidates the evaluation of
+      the dependencies on it and on what it provides in the MarkCache. */
+   struct SweepInput
+   {
+      pkgCache::Version *Ver;
+      unsigned char Bits;
+      bool operator==(SweepInput const &) const = default;
+   };
+   enum SweepInputBits : unsigned char
+   {
+      Boring = (1 << 0),
+      Install = (1 << 1),
+      Auto = (1 << 2),
+      Protect = (1 << 3),
+   };
+   std::vector<SweepInput> SweptInputs;
+   // to find the package of a changed input without walking the package list
+   std::vector<map_pointer<pkgCache::Package>> SweptPackages;
+   std::string SweptConfig;
+   MarkedDepCache MarkCache;
+   bool UseMarkCache{true};
+   // the marks are those of the cached root set and the SweptInputs
+   bool SweptWithCachedFunc{false};
+   // the marks of that sweep, as others like the solver change them as well
+   std::vector<std::pair<bool, bool>> SweptMarks;
+
+   SweepInput GetSweepInput(StateCache const &State, unsigned long const ID) const
+   {
+      bool const IsInstalled = (PkgFacts[ID] & Installed) != 0;
+      if (IsInstalled ? State.Delete() : State.Keep())
+	 return {nullptr, Boring};
+      return {State.Install() ? State.InstallVer : nullptr,
+	      static_cast<unsigned char>((State.Install() ? Install : 0) |
+					 ((State.Flags & Flag::Auto) != 0 ? Auto : 0) |
+					 (State.Protect() ? Protect : 0))};
+   }
+   bool UpdateSweepInputs(pkgDepCache &Cache);
+   void ForgetSweepInputs()
+   {
+      SweptInputs.clear();
+      SweptWithCachedFunc = false;
+   }
+   bool VerifySweep(pkgDepCache &Cache, InRootSetFunc &rootFunc);
 };
 pkgDepCache::pkgDepCache(pkgCache *const pCache, Policy *const Plcy) : group_level(0), Cache(pCache), PkgState(0), DepState(0),
 								       iUsrSize(0), iDownloadSize(0), iInstCount(0), iDelCount(0), iKeepCount(0),
@@ -238,6 +326,19 @@ bool pkgDepCache::Init(OpProgress * const Prog)
    memset(PkgState,0,sizeof(*PkgState)*Head().PackageCount);
    memset(DepState,0,sizeof(*DepState)*Head().DependsCount);
 
+   d->ForgetSweepInputs();
+   d->PkgFacts.assign(Head().PackageCount, 0);
+   for (PkgIterator I = PkgBegin(); I.end() != true; ++I)
+   {
+      unsigned char &Facts = d->PkgFacts[I->ID];
+      if (I->CurrentVer != 0)
+	 Facts |= Private::Installed;
+      if (I.State() != PkgIterator::NeedsNothing)
+	 Facts |= Private::BadState;
+      if (I.Purge())
+	 Facts |= Private::Purged;
+   }
+
    if (Prog != 0)
    {
       Prog->OverallProgress(0,2*Head().PackageCount,Head().PackageCount,
@@ -585,6 +686,49 @@ void pkgDepCache::AddSizes(const PkgIterator &Pkg, bool const Inverse)
    }   
 }
 									/*}}}*/
+// DepCache::StateCounts - Count the states of packages		/*{{{*/
+// ---------------------------------------------------------------------
+/* The counters are sums of conditions without branches, so that counting
+   doesn't stall on mispredicting the states of the packages, and counting
+   all of them in a row can be vectorized. */
+void pkgDepCache::StateCounts::Add(StateCache const &State, unsigned char const Facts)
+{
+   bool const Installed = (Facts & Private::Installed) != 0;
+   // an installed package with another install version can be in all three modes
+   bool const Changes = Installed & (State.Status != 0);
+   bool const Delete = State.Mode == ModeDelete;
+   bool const Install = State.Mode == ModeInstall;
+
+   Broken += (State.DepState & DepInstMin) != DepInstMin;
+   PolicyBroken += (State.DepState & DepInstPolicy) != DepInstPolicy;
+   Bad += (Facts & Private::BadState) != 0;
+   Del += Delete & (Installed | (((State.iFlags & pkgDepCache::Purge) != 0) & ((Facts & Private::Purged) == 0)));
+   Inst += (Install & (not Installed | Changes)) |
+	   (Installed & not Changes & not Delete & ((State.iFlags & pkgDepCache::ReInstall) != 0));
+   Keep += Changes & (State.Mode == ModeKeep);
+   Upgrade += Changes & Install & (State.Status > 0);
+}
+void pkgDepCache::StateCounts::AddTo(pkgDepCache &Cache) const
+{
+   Cache.iInstCount += Inst;
+   Cache.iDelCount += Del;
+   Cache.iKeepCount += Keep;
+   Cache.iBrokenCount += Broken;
+   Cache.iPolicyBrokenCount += PolicyBroken;
+   Cache.iBadCount += Bad;
+   Cache.d->iUpgradeCount += Upgrade;
+}
+void pkgDepCache::StateCounts::RemoveFrom(pkgDepCache &Cache) const
+{
+   Cache.iInstCount -= Inst;
+   Cache.iDelCount -= Del;
+   Cache.iKeepCount -= Keep;
+   Cache.iBrokenCount -= Broken;
+   Cache.iPolicyBrokenCount -= PolicyBroken;
+   Cache.iBadCount -= Bad;
+   Cache.d->iUpgradeCount -= Upgrade;
+}
+									/*}}}*/
 // DepCache::AddStates - Add the package to the state counter		/*{{{*/
 // ---------------------------------------------------------------------
 /* This routine is tricky to use, you must make sure that it is never
@@ -595,53 +739,12 @@ void pkgDepCache::AddSizes(const PkgIterator &Pkg, bool const Inverse)
    will be called on Pkg */
 void pkgDepCache::AddStates(const PkgIterator &Pkg, bool const Invert)
 {
-   signed char const Add = (Invert == false) ? 1 : -1;
-   StateCache &State = PkgState[Pkg->ID];
-
-   // The Package is broken (either minimal dep or policy dep)
-   if ((State.DepState & DepInstMin) != DepInstMin)
-      iBrokenCount += Add;
-   if ((State.DepState & DepInstPolicy) != DepInstPolicy)
-      iPolicyBrokenCount += Add;
-
-   // Bad state
-   if (Pkg.State() != PkgIterator::NeedsNothing)
-      iBadCount += Add;
-
-   // Not installed
-   if (Pkg->CurrentVer == 0)
-   {
-      if (State.Mode == ModeDelete &&
-	  (State.iFlags & Purge) == Purge && Pkg.Purge() == false)
-	 iDelCount += Add;
-
-      if (State.Mode == ModeInstall)
-	 iInstCount += Add;
-      return;
-   }
-
-   // Installed, no upgrade
-   if (State.Status == 0)
-   {
-      if (State.Mode == ModeDelete)
-	 iDelCount += Add;
-      else
-	 if ((State.iFlags & ReInstall) == ReInstall)
-	    iInstCount += Add;
-      return;
-   }
-
-   // Alll 3 are possible
-   if (State.Mode == ModeDelete)
-      iDelCount += Add;
-   else if (State.Mode == ModeKeep)
-      iKeepCount += Add;
-   else if (State.Mode == ModeInstall)
-   {
-      iInstCount += Add;
-      if (Pkg->CurrentVer != 0 && State.Status > 0)
-	 d->iUpgradeCount += Add;
-   }
+   StateCounts Counts;
+   Counts.Add(PkgState[Pkg->ID], d->PkgFacts[Pkg->ID]);
+   if (Invert == false)
+      Counts.AddTo(*this);
+   else
+      Counts.RemoveFrom(*this);
 }
 									/*}}}*/
 // DepCache::BuildGroupOrs - Generate the Or group dep data		/*{{{*/
@@ -808,8 +911,15 @@ void pkgDepCache::PerformDependencyPass(OpProgress * const Prog)
       // Compute the package dependency state and size additions
       AddSizes(I);
       UpdateVerState(I);
-      AddStates(I);
    }
+
+   // count the states of all packages at once now that they are known
+   StateCounts Counts;
+   auto const PackageCount = Head().PackageCount;
+   for (auto I = decltype(PackageCount){0}; I < PackageCount; ++I)
+      Counts.Add(PkgState[I], d->PkgFacts[I]);
+   Counts.AddTo(*this);
+
    if (Prog != 0)
       Prog->Progress(Done);
 }
@@ -2324,6 +2434,7 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
 			pkgDepCache &DepCache,
 			pkgDepCache::StateCache *const PkgState,
 			std::vector<bool> &fullyExplored,
+			MarkedDepCache *const MarkCache,
 			std::unique_ptr<APT::CacheFilter::Matcher> &IsAVersionedKernelPackage,
 			std::unique_ptr<APT::CacheFilter::Matcher> &IsProtectedKernelPackage)
 {
@@ -2364,6 +2475,24 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
 	    (not follow_suggests || D->Type != pkgCache::Dep::Suggests))
 	 continue;
 
+      if (MarkCache != nullptr && MarkCache->Deps[D->ID].Valid)
+      {
+	 auto const &E = MarkCache->Deps[D->ID];
+	 if (E.MarkTarget)
+	    PkgState[T->ID].Marked = true;
+	 if (E.Explored)
+	    fullyExplored[T->ID] = true;
+	 for (auto V = E.Offset; V != E.Offset + E.Count; ++V)
+	 {
+	    pkgCache::VerIterator const PV(Cache, MarkCache->Follow[V]);
+	    if (not MarkPackage(PV.ParentPkg(), PV, follow_recommends, follow_suggests, debug_autoremove,
+				"Dependency", Depth + 1, Cache, DepCache, PkgState, fullyExplored, MarkCache,
+				IsAVersionedKernelPackage, IsProtectedKernelPackage))
+	       return false;
+	 }
+	 continue;
+      }
+
       bool unsatisfied_choice = false;
       std::unordered_map<std::string, APT::VersionVector> providers_by_source;
       // collect real part
@@ -2378,7 +2507,8 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
 	       providers_by_source[TV.SourcePkgName()].push_back(TV);
 	 }
       }
-      if (providers_by_source.empty() && not unsatisfied_choice)
+      bool const MarkTarget = providers_by_source.empty() && not unsatisfied_choice;
+      if (MarkTarget)
 	 PkgState[T->ID].Marked = true;
       // collect virtual part
       for (auto Prv = T.ProvidesList(); not Prv.end(); ++Prv)
@@ -2450,6 +2580,19 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
 	 }
       }
 
+      if (MarkCache != nullptr)
+      {
+	 auto &E = MarkCache->Deps[D->ID];
+	 E.Offset = MarkCache->Follow.size();
+	 for (auto const &providers : providers_by_source)
+	    for (auto PV : providers.second)
+	       MarkCache->Follow.push_back(PV);
+	 E.Count = MarkCache->Follow.size() - E.Offset;
+	 E.MarkTarget = MarkTarget;
+	 E.Explored = not unsatisfied_choice;
+	 E.Valid = true;
+      }
+
       for (auto const &providers : providers_by_source)
       {
 	 for (auto const &PV : providers.second)
@@ -2460,7 +2603,7 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
 			 << ", provided by " << PP.FullName() << " " << PV.VerStr()
 			 << " (" << providers_by_source.size() << "/" << providers.second.size() << ")\n";
 	    if (not MarkPackage(PP, PV, follow_recommends, follow_suggests, debug_autoremove,
-				"Dependency", Depth + 1, Cache, DepCache, PkgState, fullyExplored,
+				"Dependency", Depth + 1, Cache, DepCache, PkgState, fullyExplored, MarkCache,
 				IsAVersionedKernelPackage, IsProtectedKernelPackage))
 	       return false;
 	 }
@@ -2475,6 +2618,8 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
    if (_config->Find("APT::Solver", "internal") != "internal" && _config->Find("APT::Solver") != "3.0")
       return true;
 
+   d->UpdateSweepInputs(*this);
+
    // init the states
    auto const PackagesCount = Head().PackageCount;
    for(auto i = decltype(PackagesCount){0}; i < PackagesCount; ++i)
@@ -2492,6 +2637,8 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
 
    bool const follow_recommends = MarkFollowsRecommends();
    bool const follow_suggests   = MarkFollowsSuggests();
+   // the cache is skipped for the debug output to explain every dependency
+   MarkedDepCache *const MarkCache = (debug_autoremove || not d->UseMarkCache) ? nullptr : &d->MarkCache;
 
    // do the mark part, this is the core bit of the algorithm
    for (PkgIterator P = PkgBegin(); !P.end(); ++P)
@@ -2517,13 +2664,80 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
 
       pkgCache::VerIterator const PV = (PkgState[P->ID].Install()) ? PkgState[P->ID].InstVerIter(*this) : P.CurrentVer();
       if (not MarkPackage(P, PV, follow_recommends, follow_suggests, debug_autoremove,
-			  reason, 0, *Cache, *this, PkgState, fullyExplored,
+			  reason, 0, *Cache, *this, PkgState, fullyExplored, MarkCache,
 			  d->IsAVersionedKernelPackage, d->IsProtectedKernelPackage))
 	 return false;
    }
    return true;
 }
 									/*}}}*/
+// DepCache::Private::UpdateSweepInputs - invalidate changed evaluations	/*{{{*/
+bool pkgDepCache::Private::UpdateSweepInputs(pkgDepCache &Cache)
+{
+   auto const PackagesCount = Cache.Head().PackageCount;
+   std::string const Config = std::string{Cache.MarkFollowsRecommends() ? '1' : '0', Cache.MarkFollowsSuggests() ? '1' : '0',
+					  _config->FindB("APT::Ignore-Hold", false) ? '1' : '0'} +
+			      _config->Find("APT::Solver", "internal");
+   // the outdated evaluations are left behind in Follow, so start over once they pile up
+   if (SweptInputs.size() != PackagesCount || SweptConfig != Config ||
+       MarkCache.Follow.size() > 4 * static_cast<size_t>(Cache.Head().DependsCount))
+   {
+      SweptInputs.resize(PackagesCount);
+      SweptPackages.resize(PackagesCount);
+      for (PkgIterator P = Cache.PkgBegin(); not P.end(); ++P)
+      {
+	 SweptInputs[P->ID] = GetSweepInput(Cache.PkgState[P->ID], P->ID);
+	 SweptPackages[P->ID] = P.MapPointer();
+      }
+      SweptConfig = Config;
+      MarkCache.Deps.assign(Cache.Head().DependsCount, {});
+      MarkCache.Follow.clear();
+      return true;
+   }
+
+   bool Changed = false;
+   for (auto i = decltype(PackagesCount){0}; i < PackagesCount; ++i)
+   {
+      auto const Input = GetSweepInput(Cache.PkgState[i], i);
+      if (SweptInputs[i] == Input)
+	 continue;
+      SweptInputs[i] = Input;
+      Changed = true;
+      PkgIterator const P(*Cache.Cache, Cache.Cache->PkgP + SweptPackages[i]);
+      MarkCache.Invalidate(P.RevDependsList());
+      for (auto V = P.VersionList(); not V.end(); ++V)
+	 for (auto Prv = V.ProvidesList(); not Prv.end(); ++Prv)
+	    MarkCache.Invalidate(Prv.ParentPkg().RevDependsList());
+   }
+   return Changed;
+}
+									/*}}}*/
+// DepCache::Private::VerifySweep - compare with an uncached run	/*{{{*/
+bool pkgDepCache::Private::VerifySweep(pkgDepCache &Cache, InRootSetFunc &rootFunc)
+{
+   auto const PackagesCount = Cache.Head().PackageCount;
+   std::vector<std::pair<bool, bool>> Marks;
+   Marks.reserve(PackagesCount);
+   for (auto i = decltype(PackagesCount){0}; i < PackagesCount; ++i)
+      Marks.emplace_back(Cache.PkgState[i].Marked, Cache.PkgState[i].Garbage);
+
+   UseMarkCache = false;
+   bool const Okay = Cache.MarkRequired(rootFunc) && Cache.Sweep();
+   UseMarkCache = true;
+   if (Okay == false)
+      return false;
+
+   for (PkgIterator P = Cache.PkgBegin(); not P.end(); ++P)
+   {
+      auto const &State = Cache.PkgState[P->ID];
+      auto const &Old = Marks[P->ID];
+      if (State.Marked != Old.first || State.Garbage != Old.second)
+	 _error->Warning("Internal Inconsistency in pkgDepCache: Incremental mark and sweep for %s has marked %d and garbage %d vs %d and %d",
+			 P.FullName().c_str(), Old.first, Old.second, State.Marked, State.Garbage);
+   }
+   return true;
+}
+									/*}}}*/
 bool pkgDepCache::Sweep()						/*{{{*/
 {
    bool debug_autoremove = _config->FindB("Debug::pkgAutoRemove",false);
@@ -2553,15 +2767,42 @@ bool pkgDepCache::Sweep()						/*{{{*/
 // DepCache::MarkAndSweep						/*{{{*/
 bool pkgDepCache::MarkAndSweep(InRootSetFunc &rootFunc)
 {
-   return MarkRequired(rootFunc) && Sweep();
+   d->SweptWithCachedFunc = false;
+   if (MarkRequired(rootFunc) == false || Sweep() == false)
+      return false;
+   if (_config->FindB("Debug::pkgDepCache::VerifySweep", false))
+      return d->VerifySweep(*this, rootFunc);
+   return true;
 }
 bool pkgDepCache::MarkAndSweep()
 {
    InRootSetFunc *f(GetCachedRootSetFunc());
-   if (f != NULL)
-      return MarkAndSweep(*f);
-   else
+   if (f == NULL)
       return false;
+
+   // if nothing the marks depend on changed since the last run, neither did they
+   if (d->SweptWithCachedFunc && d->UpdateSweepInputs(*this) == false &&
+       _config->FindB("Debug::pkgAutoRemove", false) == false)
+   {
+      for (auto i = decltype(d->SweptMarks.size()){0}; i < d->SweptMarks.size(); ++i)
+      {
+	 PkgState[i].Marked = d->SweptMarks[i].first;
+	 PkgState[i].Garbage = d->SweptMarks[i].second;
+      }
+      if (_config->FindB("Debug::pkgDepCache::VerifySweep", false))
+	 return d->VerifySweep(*this, *f);
+      return true;
+   }
+
+   if (MarkAndSweep(*f) == false)
+      return false;
+   d->SweptWithCachedFunc = true;
+   auto const PackagesCount = Head().PackageCount;
+   d->SweptMarks.clear();
+   d->SweptMarks.reserve(PackagesCount);
+   for (auto i = decltype(PackagesCount){0}; i < PackagesCount; ++i)
+      d->SweptMarks.emplace_back(PkgState[i].Marked, PkgState[i].Garbage);
+   return true;
 }
 									/*}}}*/
 
@@ -2693,6 +2934,8 @@ struct pkgDepCache::Transaction::Private
 
    void rollback()
    {
+      // the marks are restored to a state the last mark and sweep didn't see
+      cache.d->ForgetSweepInputs();
       memcpy(&cache.PkgState[0], &PkgState[0], sizeof(PkgState[0]) * cache.GetCache().Head().PackageCount);
       memcpy(&cache.DepState[0], &DepState[0], sizeof(DepState[0]) * cache.GetCache().Head().DependsCount);
 
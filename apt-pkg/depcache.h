@@ -363,6 +363,14 @@ class APT_PUBLIC pkgDepCache : protected pkgCache::Namespace
    inline void RemoveSizes(const PkgIterator &Pkg) {AddSizes(Pkg, true);};
    void AddStates(const PkgIterator &Pkg, bool const Invert = false);
    inline void RemoveStates(const PkgIterator &Pkg) {AddStates(Pkg,true);};
+   // what the states of some packages add to the counters
+   struct APT_HIDDEN StateCounts
+   {
+      unsigned long Inst = 0, Del = 0, Keep = 0, Broken = 0, PolicyBroken = 0, Bad = 0, Upgrade = 0;
+      void Add(StateCache const &State, unsigned char const Facts);
+      void AddTo(pkgDepCache &Cache) const;
+      void RemoveFrom(pkgDepCache &Cache) const;
+   };
    
    public:
 
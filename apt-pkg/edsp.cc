@@ -9,15 +9,18 @@
 
 #include <apt-pkg/algorithms.h>
 #include <apt-pkg/aptconfiguration.h>
+#include <apt-pkg/cachefile.h>
 #include <apt-pkg/cacheset.h>
 #include <apt-pkg/depcache.h>
 #include <apt-pkg/edsp.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/mmap.h>
 #include <apt-pkg/packagemanager.h>
 #include <apt-pkg/perf.h>
 #include <apt-pkg/pkgcache.h>
 #include <apt-pkg/pkgsystem.h>
+#include <apt-pkg/policy.h>
 #include <apt-pkg/prettyprinters.h>
 #include <apt-pkg/progress.h>
 #include <apt-pkg/solver3.h>
@@ -28,12 +31,16 @@
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <array>
 #include <limits>
+#include <memory>
+#include <set>
 #include <sstream>
 #include <string>
 
@@ -359,6 +366,265 @@ bool EDSP::WriteLimitedScenario(pkgDepCache &Cache, FileFd &output,
    return WriteLimitedScenario(Cache, output, pkgset, Progress);
 }
 									/*}}}*/
+// EDSP::WriteBinaryScenario - to a memory file				/*{{{*/
+/* The snapshot is the cache image as it is in memory followed by the state
+   of each version and package the text scenario sends in APT-* and Hold
+   fields and a trailer describing where they are:
+
+   [cache image][pad to 8][version state * VersionCount]
+   [package flags * PackageCount][pad to 8][trailer]
+
+   The image header is stored clean with the hash of the image as its
+   CacheFileSize, so that pkgCache::ReMap can verify it like a cache file. */
+namespace
+{
+struct BinaryScenarioVersion
+{
+   signed short Pin;
+   uint8_t Flags;
+   uint8_t Padding;
+};
+struct BinaryScenarioTrailer
+{
+   char Signature[8];
+   uint32_t Version;
+   uint32_t PackageCount;
+   uint32_t VersionCount;
+   uint32_t Padding;
+   uint64_t CacheSize;
+};
+enum BinaryScenarioFlags
+{
+   // per version
+   BinaryScenarioCandidate = (1 << 0),
+   // per package
+   BinaryScenarioHold = (1 << 0),
+   BinaryScenarioAutomatic = (1 << 1),
+};
+constexpr char BinaryScenarioSignature[8] = {'A', 'P', 'T', 'E', 'D', 'S', 'P', '\0'};
+constexpr uint32_t BinaryScenarioFormat = 1;
+constexpr uint64_t BinaryScenarioAlign(uint64_t const Size)
+{
+   return (Size + 7) & ~uint64_t{7};
+}
+} // namespace
+bool EDSP::WriteBinaryScenario(pkgDepCache &Cache, int &output)
+{
+   output = -1;
+   pkgCache &PkgCache = Cache.GetCache();
+   MMap &Map = PkgCache.GetMap();
+   auto const &Head = Cache.Head();
+
+   std::vector<BinaryScenarioVersion> Versions(Head.VersionCount, {std::numeric_limits<signed short>::min(), 0, 0});
+   std::vector<uint8_t> Packages(Head.PackageCount, 0);
+   for (auto Pkg = Cache.PkgBegin(); Pkg.end() == false; ++Pkg)
+   {
+      if (Pkg->SelectedState == pkgCache::State::Hold ||
+	  (Cache[Pkg].Keep() == true && Cache[Pkg].Protect() == true))
+	 Packages[Pkg->ID] |= BinaryScenarioHold;
+      if ((Cache[Pkg].Flags & pkgCache::Flag::Auto) == pkgCache::Flag::Auto)
+	 Packages[Pkg->ID] |= BinaryScenarioAutomatic;
+      // versions the text scenario leaves out stay in the image and are only
+      // kept out of reach by strict pinning, see ResolveExternal
+      if (Pkg->CurrentVer == 0 && not checkKnownArchitecture(Pkg.Arch()))
+	 continue;
+      auto const Cand = Cache.GetCandidateVersion(Pkg);
+      for (auto Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+      {
+	 if (SkipUnavailableVersions(Cache, Pkg, Ver))
+	    continue;
+	 Versions[Ver->ID].Pin = Cache.GetPolicy().GetPriority(Ver);
+	 if (Cand == Ver)
+	    Versions[Ver->ID].Flags |= BinaryScenarioCandidate;
+      }
+   }
+
+   pkgCache::Header Clean;
+   memcpy(&Clean, Map.Data(), sizeof(Clean));
+   Clean.Dirty = false;
+   Clean.CacheFileSize = PkgCache.CacheHash();
+
+   BinaryScenarioTrailer Trailer{};
+   memcpy(Trailer.Signature, BinaryScenarioSignature, sizeof(Trailer.Signature));
+   Trailer.Version = BinaryScenarioFormat;
+   Trailer.PackageCount = Head.PackageCount;
+   Trailer.VersionCount = Head.VersionCount;
+   Trailer.CacheSize = Map.Size();
+
+   int fd = -1;
+#ifdef MFD_CLOEXEC
+   fd = memfd_create("apt-edsp-scenario", MFD_CLOEXEC);
+#endif
+   if (fd == -1)
+   {
+      FileFd Temp;
+      if (GetTempFile("apt-edsp-scenario", true, &Temp) == nullptr)
+	 return false;
+      if ((fd = dup(Temp.Fd())) == -1)
+	 return _error->Errno("WriteBinaryScenario", "Failed to duplicate file descriptor %d", Temp.Fd());
+      SetCloseExec(fd, true);
+   }
+
+   static constexpr char const Padding[8] = {};
+   auto const VersionsOffset = BinaryScenarioAlign(Map.Size());
+   auto const PackagesEnd = VersionsOffset + Versions.size() * sizeof(Versions[0]) + Packages.size();
+   FileFd Out;
+   bool Okay = Out.OpenDescriptor(fd, FileFd::WriteOnly | FileFd::BufferedWrite, false) &&
+	       Out.Write(&Clean, sizeof(Clean)) &&
+	       Out.Write(static_cast<char *>(Map.Data()) + sizeof(Clean), Map.Size() - sizeof(Clean)) &&
+	       Out.Write(Padding, VersionsOffset - Map.Size()) &&
+	       Out.Write(Versions.data(), Versions.size() * sizeof(Versions[0])) &&
+	       Out.Write(Packages.data(), Packages.size()) &&
+	       Out.Write(Padding, BinaryScenarioAlign(PackagesEnd) - PackagesEnd) &&
+	       Out.Write(&Trailer, sizeof(Trailer));
+   Okay &= Out.Close();
+   if (Okay == false)
+   {
+      close(fd);
+      return _error->Error("Failed to write the binary scenario for the solver");
+   }
+   output = fd;
+   return true;
+}
+									/*}}}*/
+// EDSP::ReadBinaryScenario - map the snapshot as a cache		/*{{{*/
+namespace
+{
+class BinaryScenarioMap : public MMap
+{
+   void *const Start;
+   size_t const Length;
+
+   public:
+   BinaryScenarioMap(void *const Start, size_t const Length, unsigned long long const CacheSize) : MMap(UnMapped), Start(Start), Length(Length)
+   {
+      Base = Start;
+      iSize = CacheSize;
+   }
+   ~BinaryScenarioMap() override
+   {
+      munmap(Start, Length);
+   }
+};
+class BinaryScenarioPolicy : public pkgPolicy
+{
+   BinaryScenarioVersion const *const Versions;
+
+   public:
+   BinaryScenarioPolicy(pkgCache *const Owner, BinaryScenarioVersion const *const Versions) : pkgPolicy(Owner), Versions(Versions) {}
+   pkgCache::VerIterator GetCandidateVer(pkgCache::PkgIterator const &Pkg) override
+   {
+      for (auto Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+	 if ((Versions[Ver->ID].Flags & BinaryScenarioCandidate) != 0)
+	    return Ver;
+      return pkgCache::VerIterator();
+   }
+   signed short GetPriority(pkgCache::VerIterator const &Ver, bool) override
+   {
+      return Versions[Ver->ID].Pin;
+   }
+};
+class BinaryScenarioCacheFile : public pkgCacheFile
+{
+   public:
+   BinaryScenarioCacheFile(MMap *const M, pkgCache *const C, pkgPolicy *const P, pkgDepCache *const D)
+   {
+      Map = M;
+      Cache = C;
+      Policy = P;
+      DCache = D;
+   }
+};
+} // namespace
+std::unique_ptr<pkgCacheFile> EDSP::ReadBinaryScenario(int const input)
+{
+   struct stat Buf;
+   if (fstat(input, &Buf) != 0)
+   {
+      _error->Errno("fstat", "Failed to stat the binary scenario on fd %d", input);
+      return nullptr;
+   }
+   size_t const Size = Buf.st_size;
+   if (Size < sizeof(pkgCache::Header) + sizeof(BinaryScenarioTrailer))
+   {
+      _error->Error("The binary scenario on fd %d is truncated", input);
+      return nullptr;
+   }
+   void *const Base = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE, input, 0);
+   if (Base == MAP_FAILED)
+   {
+      _error->Errno("mmap", "Failed to map the binary scenario on fd %d", input);
+      return nullptr;
+   }
+
+   auto const Data = static_cast<char *>(Base);
+   BinaryScenarioTrailer Trailer;
+   memcpy(&Trailer, Data + Size - sizeof(Trailer), sizeof(Trailer));
+   auto const VersionsOffset = BinaryScenarioAlign(Trailer.CacheSize);
+   auto const PackagesOffset = VersionsOffset + uint64_t{Trailer.VersionCount} * sizeof(BinaryScenarioVersion);
+   if (memcmp(Trailer.Signature, BinaryScenarioSignature, sizeof(Trailer.Signature)) != 0 ||
+       Trailer.Version != BinaryScenarioFormat || Trailer.CacheSize < sizeof(pkgCache::Header) ||
+       BinaryScenarioAlign(PackagesOffset + Trailer.PackageCount) + sizeof(Trailer) != Size)
+   {
+      munmap(Base, Size);
+      _error->Error("The binary scenario on fd %d is not in a format this version of APT understands", input);
+      return nullptr;
+   }
+   auto Map = std::make_unique<BinaryScenarioMap>(Base, Size, Trailer.CacheSize);
+
+   /* The architectures are part of the image, so configure them the way
+      the image was built before checking it against the configuration */
+   auto const Head = static_cast<pkgCache::Header const *>(Base);
+   auto const CacheString = [&](map_stringitem_t const Item) -> std::string {
+      auto const Offset = static_cast<uint32_t>(Item);
+      if (Offset == 0 || Offset >= Trailer.CacheSize)
+	 return "";
+      return std::string(Data + Offset, strnlen(Data + Offset, Trailer.CacheSize - Offset));
+   };
+   if (Head->VersionCount != Trailer.VersionCount || Head->PackageCount != Trailer.PackageCount)
+   {
+      _error->Error("The binary scenario on fd %d is corrupted", input);
+      return nullptr;
+   }
+   _config->Set("APT::Architecture", CacheString(Head->Architecture));
+   auto const Architectures = CacheString(Head->GetArchitectures());
+   auto const Variants = Architectures.find(';');
+   _config->Set("APT::Architectures", Architectures.substr(0, Variants));
+   if (Variants == std::string::npos)
+      _config->Clear("APT::Architecture-Variants");
+   else
+      _config->Set("APT::Architecture-Variants", Architectures.substr(Variants + 1));
+   APT::Configuration::getArchitectures(false);
+   APT::Configuration::getArchitectureVariants(false);
+
+   auto Cache = std::make_unique<pkgCache>(Map.get(), false);
+   if (Cache->ReMap(true) == false)
+      return nullptr;
+
+   auto const Versions = reinterpret_cast<BinaryScenarioVersion const *>(Data + VersionsOffset);
+   auto const Packages = reinterpret_cast<uint8_t const *>(Data + PackagesOffset);
+   // the image has the state of the system, the scenario only what the text format has
+   for (auto Pkg = Cache->PkgBegin(); Pkg.end() == false; ++Pkg)
+   {
+      Pkg->SelectedState = (Packages[Pkg->ID] & BinaryScenarioHold) != 0 ? pkgCache::State::Hold : pkgCache::State::Unknown;
+      Pkg->InstState = pkgCache::State::Ok;
+      Pkg->CurrentState = Pkg->CurrentVer != 0 ? pkgCache::State::Installed : pkgCache::State::NotInstalled;
+   }
+
+   auto Policy = std::make_unique<BinaryScenarioPolicy>(Cache.get(), Versions);
+   auto DCache = std::make_unique<pkgDepCache>(Cache.get(), Policy.get());
+   if (DCache->Init(nullptr) == false)
+      return nullptr;
+   for (auto Pkg = Cache->PkgBegin(); Pkg.end() == false; ++Pkg)
+      if ((Packages[Pkg->ID] & BinaryScenarioAutomatic) != 0)
+	 (*DCache)[Pkg].Flags |= pkgCache::Flag::Auto;
+
+   auto const M = Map.release();
+   auto const C = Cache.release();
+   auto const P = Policy.release();
+   return std::make_unique<BinaryScenarioCacheFile>(M, C, P, DCache.release());
+}
+									/*}}}*/
 // EDSP::WriteRequest - to the given file descriptor			/*{{{*/
 bool EDSP::WriteRequest(pkgDepCache &Cache, FileFd &output,
 			unsigned int const flags,
@@ -410,6 +676,8 @@ bool EDSP::WriteRequest(pkgDepCache &Cache, FileFd &output,
       WriteOkay(Okay, output, "Forbid-Remove: yes\n");
    else if (flags & Request::FORBID_NEW_INSTALL)
       WriteOkay(Okay, output, "Forbid-Remove: no\n");
+   if (flags & Request::BINARY_SCENARIO)
+      WriteOkay(Okay, output, "Binary-Scenario: yes\n");
    auto const solver = _config->Find("APT::Solver", "internal");
    WriteOkay(Okay, output, "Solver: ", solver, "\n");
    if (_config->FindB("APT::Solver::Strict-Pinning", true) == false)
@@ -619,7 +887,8 @@ bool EDSP::ReadRequest(int const input, std::list<std::string> &install,
 	       ReadFlag(flags, line, "Upgrade-All:", Request::UPGRADE_ALL) ||
 	       ReadFlag(flags, line, "Forbid-New-Install:", Request::FORBID_NEW_INSTALL) ||
 	       ReadFlag(flags, line, "Forbid-Remove:", Request::FORBID_REMOVE) ||
-	       ReadFlag(flags, line, "Autoremove:", Request::AUTOREMOVE))
+	       ReadFlag(flags, line, "Autoremove:", Request::AUTOREMOVE) ||
+	       ReadFlag(flags, line, "Binary-Scenario:", Request::BINARY_SCENARIO))
 	 ;
       else if (LineStartsWithAndStrip(line, "Architecture:"))
 	 _config->Set("APT::Architecture", line);
@@ -701,7 +970,7 @@ static std::string findExecutable(std::vector<std::string> const &dirs, char con
 	return "";
 }
 									/*}}}*/
-static pid_t ExecuteExternal(char const* const type, char const * const binary, char const * const configdir, int * const solver_in, int * const solver_out) {/*{{{*/
+static pid_t ExecuteExternal(char const* const type, char const * const binary, char const * const configdir, int * const solver_in, int * const solver_out, int const scenario = -1) {/*{{{*/
 	auto const solverDirs = _config->FindVector(configdir);
 	auto const file = findExecutable(solverDirs, binary);
 	std::string dumper;
@@ -713,22 +982,37 @@ static pid_t ExecuteExternal(char const* const type, char const * const binary,
 
 	if (file.empty() == true)
 	{
+		if (scenario != -1)
+			close(scenario);
 		_error->Error("Can't call external %s '%s' as it is not in a configured directory!", type, binary);
 		return 0;
 	}
 	int external[4] = {-1, -1, -1, -1};
 	if (pipe(external) != 0 || pipe(external + 2) != 0)
 	{
+		if (scenario != -1)
+			close(scenario);
 		_error->Errno("Resolve", "Can't create needed IPC pipes for EDSP");
 		return 0;
 	}
 	for (int i = 0; i < 4; ++i)
 		SetCloseExec(external[i], true);
 
-	pid_t Solver = ExecFork();
+	std::set<int> KeepFDs;
+	MergeKeepFdsFromConfiguration(KeepFDs);
+	if (scenario != -1)
+		KeepFDs.insert(scenario);
+	pid_t Solver = ExecFork(KeepFDs);
 	if (Solver == 0) {
 		dup2(external[0], STDIN_FILENO);
 		dup2(external[3], STDOUT_FILENO);
+		if (scenario == EDSP::BinaryScenarioFd)
+			SetCloseExec(scenario, false);
+		else if (scenario != -1)
+		{
+			dup2(scenario, EDSP::BinaryScenarioFd);
+			close(scenario);
+		}
 		auto const dumpfile = _config->FindFile((std::string("Dir::Log::") + type).c_str());
 		auto const dumpdir = flNotFile(dumpfile);
 		auto const runasuser = _config->Find(std::string("APT::") + type + "::" + binary + "::RunAsUser",
@@ -751,6 +1035,8 @@ static pid_t ExecuteExternal(char const* const type, char const * const binary,
 	}
 	close(external[0]);
 	close(external[3]);
+	if (scenario != -1)
+		close(scenario);
 
 	if (WaitFd(external[1], true, 5) == false)
 	{
@@ -798,7 +1084,7 @@ bool EDSP::ResolveExternal(const char* const solver, pkgDepCache &Cache,
    if (strstr(solver, "3.") == solver)
    {
       APT::PerformanceContext context{"APT::Solver"};
-      APT::Solver::DependencySolver s(Cache.GetCache(), Cache.GetPolicy(), (EDSP::Request::Flags)flags);
+      APT::Solver::Portfolio s(Cache.GetCache(), Cache.GetPolicy(), (EDSP::Request::Flags)flags, std::max(_config->FindI("APT::Solver::Portfolio", 1), 1));
       FileFd output;
       bool res = true;
       if (Progress != NULL)
@@ -809,6 +1095,12 @@ bool EDSP::ResolveExternal(const char* const solver, pkgDepCache &Cache,
 	 Progress->Progress(10);
       if (res && not s.Solve())
 	 res = false;
+      auto const &stats = s.GetStatistics();
+      context.Set("conflicts", stats.conflicts);
+      context.Set("learned", stats.learned);
+      context.Set("forgotten", stats.forgotten);
+      context.Set("backjump_distance", stats.backjumpDistance);
+      context.Set("max_backjump_distance", stats.maxBackjumpDistance);
       if (Progress != NULL)
 	 Progress->Progress(90);
       if (res && not s.ToDepCache(Cache))
@@ -824,9 +1116,22 @@ bool EDSP::ResolveExternal(const char* const solver, pkgDepCache &Cache,
 		Okay &= EDSP::WriteRequest(Cache, output, flags, nullptr);
 		return Okay && EDSP::WriteLimitedScenario(Cache, output, nullptr);
 	}
+	// solvers linked against this libapt-pkg can map the cache instead of parsing it,
+	// but without strict pinning they could choose versions the text scenario leaves out
+	int scenario = -1;
+	if (_config->FindB(std::string("APT::Solver::") + solver + "::Binary-Scenario",
+			   strcmp(solver, "apt") == 0 || strcmp(solver, "solver3") == 0) &&
+	    _config->FindB("APT::Solver::Strict-Pinning", true) &&
+	    _config->FindFile("Dir::Log::solver").empty())
+	{
+		_error->PushToStack();
+		if (EDSP::WriteBinaryScenario(Cache, scenario) == false && _config->FindB("Debug::EDSP::BinaryScenario", false))
+			_error->DumpErrors(std::clog);
+		_error->RevertToStack();
+	}
 	_error->PushToStack();
 	int solver_in, solver_out;
-	pid_t const solver_pid = ExecuteSolver(solver, &solver_in, &solver_out, true);
+	pid_t const solver_pid = ExecuteExternal("solver", solver, "Dir::Bin::Solvers", &solver_in, &solver_out, scenario);
 	if (solver_pid == 0)
 		return false;
 
@@ -837,10 +1142,11 @@ bool EDSP::ResolveExternal(const char* const solver, pkgDepCache &Cache,
 	bool Okay = output.Failed() == false;
 	if (Okay && Progress != NULL)
 		Progress->OverallProgress(0, 100, 5, _("Execute external solver"));
-	Okay &= EDSP::WriteRequest(Cache, output, flags, Progress);
+	Okay &= EDSP::WriteRequest(Cache, output, scenario == -1 ? flags : (flags | Request::BINARY_SCENARIO), Progress);
 	if (Okay && Progress != NULL)
 		Progress->OverallProgress(5, 100, 20, _("Execute external solver"));
-	Okay &= EDSP::WriteScenario(Cache, output, Progress);
+	if (scenario == -1)
+		Okay &= EDSP::WriteScenario(Cache, output, Progress);
 	output.Close();
 
 	if (Okay && Progress != NULL)
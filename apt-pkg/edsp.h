@@ -16,10 +16,12 @@
 #include <cstdio>
 
 #include <list>
+#include <memory>
 #include <string>
 #include <vector>
 
 
+class pkgCacheFile;
 class pkgDepCache;
 class OpProgress;
 
@@ -33,8 +35,11 @@ namespace EDSP								/*{{{*/
 	      UPGRADE_ALL = (1 << 1), /*!< upgrade all installed packages, like 'apt-get full-upgrade' without forbid flags */
 	      FORBID_NEW_INSTALL = (1 << 2), /*!< forbid the resolver to install new packages */
 	      FORBID_REMOVE = (1 << 3), /*!< forbid the resolver to remove packages */
+	      BINARY_SCENARIO = (1 << 4), /*!< the universe is a binary scenario on #BinaryScenarioFd */
 	   };
 	}
+	/** \brief file descriptor the solver finds a binary scenario on */
+	constexpr int BinaryScenarioFd = 3;
 	/** \brief creates the EDSP request stanza
 	 *
 	 *  In the EDSP protocol the first thing send to the resolver is a stanza
@@ -107,6 +112,34 @@ namespace EDSP								/*{{{*/
 	APT_PUBLIC bool WriteLimitedScenario(pkgDepCache &Cache, FileFd &output,
 					     OpProgress *Progress = NULL);
 
+	/** \brief creates a binary snapshot of the package universe
+	 *
+	 *  Instead of formatting the universe as text for the solver to parse
+	 *  it back into a cache, the snapshot is an image of the cache followed
+	 *  by the state #WriteScenario sends in the APT-* fields, which the
+	 *  solver can map as it is with #ReadBinaryScenario. The image can only
+	 *  be read by the same version of libapt-pkg, so it is only sent to
+	 *  solvers advertising support for it.
+	 *
+	 *  \param Cache is the known package universe
+	 *  \param[out] output is a file descriptor the snapshot is stored in
+	 *
+	 *  \return true if the snapshot was created, otherwise false
+	 */
+	APT_PUBLIC bool WriteBinaryScenario(pkgDepCache &Cache, int &output);
+
+	/** \brief maps a binary snapshot created by #WriteBinaryScenario
+	 *
+	 *  The snapshot is mapped copy-on-write, so the cache is not parsed or
+	 *  copied, but can still be changed to represent the scenario. The
+	 *  architectures are configured like the ones the snapshot was made with.
+	 *
+	 *  \param input file descriptor with the snapshot
+	 *
+	 *  \return the cache with policy and depcache of the scenario or nullptr
+	 */
+	APT_PUBLIC std::unique_ptr<pkgCacheFile> ReadBinaryScenario(int const input);
+
 	/** \brief waits and acts on the information returned from the solver
 	 *
 	 *  This method takes care of interpreting whatever the solver sends
@@ -327,7 +327,10 @@ bool pkgDebianIndexFile::Merge(pkgCacheGenerator &Gen,OpProgress * const Prog)
    const IndexTarget *Target = nullptr;
    FileFd Pkg;
 
-   if (OpenListFile(Pkg, PackageFile) == false)
+   map_filesize_t PrefetchedSize = 0;
+   time_t PrefetchedModificationTime = 0;
+   bool const Prefetched = Gen.TakePrefetchedFile(PackageFile, Pkg, PrefetchedSize, PrefetchedModificationTime);
+   if (Prefetched == false && OpenListFile(Pkg, PackageFile) == false)
       return false;
    _error->PushToStack();
    std::unique_ptr<pkgCacheListParser> Parser(CreateListParser(Pkg));
@@ -350,13 +353,28 @@ bool pkgDebianIndexFile::Merge(pkgCacheGenerator &Gen,OpProgress * const Prog)
    // Store the IMS information
    pkgCache::PkgFileIterator File = Gen.GetCurFile();
    pkgCacheGenerator::Dynamic<pkgCache::PkgFileIterator> DynFile(File);
-   File->Size = Pkg.FileSize();
-   File->mtime = Pkg.ModificationTime();
+   if (Prefetched)
+   {
+      File->Size = PrefetchedSize;
+      File->mtime = PrefetchedModificationTime;
+   }
+   else
+   {
+      File->Size = Pkg.FileSize();
+      File->mtime = Pkg.ModificationTime();
+   }
 
    if (Gen.MergeList(*Parser) == false)
       return _error->Error("Problem with MergeList %s",PackageFile.c_str());
    return true;
 }
+std::string pkgDebianIndexFile::ListFileName() const
+{
+   // other index types create their content while opening
+   if (dynamic_cast<pkgDebianIndexTargetFile const *>(this) == nullptr)
+      return "";
+   return IndexFileName();
+}
 pkgCache::PkgFileIterator pkgDebianIndexFile::FindInCache(pkgCache &Cache) const
 {
    std::string const FileName = IndexFileName();
@@ -165,6 +165,14 @@ protected:
 public:
    bool Merge(pkgCacheGenerator &Gen, OpProgress *Prog) override;
    pkgCache::PkgFileIterator FindInCache(pkgCache &Cache) const override;
+   /** \brief name of the plain index file #Merge will read
+    *
+    * The cache generator uses it to read the file ahead of time or to
+    * identify the file in an existing cache.
+    *
+    * \return an empty string if the file needs special handling while opening
+    */
+   APT_HIDDEN std::string ListFileName() const;
 
    explicit pkgDebianIndexFile(bool const Trusted);
    ~pkgDebianIndexFile() override;
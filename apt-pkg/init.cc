@@ -131,8 +131,10 @@ bool pkgInitConfig(Configuration &Cnf)
    // Cache
    Cnf.CndSet("Dir::Cache", &CACHE_DIR[1]);
    Cnf.CndSet("Dir::Cache::archives","archives/");
+   Cnf.CndSet("Dir::Cache::methods", "methods/");
    Cnf.CndSet("Dir::Cache::srcpkgcache","srcpkgcache.bin");
    Cnf.CndSet("Dir::Cache::pkgcache","pkgcache.bin");
+   Cnf.CndSet("Dir::Cache::searchindex","searchindex.bin");
 
    // Configuration
    Cnf.CndSet("Dir::Etc", &CONF_DIR[1]);
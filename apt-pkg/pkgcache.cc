@@ -23,6 +23,7 @@
 
 #include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/configuration.h>
+#include <apt-pkg/debversion.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/macros.h>
 #include <apt-pkg/mmap.h>
@@ -35,6 +36,7 @@
 #include <array>
 #include <cstddef>
 #include <cstring>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -126,10 +128,27 @@ bool pkgCache::Header::CheckSizes(Header &Against) const
 }
 									/*}}}*/
 
+struct pkgCache::Private
+{
+   // the comparison keys of the version strings by version ID
+   struct VersionKey
+   {
+      uint32_t Offset{0};
+      uint32_t Size{0};
+   };
+   static constexpr uint32_t NoKey = std::numeric_limits<uint32_t>::max();
+   std::vector<VersionKey> VersionKeys;
+   std::string Keys;
+   // the versioning system the keys were made with
+   pkgVersioningSystem *KeysVS{nullptr};
+   bool HasKeys{false};
+
+   VersionKey const &GetKey(pkgCache &Cache, Version const *const Ver);
+};
 // Cache::pkgCache - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-pkgCache::pkgCache(MMap *Map, bool DoMap) : Map(*Map), VS(nullptr), d(NULL)
+pkgCache::pkgCache(MMap *Map, bool DoMap) : Map(*Map), VS(nullptr), d(new Private())
 {
    // call getArchitectures() with cached=false to ensure that the
    // architectures cache is re-evaluated. this is needed in cases
@@ -182,6 +201,7 @@ bool pkgCache::ReMap(bool const &Errorchecks)
       return _error->Error(_("The package cache file is corrupted"));
 
    // Locate our VS..
+   d->KeysVS = nullptr;
    if ((VS = pkgVersioningSystem::GetVS(StrP + HeaderP->VerSysName)) == 0)
       return _error->Error(_("This APT does not support the versioning system '%s'"),StrP + HeaderP->VerSysName);
 
@@ -876,6 +896,56 @@ int pkgCache::VerIterator::CompareVer(const VerIterator &B) const
    return -1;
 }
 									/*}}}*/
+// Cache::CmpVersion - Compare the version strings			/*{{{*/
+pkgCache::Private::VersionKey const &pkgCache::Private::GetKey(pkgCache &Cache, Version const *const Ver)
+{
+   if (Cache.VS != KeysVS)
+   {
+      KeysVS = Cache.VS;
+      HasKeys = dynamic_cast<debVersioningSystem *>(KeysVS) != nullptr;
+      VersionKeys.clear();
+      Keys.clear();
+   }
+   if (Ver->ID >= VersionKeys.size())
+      VersionKeys.resize(std::max<size_t>(Ver->ID + 1, Cache.HeaderP->VersionCount));
+   auto &Key = VersionKeys[Ver->ID];
+   if (Key.Size != 0)
+      return Key;
+
+   auto const VerStr = Cache.ViewString(Ver->VerStr);
+   Key.Offset = Keys.size();
+   if (HasKeys && debVersioningSystem::ComparisonKey(Keys, VerStr.data(), VerStr.data() + VerStr.size()))
+      Key.Size = Keys.size() - Key.Offset;
+   else
+   {
+      Keys.resize(Key.Offset);
+      Key.Size = NoKey;
+   }
+   return Key;
+}
+int pkgCache::CmpVersion(VerIterator const &A, VerIterator const &B)
+{
+   if (A == B)
+      return 0;
+   // fetching the key of B can move that of A
+   d->GetKey(*this, A);
+   auto const &KeyB = d->GetKey(*this, B);
+   auto const &KeyA = d->VersionKeys[A->ID];
+   if (KeyA.Size == Private::NoKey || KeyB.Size == Private::NoKey)
+      return VS->CmpVersion(A.VerStr(), B.VerStr());
+
+   int const Res = memcmp(d->Keys.data() + KeyA.Offset, d->Keys.data() + KeyB.Offset, std::min(KeyA.Size, KeyB.Size));
+   if (Res != 0 || KeyA.Size == KeyB.Size)
+      return Res;
+   return KeyA.Size < KeyB.Size ? -1 : 1;
+}
+void pkgCache::FillVersionKeys()
+{
+   for (auto Pkg = PkgBegin(); Pkg.end() == false; ++Pkg)
+      for (auto Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+	 d->GetKey(*this, Ver);
+}
+									/*}}}*/
 // VerIterator::Downloadable - Checks if the version is downloadable	/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -1092,4 +1162,4 @@ bool pkgCache::VerIterator::IsSecurityUpdate() const
 }
 
 									/*}}}*/
-pkgCache::~pkgCache() {}
+pkgCache::~pkgCache() { delete d; }
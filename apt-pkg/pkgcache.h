@@ -246,6 +246,20 @@ class APT_PUBLIC pkgCache								/*{{{*/
 
    APT_HIDDEN uint32_t CacheHash();
 
+   /** \brief Compares the version strings of A and B like VS->CmpVersion()
+    *
+    *  If the versioning system can encode its versions into keys which
+    *  compare faster than the strings, the keys of the versions are kept
+    *  on first use, making further comparisons of them cheap.
+    */
+   int CmpVersion(VerIterator const &A, VerIterator const &B);
+   /** \brief Computes the keys #CmpVersion uses for all versions now
+    *
+    *  Keys are otherwise kept on first use, which is not thread-safe. With
+    *  all keys computed, #CmpVersion can be used by several threads at once.
+    */
+   APT_HIDDEN void FillVersionKeys();
+
    // Useful transformation things
    static const char *Priority(unsigned char Priority);
    static std::string_view Priority_NoL10n(unsigned char Prio);
@@ -288,7 +302,8 @@ class APT_PUBLIC pkgCache								/*{{{*/
    virtual ~pkgCache();
 
 private:
-   void * const d;
+   struct Private;
+   Private * const d;
    bool MultiArchEnabled;
 };
 									/*}}}*/
@@ -28,12 +28,19 @@
 #include <apt-pkg/version.h>
 
 #include <algorithm>
+#include <condition_variable>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -61,6 +68,151 @@ static inline uint32_t NarrowOffset(T ptr)
    return res;
 }
 
+// CacheGenerator::IndexPrefetcher - Read index files on worker threads	/*{{{*/
+// ---------------------------------------------------------------------
+/* Opening and decompressing the index files is done by a small pool of
+   threads while the main thread is busy merging the previous files into
+   the map. Each file is decompressed into an anonymous in-memory file, so
+   the list parsers can read it like any other FileFd. To bound the memory
+   usage the workers only run a few files ahead of the merge. */
+class APT_HIDDEN pkgCacheGenerator::IndexPrefetcher
+{
+   struct Item
+   {
+      std::string FileName;
+      int Fd = -1;
+      map_filesize_t Size = 0;
+      time_t ModificationTime = 0;
+      bool Done = false;
+   };
+   std::vector<Item> Items;
+   size_t const Window;
+   size_t NextItem = 0;
+   size_t Consumed = 0;
+   bool Cancel = false;
+   std::mutex Lock;
+   std::condition_variable Changed;
+   std::vector<std::thread> Workers;
+
+   static int OpenMemoryFile();
+   static int Prefetch(std::string const &FileName, map_filesize_t &Size, time_t &ModificationTime);
+   void Run();
+
+   public:
+   bool Take(std::string const &FileName, FileFd &Fd, map_filesize_t &Size, time_t &ModificationTime);
+
+   IndexPrefetcher(std::vector<std::string> const &FileNames, unsigned int const Workers);
+   ~IndexPrefetcher();
+};
+pkgCacheGenerator::IndexPrefetcher::IndexPrefetcher(std::vector<std::string> const &FileNames, unsigned int const WorkerCount)
+   : Window(WorkerCount + 1)
+{
+   Items.resize(FileNames.size());
+   for (size_t i = 0; i < FileNames.size(); ++i)
+      Items[i].FileName = FileNames[i];
+   for (unsigned int i = 0; i < WorkerCount && i < Items.size(); ++i)
+      Workers.emplace_back(&IndexPrefetcher::Run, this);
+}
+pkgCacheGenerator::IndexPrefetcher::~IndexPrefetcher()
+{
+   {
+      std::lock_guard<std::mutex> guard(Lock);
+      Cancel = true;
+   }
+   Changed.notify_all();
+   for (auto &W : Workers)
+      W.join();
+   for (auto const &I : Items)
+      if (I.Fd != -1)
+	 close(I.Fd);
+}
+int pkgCacheGenerator::IndexPrefetcher::OpenMemoryFile()
+{
+#ifdef MFD_CLOEXEC
+   int const Fd = memfd_create("apt-index", MFD_CLOEXEC);
+   if (Fd != -1)
+      return Fd;
+#endif
+   std::unique_ptr<FileFd> Tmp(GetTempFile("apt-index", true, nullptr, false));
+   if (Tmp == nullptr)
+      return -1;
+   return dup(Tmp->Fd());
+}
+int pkgCacheGenerator::IndexPrefetcher::Prefetch(std::string const &FileName, map_filesize_t &Size, time_t &ModificationTime)
+{
+   // errors are reported by the fallback in the main thread instead
+   _error->PushToStack();
+   int Fd = -1;
+   FileFd In(FileName, FileFd::ReadOnly, FileFd::Extension);
+   if (In.IsOpen() && In.Failed() == false)
+   {
+      Size = In.FileSize();
+      ModificationTime = In.ModificationTime();
+      Fd = OpenMemoryFile();
+      if (Fd != -1)
+      {
+	 FileFd Out;
+	 if (Out.OpenDescriptor(Fd, FileFd::WriteOnly, FileFd::None, false) == false ||
+	     CopyFile(In, Out) == false || Out.Close() == false ||
+	     lseek(Fd, 0, SEEK_SET) != 0)
+	 {
+	    close(Fd);
+	    Fd = -1;
+	 }
+      }
+   }
+   if (_error->PendingError())
+   {
+      if (Fd != -1)
+	 close(Fd);
+      Fd = -1;
+   }
+   _error->RevertToStack();
+   return Fd;
+}
+void pkgCacheGenerator::IndexPrefetcher::Run()
+{
+   std::unique_lock<std::mutex> guard(Lock);
+   while (true)
+   {
+      Changed.wait(guard, [&] { return Cancel || NextItem >= Items.size() || NextItem < Consumed + Window; });
+      if (Cancel || NextItem >= Items.size())
+	 return;
+      Item &I = Items[NextItem++];
+      guard.unlock();
+      map_filesize_t Size = 0;
+      time_t ModificationTime = 0;
+      int const Fd = Prefetch(I.FileName, Size, ModificationTime);
+      guard.lock();
+      I.Fd = Fd;
+      I.Size = Size;
+      I.ModificationTime = ModificationTime;
+      I.Done = true;
+      Changed.notify_all();
+   }
+}
+bool pkgCacheGenerator::IndexPrefetcher::Take(std::string const &FileName, FileFd &Fd, map_filesize_t &Size, time_t &ModificationTime)
+{
+   std::unique_lock<std::mutex> guard(Lock);
+   auto const I = std::find_if(Items.begin() + Consumed, Items.end(), [&](Item const &I) { return I.FileName == FileName; });
+   if (I == Items.end())
+      return false;
+   Consumed = std::distance(Items.begin(), I) + 1;
+   Changed.notify_all();
+   Changed.wait(guard, [&] { return I->Done; });
+   int const ItemFd = I->Fd;
+   I->Fd = -1;
+   guard.unlock();
+   if (ItemFd == -1)
+      return false;
+   Size = I->Size;
+   ModificationTime = I->ModificationTime;
+   if (Fd.OpenDescriptor(ItemFd, FileFd::ReadOnly, FileFd::None, true) == false)
+      return false;
+   Fd.Name() = FileName;
+   return true;
+}
+									/*}}}*/
 // CacheGenerator::pkgCacheGenerator - Constructor			/*{{{*/
 // ---------------------------------------------------------------------
 /* We set the dirty flag and make sure that is written to the disk */
@@ -461,6 +613,27 @@ bool pkgCacheGenerator::MergeListVersion(ListParser &List, pkgCache::PkgIterator
       /* We already have a version for this item, record that we saw it */
       if (Res == 0 && Ver.end() == false && Ver->Hash == Hash)
       {
+	 /* A version only known from replaced files is parsed again as
+	    the hash doesn't cover all fields (like Provides) */
+	 bool const Refresh = Ver->FileList == 0 && ReplacedFiles.empty() == false;
+	 if (Refresh)
+	 {
+	    UnlinkVersionRelations(Ver);
+	    Ver->DependsList = 0;
+	    Ver->ProvidesList = 0;
+	    Ver->DescriptionList = 0;
+	    Ver->Section = 0;
+	    if (ListSHA256.size() == 64)
+	    {
+	       if (VersionExtra.size() <= Ver->ID)
+		  VersionExtra.resize(Ver->ID + 1);
+	       memcpy(VersionExtra[Ver->ID].SHA256, ListSHA256.data(), 64);
+	    }
+	    if (unlikely(List.NewVersion(Ver) == false))
+	       return _error->Error(_("Error occurred while processing %s (%s%d)"),
+				    Pkg.Name(), "NewVersion", 3);
+	 }
+
 	 if (List.UsePackage(Pkg,Ver) == false)
 	    return _error->Error(_("Error occurred while processing %s (%s%d)"),
 				 Pkg.Name(), "UsePackage", 2);
@@ -476,6 +649,19 @@ bool pkgCacheGenerator::MergeListVersion(ListParser &List, pkgCache::PkgIterator
 	    return true;
 	 }
 
+	 if (Refresh)
+	 {
+	    pkgCache::GrpIterator Grp = Pkg.Group();
+	    Dynamic<pkgCache::GrpIterator> DynGrp(Grp);
+	    if (unlikely(AddImplicitDepends(Grp, Pkg, Ver) == false))
+	       return _error->Error(_("Error occurred while processing %s (%s%d)"),
+				    Pkg.Name(), "AddImplicitDepends", 3);
+	    return MergeListVersionDescriptions(List, Ver, false);
+	 }
+	 /* A replaced file might have been the one providing the description,
+	    so if it is gone now this file has to provide it again */
+	 if (ReplacedFiles.empty() == false)
+	    return MergeListVersionDescriptions(List, Ver, true);
 	 return true;
       }
    }
@@ -537,9 +723,36 @@ bool pkgCacheGenerator::MergeListVersion(ListParser &List, pkgCache::PkgIterator
       return true;
    }
 
+   return MergeListVersionDescriptions(List, Ver, false);
+}
+									/*}}}*/
+// findDescription							/*{{{*/
+static bool findDescription(pkgCache &Cache, pkgCache::DescIterator &Desc,
+			    std::string_view CurMd5, std::string_view const CurLang)
+{
+   // Descriptions in the same link-list have all the same md5
+   if (Desc.end() || Cache.ViewString(Desc->md5sum) != CurMd5)
+      return false;
+   for (; not Desc.end(); ++Desc)
+      if (CurLang == Cache.ViewString(Desc->language_code))
+	 return true;
+   return false;
+}
+									/*}}}*/
+// CacheGenerator::MergeListVersionDescriptions				/*{{{*/
+bool pkgCacheGenerator::MergeListVersionDescriptions(ListParser &List, pkgCache::VerIterator &Ver,
+						     bool const OnlyMissing)
+{
+   pkgCache::GrpIterator Grp = Ver.ParentPkg().Group();
+   Dynamic<pkgCache::GrpIterator> DynGrp(Grp);
+
    /* Record the Description(s) based on their master md5sum */
    string_view CurMd5 = List.Description_md5();
 
+   // the version is described by another file already
+   if (OnlyMissing && Ver->DescriptionList != 0 && Cache.ViewString(Ver.DescriptionList()->md5sum) != CurMd5)
+      return true;
+
    /* Before we add a new description we first search in the group for
       a version with a description of the same MD5 - if so we reuse this
       description group instead of creating our own for this version */
@@ -557,24 +770,19 @@ bool pkgCacheGenerator::MergeListVersion(ListParser &List, pkgCache::PkgIterator
 
    map_stringitem_t md5idx = Ver->DescriptionList == 0 ? 0 : Ver.DescriptionList()->md5sum;
    for (auto const &CurLang : List.AvailableDescriptionLanguages())
+   {
+      if (OnlyMissing)
+      {
+	 pkgCache::DescIterator Desc = Ver.DescriptionList();
+	 if (findDescription(Cache, Desc, CurMd5, CurLang) && Desc->FileList != 0)
+	    continue;
+      }
       if (not AddNewDescription(List, Ver, CurLang, CurMd5, md5idx))
 	 return false;
+   }
    return true;
 }
 									/*}}}*/
-// findDescription							/*{{{*/
-static bool findDescription(pkgCache &Cache, pkgCache::DescIterator &Desc,
-			    std::string_view CurMd5, std::string_view const CurLang)
-{
-   // Descriptions in the same link-list have all the same md5
-   if (Desc.end() || Cache.ViewString(Desc->md5sum) != CurMd5)
-      return false;
-   for (; not Desc.end(); ++Desc)
-      if (CurLang == Cache.ViewString(Desc->language_code))
-	 return true;
-   return false;
-}
-									/*}}}*/
 bool pkgCacheGenerator::AddNewDescription(ListParser &List, pkgCache::VerIterator &Ver, std::string const &CurLang, std::string_view CurMd5, map_stringitem_t &md5idx) /*{{{*/
 {
    pkgCache::DescIterator Desc = Ver.DescriptionList();
@@ -611,6 +819,26 @@ bool pkgCacheGenerator::AddNewDescription(ListParser &List, pkgCache::VerIterato
 }
 									/*}}}*/
 									/*}}}*/
+// CacheGenerator::PrefetchFiles - Read index files ahead of time	/*{{{*/
+void pkgCacheGenerator::PrefetchFiles(std::vector<std::string> const &FileNames, unsigned int const Workers)
+{
+   Prefetcher.reset();
+   if (Workers == 0 || FileNames.empty())
+      return;
+   if (_config->FindB("Debug::pkgCacheGen", false))
+      std::clog << "Prefetching " << FileNames.size() << " index files with " << Workers << " workers" << std::endl;
+   Prefetcher = std::make_unique<IndexPrefetcher>(FileNames, Workers);
+}
+									/*}}}*/
+// CacheGenerator::TakePrefetchedFile - Open a prefetched index file	/*{{{*/
+bool pkgCacheGenerator::TakePrefetchedFile(std::string const &FileName, FileFd &Fd,
+      map_filesize_t &Size, time_t &ModificationTime)
+{
+   if (Prefetcher == nullptr)
+      return false;
+   return Prefetcher->Take(FileName, Fd, Size, ModificationTime);
+}
+									/*}}}*/
 // CacheGenerator::NewGroup - Add a new group				/*{{{*/
 // ---------------------------------------------------------------------
 /* This creates a new group structure and adds it to the hash table */
@@ -896,10 +1124,15 @@ bool pkgCacheGenerator::NewFileVer(pkgCache::VerIterator &Ver,
    pkgCache::VerFileIterator VF(Cache,Cache.VerFileP + VerFile);
    VF->File = map_pointer<pkgCache::PackageFile>{NarrowOffset(CurrentFile - Cache.PkgFileP)};
 
-   // Link it to the end of the list
+   // Link it to the end of the list, which is in the order the files were
+   // merged in, so stop before a file merged later if we replace a file
    map_pointer<pkgCache::VerFile> *Last = &Ver->FileList;
    for (pkgCache::VerFileIterator V = Ver.FileList(); V.end() == false; ++V)
+   {
+      if (V.File()->ID > CurrentFile->ID)
+	 break;
       Last = &V->NextFile;
+   }
    VF->NextFile = *Last;
    *Last = VF.MapPointer();
 
@@ -1000,15 +1233,16 @@ bool pkgCacheGenerator::NewFileDesc(pkgCache::DescIterator &Desc,
    DF->File = DFFile;
    DF->Offset = DFOffset;
 
-   // Link it to the end of the list
-   if (Desc->FileList == 0)
-      Desc->FileList = DescFile;
-   else
+   // Link it to the end of the list (see NewFileVer for the order)
+   map_pointer<pkgCache::DescFile> *Last = &Desc->FileList;
+   for (auto D = Desc.FileList(); not D.end(); ++D)
    {
-      auto Last = Desc.FileList();
-      for (; Last->NextFile != 0; ++Last);
-      Last->NextFile = DescFile;
+      if (D.File()->ID > CurrentFile->ID)
+	 break;
+      Last = &D->NextFile;
    }
+   DF->NextFile = *Last;
+   *Last = DescFile;
 
    auto const Size = List.Size();
    if (Cache.HeaderP->MaxDescFileSize < Size)
@@ -1337,6 +1571,26 @@ bool pkgCacheGenerator::SelectReleaseFile(const string &File,const string &Site,
    if (File.empty() && Site.empty())
       return true;
 
+   // A replaced file keeps its place in the list, but gets new data
+   if (auto const Replaced = ReplacedRlsFiles.find(File); Replaced != ReplacedRlsFiles.end())
+   {
+      map_stringitem_t const idxSite = StoreString(MIXED, Site);
+      if (unlikely(idxSite == 0))
+	 return false;
+      CurrentRlsFile = Cache.RlsFileP + Replaced->second;
+      CurrentRlsFile->Archive = 0;
+      CurrentRlsFile->Codename = 0;
+      CurrentRlsFile->Version = 0;
+      CurrentRlsFile->Origin = 0;
+      CurrentRlsFile->Label = 0;
+      CurrentRlsFile->Site = idxSite;
+      CurrentRlsFile->Size = 0;
+      CurrentRlsFile->mtime = 0;
+      CurrentRlsFile->Flags = Flags;
+      RlsFileName = File;
+      return true;
+   }
+
    // Get some space for the structure
    auto const idxFile = AllocateInMap<pkgCache::ReleaseFile>();
    if (unlikely(idxFile == 0))
@@ -1372,19 +1626,29 @@ bool pkgCacheGenerator::SelectFile(std::string const &File,
 				   unsigned long const Flags)
 {
    CurrentFile = nullptr;
-   // Get some space for the structure
-   auto const idxFile = AllocateInMap<pkgCache::PackageFile>();
-   if (unlikely(idxFile == 0))
-      return false;
-   CurrentFile = Cache.PkgFileP + idxFile;
+   auto const Replaced = ReplacedFiles.find(File);
+   if (Replaced != ReplacedFiles.end())
+   {
+      // A replaced file keeps its place in the list, so that the content
+      // is merged in again in the same order as before
+      CurrentFile = Cache.PkgFileP + Replaced->second;
+   }
+   else
+   {
+      // Get some space for the structure
+      auto const idxFile = AllocateInMap<pkgCache::PackageFile>();
+      if (unlikely(idxFile == 0))
+	 return false;
+      CurrentFile = Cache.PkgFileP + idxFile;
 
-   // Fill it in
-   map_stringitem_t const idxFileName = WriteStringInMap(File);
-   if (unlikely(idxFileName == 0))
-      return false;
-   CurrentFile->FileName = idxFileName;
-   CurrentFile->NextFile = Cache.HeaderP->FileList;
-   CurrentFile->ID = Cache.HeaderP->PackageFileCount;
+      // Fill it in
+      map_stringitem_t const idxFileName = WriteStringInMap(File);
+      if (unlikely(idxFileName == 0))
+	 return false;
+      CurrentFile->FileName = idxFileName;
+      CurrentFile->NextFile = Cache.HeaderP->FileList;
+      CurrentFile->ID = Cache.HeaderP->PackageFileCount;
+   }
    map_stringitem_t const idxIndexType = StoreString(MIXED, Index.GetType()->Label);
    if (unlikely(idxIndexType == 0))
       return false;
@@ -1403,13 +1667,16 @@ bool pkgCacheGenerator::SelectFile(std::string const &File,
       return false;
    CurrentFile->Component = component;
    CurrentFile->Flags = Flags;
-   if (CurrentRlsFile != nullptr)
-      CurrentFile->Release = map_pointer<pkgCache::ReleaseFile>{NarrowOffset(CurrentRlsFile - Cache.RlsFileP)};
-   else
-      CurrentFile->Release = 0;
    PkgFileName = File;
-   Cache.HeaderP->FileList = map_pointer<pkgCache::PackageFile>{NarrowOffset(CurrentFile - Cache.PkgFileP)};
-   Cache.HeaderP->PackageFileCount++;
+   if (Replaced == ReplacedFiles.end())
+   {
+      if (CurrentRlsFile != nullptr)
+	 CurrentFile->Release = map_pointer<pkgCache::ReleaseFile>{NarrowOffset(CurrentRlsFile - Cache.RlsFileP)};
+      else
+	 CurrentFile->Release = 0;
+      Cache.HeaderP->FileList = map_pointer<pkgCache::PackageFile>{NarrowOffset(CurrentFile - Cache.PkgFileP)};
+      Cache.HeaderP->PackageFileCount++;
+   }
 
    include.clear();
    exclude.clear();
@@ -1432,6 +1699,202 @@ bool pkgCacheGenerator::SelectFile(std::string const &File,
    return true;
 }
 									/*}}}*/
+// CacheGenerator::ReplaceFiles - Drop the content of the given files	/*{{{*/
+// ---------------------------------------------------------------------
+/* The associations of versions and descriptions with the given files are
+   removed, but they stay in the lists, so that merging the files again
+   can find and reuse them if they haven't changed. */
+void pkgCacheGenerator::ReplaceFiles(std::vector<pkgCache::RlsFileIterator> const &RlsFiles,
+				     std::vector<pkgCache::PkgFileIterator> const &Files)
+{
+   ReplacedRlsFiles.clear();
+   for (auto const &R : RlsFiles)
+      ReplacedRlsFiles.emplace(R.FileName(), R.MapPointer());
+   ReplacedFiles.clear();
+   std::vector<bool> Replaced(Cache.HeaderP->PackageFileCount, false);
+   for (auto const &F : Files)
+   {
+      ReplacedFiles.emplace(F.FileName(), F.MapPointer());
+      Replaced[F->ID] = true;
+   }
+   auto const isReplaced = [&](map_pointer<pkgCache::PackageFile> const File) {
+      return Replaced[(Cache.PkgFileP + File)->ID];
+   };
+
+   ReplacedVersions.clear();
+   ReplacedDescriptions.clear();
+   std::vector<bool> SeenDesc(Cache.HeaderP->DescriptionCount, false);
+   for (auto Pkg = Cache.PkgBegin(); not Pkg.end(); ++Pkg)
+   {
+      for (auto Ver = Pkg.VersionList(); not Ver.end(); ++Ver)
+      {
+	 bool Dropped = false;
+	 for (auto *Last = &Ver->FileList; *Last != 0;)
+	 {
+	    auto const VF = Cache.VerFileP + *Last;
+	    if (isReplaced(VF->File) == false)
+	       Last = &VF->NextFile;
+	    else
+	    {
+	       *Last = VF->NextFile;
+	       --Cache.HeaderP->VerFileCount;
+	       Dropped = true;
+	    }
+	 }
+	 if (Dropped)
+	    ReplacedVersions.push_back(Ver.MapPointer());
+
+	 // descriptions are shared between versions
+	 for (auto Desc = Ver.DescriptionList(); not Desc.end(); ++Desc)
+	 {
+	    if (SeenDesc[Desc->ID])
+	       continue;
+	    SeenDesc[Desc->ID] = true;
+	    bool DroppedDesc = false;
+	    for (auto *Last = &Desc->FileList; *Last != 0;)
+	    {
+	       auto const DF = Cache.DescFileP + *Last;
+	       if (isReplaced(DF->File) == false)
+		  Last = &DF->NextFile;
+	       else
+	       {
+		  *Last = DF->NextFile;
+		  --Cache.HeaderP->DescFileCount;
+		  DroppedDesc = true;
+	       }
+	    }
+	    if (DroppedDesc)
+	       ReplacedDescriptions.push_back(Desc.MapPointer());
+	 }
+      }
+   }
+}
+									/*}}}*/
+// CacheGenerator::FinishReplacingFiles - Unlink what is gone		/*{{{*/
+map_id_t pkgCacheGenerator::FinishReplacingFiles()
+{
+   ReplacedFiles.clear();
+   ReplacedRlsFiles.clear();
+
+   std::vector<bool> EmptyDesc(Cache.HeaderP->DescriptionCount, false);
+   bool HaveEmptyDesc = false;
+   for (auto const Desc : ReplacedDescriptions)
+      if ((Cache.DescP + Desc)->FileList == 0)
+	 HaveEmptyDesc = EmptyDesc[(Cache.DescP + Desc)->ID] = true;
+   ReplacedDescriptions.clear();
+
+   map_id_t Versions = 0;
+   for (auto Pkg = Cache.PkgBegin(); not Pkg.end(); ++Pkg)
+      for (auto Ver = Pkg.VersionList(); not Ver.end(); ++Ver)
+      {
+	 ++Versions;
+	 if (HaveEmptyDesc == false)
+	    continue;
+	 // the lists are shared, so this can find already unlinked ones
+	 for (auto *Last = &Ver->DescriptionList; *Last != 0;)
+	 {
+	    auto const Desc = Cache.DescP + *Last;
+	    if (EmptyDesc[Desc->ID])
+	       *Last = Desc->NextDesc;
+	    else
+	       Last = &Desc->NextDesc;
+	 }
+      }
+
+   for (auto const Ver : ReplacedVersions)
+      if ((Cache.VerP + Ver)->FileList == 0)
+      {
+	 UnlinkVersion(pkgCache::VerIterator(Cache, Cache.VerP + Ver));
+	 --Versions;
+      }
+   ReplacedVersions.clear();
+   return Versions;
+}
+									/*}}}*/
+// CacheGenerator::UnlinkVersionRelations - Remove links to a version	/*{{{*/
+// ---------------------------------------------------------------------
+/* Unlinks the dependencies and provides of the version from the packages
+   they point to as well as the version from its source package group */
+void pkgCacheGenerator::UnlinkVersionRelations(pkgCache::VerIterator const &Ver)
+{
+   auto const VerP = Ver.MapPointer();
+   if (Ver->SourceVersion != 0 && Ver.SourceVersion()->Group != 0)
+   {
+      auto const Grp = Cache.GrpP + Ver.SourceVersion()->Group;
+      for (auto *Last = &Grp->VersionsInSource; *Last != 0; Last = &(Cache.VerP + *Last)->NextInSource)
+	 if (*Last == VerP)
+	 {
+	    *Last = Ver->NextInSource;
+	    break;
+	 }
+   }
+
+   auto const unlinkRevDepends = [&](pkgCache::Package * const Target, map_pointer<pkgCache::Dependency> const Dep) {
+      for (auto *Last = &Target->RevDepends; *Last != 0; Last = &(Cache.DepP + *Last)->NextRevDepends)
+	 if (*Last == Dep)
+	 {
+	    *Last = (Cache.DepP + Dep)->NextRevDepends;
+	    break;
+	 }
+   };
+   for (auto Dep = Ver->DependsList; Dep != 0; Dep = (Cache.DepP + Dep)->NextDepends)
+      unlinkRevDepends(Cache.PkgP + (Cache.DepDataP + (Cache.DepP + Dep)->DependencyData)->Package, Dep);
+
+   for (auto Prv = Ver->ProvidesList; Prv != 0; Prv = (Cache.ProvideP + Prv)->NextPkgProv)
+   {
+      auto const Target = Cache.PkgP + (Cache.ProvideP + Prv)->ParentPkg;
+      for (auto *Last = &Target->ProvidesList; *Last != 0; Last = &(Cache.ProvideP + *Last)->NextProvides)
+	 if (*Last == Prv)
+	 {
+	    *Last = (Cache.ProvideP + Prv)->NextProvides;
+	    break;
+	 }
+   }
+
+}
+									/*}}}*/
+// CacheGenerator::UnlinkVersion - Remove a version from all lists	/*{{{*/
+void pkgCacheGenerator::UnlinkVersion(pkgCache::VerIterator const &Ver)
+{
+   UnlinkVersionRelations(Ver);
+
+   auto const VerP = Ver.MapPointer();
+   auto const Pkg = Cache.PkgP + Ver->ParentPkg;
+   for (auto *Last = &Pkg->VersionList; *Last != 0; Last = &(Cache.VerP + *Last)->NextVer)
+      if (*Last == VerP)
+      {
+	 *Last = Ver->NextVer;
+	 break;
+      }
+   if (Pkg->CurrentVer == VerP)
+      Pkg->CurrentVer = 0;
+
+   if (Pkg->VersionList != 0)
+      return;
+   /* The other members of the group got implicit dependencies on this
+      package with its first version, which a full rebuild wouldn't have */
+   for (auto *Last = &Pkg->RevDepends; *Last != 0;)
+   {
+      auto const Dep = Cache.DepP + *Last;
+      auto const Parent = Cache.VerP + Dep->ParentVer;
+      auto const ParentPkg = Cache.PkgP + Parent->ParentPkg;
+      if (((Cache.DepDataP + Dep->DependencyData)->CompareOp & pkgCache::Dep::MultiArchImplicit) == 0 ||
+	  ParentPkg == Pkg || ParentPkg->Group != Pkg->Group)
+      {
+	 Last = &Dep->NextRevDepends;
+	 continue;
+      }
+      auto const DepP = *Last;
+      *Last = Dep->NextRevDepends;
+      for (auto *LastDep = &Parent->DependsList; *LastDep != 0; LastDep = &(Cache.DepP + *LastDep)->NextDepends)
+	 if (*LastDep == DepP)
+	 {
+	    *LastDep = Dep->NextDepends;
+	    break;
+	 }
+   }
+}
+									/*}}}*/
 // CacheGenerator::WriteUniqueString - Insert a unique string		/*{{{*/
 // ---------------------------------------------------------------------
 /* This is used to create handles to strings. Given the same text it
@@ -1637,6 +2100,28 @@ static bool BuildCache(pkgCacheGenerator &Gen,
 {
    bool mergeFailure = false;
 
+   if (auto const Workers = _config->FindI("APT::Cache-Workers", 0); Workers > 0)
+   {
+      std::vector<std::string> FileNames;
+      auto const addPrefetchFile = [&](pkgIndexFile * const I) {
+	 auto const DebI = dynamic_cast<pkgDebianIndexFile *>(I);
+	 if (DebI == nullptr || I->HasPackages() == false || I->Exists() == false)
+	    return;
+	 if (auto FileName = DebI->ListFileName(); FileName.empty() == false)
+	    FileNames.push_back(std::move(FileName));
+      };
+      if (List != nullptr)
+	 for (auto const &M : *List)
+	    if (auto const Indexes = M->GetIndexFiles(); Indexes != nullptr)
+	       std::for_each(Indexes->begin(), Indexes->end(), addPrefetchFile);
+      std::for_each(Start, End, addPrefetchFile);
+      Gen.PrefetchFiles(FileNames, Workers);
+   }
+   struct PrefetchReset {
+      pkgCacheGenerator &Gen;
+      ~PrefetchReset() { Gen.PrefetchFiles({}, 0); }
+   } const prefetchReset{Gen};
+
    auto const indexFileMerge = [&](pkgIndexFile * const I) {
       if (I->HasPackages() == false || mergeFailure)
 	 return;
@@ -1692,6 +2177,237 @@ static bool BuildCache(pkgCacheGenerator &Gen,
    return true;
 }
 									/*}}}*/
+// ReachableCacheSize - Bytes of the cache still in use			/*{{{*/
+// ---------------------------------------------------------------------
+/* Replacing files leaves everything they had allocated behind: versions,
+   dependencies, provides, descriptions and the strings they point to.
+   Instead of tracking every such allocation we sum up what can still be
+   reached from the header, so the rest of the map is garbage. */
+static unsigned long long ReachableCacheSize(pkgCache &Cache)
+{
+   auto const Header = Cache.HeaderP;
+   unsigned long long Size = sizeof(pkgCache::Header) + 2ull * Header->GetHashTableSize() * sizeof(map_pointer<void>);
+
+   std::unordered_set<uint32_t> Strings;
+   auto const addString = [&](map_stringitem_t const S) {
+      if (S != 0)
+	 Strings.insert(static_cast<uint32_t>(S));
+   };
+   addString(Header->VerSysName);
+   addString(Header->Architecture);
+   addString(Header->GetArchitectures());
+
+   for (auto Rls = Cache.RlsFileP + Header->RlsFileList; Rls != Cache.RlsFileP; Rls = Cache.RlsFileP + Rls->NextFile)
+   {
+      Size += sizeof(*Rls);
+      for (auto const S : {Rls->FileName, Rls->Archive, Rls->Codename, Rls->Version, Rls->Origin, Rls->Label, Rls->Site})
+	 addString(S);
+   }
+   for (auto File = Cache.PkgFileP + Header->FileList; File != Cache.PkgFileP; File = Cache.PkgFileP + File->NextFile)
+   {
+      Size += sizeof(*File);
+      for (auto const S : {File->FileName, File->Component, File->Architecture, File->IndexType})
+	 addString(S);
+   }
+
+   std::unordered_set<uint32_t> Descriptions, DependencyData;
+   for (auto Grp = Cache.GrpBegin(); Grp.end() == false; ++Grp)
+   {
+      Size += sizeof(pkgCache::Group);
+      addString(Grp->Name);
+      for (auto Pkg = Grp.PackageList(); Pkg.end() == false; Pkg = Grp.NextPkg(Pkg))
+      {
+	 Size += sizeof(pkgCache::Package);
+	 addString(Pkg->Arch);
+	 for (auto Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+	 {
+	    Size += sizeof(pkgCache::Version) + sizeof(pkgCache::Version::Extra) + sizeof(pkgCache::SourceVersion);
+	    addString(Ver->VerStr);
+	    addString(Ver->Section);
+	    if (Ver->d != 0)
+	       addString((static_cast<pkgCache::Version::Extra *>(Cache.GetMap().Data()) + Ver->d)->ArchVariant);
+	    if (Ver->SourceVersion != 0)
+	       addString(Ver.SourceVersion()->VerStr);
+	    for (auto VF = Ver->FileList; VF != 0; VF = (Cache.VerFileP + VF)->NextFile)
+	       Size += sizeof(pkgCache::VerFile);
+	    for (auto Desc = Ver->DescriptionList; Desc != 0; Desc = (Cache.DescP + Desc)->NextDesc)
+	       Descriptions.insert(static_cast<uint32_t>(Desc));
+	    for (auto Dep = Ver->DependsList; Dep != 0; Dep = (Cache.DepP + Dep)->NextDepends)
+	    {
+	       Size += sizeof(pkgCache::Dependency);
+	       DependencyData.insert(static_cast<uint32_t>((Cache.DepP + Dep)->DependencyData));
+	    }
+	    for (auto Prv = Ver->ProvidesList; Prv != 0; Prv = (Cache.ProvideP + Prv)->NextPkgProv)
+	    {
+	       Size += sizeof(pkgCache::Provides);
+	       addString((Cache.ProvideP + Prv)->ProvideVersion);
+	    }
+	 }
+      }
+   }
+   for (auto const D : Descriptions)
+   {
+      auto const Desc = Cache.DescP + map_pointer<pkgCache::Description>{D};
+      Size += sizeof(*Desc);
+      addString(Desc->language_code);
+      addString(Desc->md5sum);
+      for (auto DF = Desc->FileList; DF != 0; DF = (Cache.DescFileP + DF)->NextFile)
+	 Size += sizeof(pkgCache::DescFile);
+   }
+   for (auto const D : DependencyData)
+   {
+      Size += sizeof(pkgCache::DependencyData);
+      addString((Cache.DepDataP + map_pointer<pkgCache::DependencyData>{D})->Version);
+   }
+
+   // strings are stored with a length prefix and terminator, 2-aligned
+   for (auto const S : Strings)
+   {
+      uint16_t Length;
+      memcpy(&Length, Cache.StrP + S - sizeof(Length), sizeof(Length));
+      unsigned long long const Raw = sizeof(Length) + Length + 1;
+      Size += Raw + 2 - Raw % 2;
+   }
+
+   // what is left in the pools will be used by the next additions
+   for (auto const &Pool : Header->Pools)
+      if (Pool.ItemSize != 0)
+	 Size += Pool.Count * Pool.ItemSize;
+   return Size;
+}
+									/*}}}*/
+// UpdateCache - Merge only the changed index files into the cache	/*{{{*/
+// ---------------------------------------------------------------------
+/* The sources.list must describe the same release and index files in the
+   same order as the cache was built from, only the content of some of
+   them is allowed to have changed. The files which changed are dropped
+   from the cache and merged in again in their old place. If too much of
+   the cache would be garbage afterwards or anything unexpected is found
+   we give up, so that the caller can rebuild the cache from scratch. */
+static bool UpdateCache(pkgCacheGenerator &Gen,
+			OpProgress * const Progress,
+			map_filesize_t &CurrentSize, map_filesize_t &TotalSize,
+			pkgSourceList &List, time_t const CacheModificationTime)
+{
+   bool const Debug = _config->FindB("Debug::pkgCacheGen", false);
+   pkgCache &Cache = Gen.GetCache();
+   if (_error->PendingError() == true)
+   {
+      if (Debug == true)
+	 std::clog << "The cache couldn't be loaded - no update possible" << std::endl;
+      return false;
+   }
+   if (List.GetLastModifiedTime() > CacheModificationTime)
+   {
+      if (Debug == true)
+	 std::clog << "sources.list is newer than the cache - no update possible" << std::endl;
+      return false;
+   }
+
+   std::vector<pkgCache::PkgFileIterator> CacheFiles(Cache.HeaderP->PackageFileCount);
+   for (auto File = Cache.FileBegin(); File.end() == false; ++File)
+      CacheFiles[File->ID] = File;
+
+   std::vector<pkgCache::RlsFileIterator> StaleRlsFiles;
+   std::vector<pkgCache::PkgFileIterator> StaleFiles;
+   std::vector<metaIndex *> StaleMetas;
+   std::vector<pkgIndexFile *> StaleIndexes, NoPackagesIndexes;
+   map_id_t RlsID = 0, FileID = 0;
+   for (auto const &M : List)
+   {
+      auto const RlsFile = M->FindInCache(Cache, false);
+      if (RlsFile.end() == true || RlsFile->ID != RlsID++)
+      {
+	 if (Debug == true)
+	    std::clog << "RlsFile " << M->Describe() << " isn't where it is expected in the cache" << std::endl;
+	 return false;
+      }
+      if (M->FindInCache(Cache, true).end() == true)
+      {
+	 StaleRlsFiles.push_back(RlsFile);
+	 StaleMetas.push_back(M);
+      }
+
+      auto const Indexes = M->GetIndexFiles();
+      if (Indexes == nullptr)
+	 continue;
+      for (auto const I : *Indexes)
+      {
+	 if (I->HasPackages() == false || I->Exists() == false)
+	    continue;
+	 auto const DebI = dynamic_cast<pkgDebianIndexFile *>(I);
+	 if (DebI == nullptr || FileID == CacheFiles.size() ||
+	     DebI->ListFileName() != CacheFiles[FileID].FileName())
+	 {
+	    if (Debug == true)
+	       std::clog << "PkgFile " << I->Describe() << " isn't where it is expected in the cache" << std::endl;
+	    return false;
+	 }
+	 auto const &File = CacheFiles[FileID++];
+	 if ((File->Flags & pkgCache::Flag::NoPackages) != 0)
+	    NoPackagesIndexes.push_back(I);
+	 if (I->FindInCache(Cache).end() == false)
+	    continue;
+	 StaleFiles.push_back(File);
+	 StaleIndexes.push_back(I);
+      }
+   }
+   if (RlsID != Cache.HeaderP->ReleaseFileCount || FileID != Cache.HeaderP->PackageFileCount)
+   {
+      if (Debug == true)
+	 std::clog << "The cache has files which aren't in the sources.list" << std::endl;
+      return false;
+   }
+
+   /* Additions like translations are only attached to what is already in
+      the cache while they are merged, so they have to follow every change */
+   if (std::any_of(StaleFiles.begin(), StaleFiles.end(), [](auto const &F) { return (F->Flags & pkgCache::Flag::NoPackages) == 0; }))
+      for (auto const I : NoPackagesIndexes)
+	 if (std::find(StaleIndexes.begin(), StaleIndexes.end(), I) == StaleIndexes.end())
+	 {
+	    StaleIndexes.push_back(I);
+	    StaleFiles.push_back(I->FindInCache(Cache));
+	 }
+
+   if (Debug == true)
+      std::clog << "Updating " << StaleRlsFiles.size() << " release and " << StaleFiles.size() << " index files" << std::endl;
+   Gen.ReplaceFiles(StaleRlsFiles, StaleFiles);
+   TotalSize = std::accumulate(StaleIndexes.begin(), StaleIndexes.end(), TotalSize,
+	 [](map_filesize_t const Size, pkgIndexFile const * const I) { return Size + I->Size(); });
+   for (auto const &M : List)
+   {
+      if (std::find(StaleMetas.begin(), StaleMetas.end(), M) != StaleMetas.end() &&
+	  M->Merge(Gen, Progress) == false)
+	 return false;
+
+      auto const Indexes = M->GetIndexFiles();
+      if (Indexes == nullptr)
+	 continue;
+      for (auto const I : *Indexes)
+      {
+	 if (std::find(StaleIndexes.begin(), StaleIndexes.end(), I) == StaleIndexes.end())
+	    continue;
+	 map_filesize_t const Size = I->Size();
+	 if (Progress != NULL)
+	    Progress->OverallProgress(CurrentSize, TotalSize, Size, _("Reading package lists"));
+	 CurrentSize += Size;
+	 if (I->Merge(Gen, Progress) == false)
+	    return false;
+      }
+   }
+   if (_error->PendingError() == true)
+      return false;
+
+   Gen.FinishReplacingFiles();
+   auto const Ratio = _config->FindI("APT::Cache-Compact-Ratio", 25);
+   unsigned long long const MapSize = Cache.GetMap().Size();
+   unsigned long long const Reachable = ReachableCacheSize(Cache);
+   auto const Garbage = MapSize > Reachable ? MapSize - Reachable : 0;
+   if (Debug == true)
+      std::clog << "Updated cache has " << Garbage << " of " << MapSize << " bytes unused" << std::endl;
+   return Garbage * 100 <= static_cast<unsigned long long>(Ratio) * MapSize;
+}
+									/*}}}*/
 // CacheGenerator::MakeStatusCache - Construct the status cache		/*{{{*/
 // ---------------------------------------------------------------------
 /* This makes sure that the status cache (the cache that has all
@@ -1858,16 +2574,46 @@ bool pkgCacheGenerator::MakeStatusCache(pkgSourceList &List,OpProgress *Progress
    }
    else if (srcpkgcache_fine == false)
    {
-      if (Debug == true)
+      bool srcpkgcache_updated = false;
+      if (_config->FindB("APT::Cache-Incremental", false) == true && SrcCacheFile.IsOpen() == true)
+      {
+	 if (Debug == true)
+	    std::clog << "srcpkgcache.bin is NOT valid - try to update it" << std::endl;
+	 _error->PushToStack();
+	 map_filesize_t UpdateSize = 0;
+	 srcpkgcache_updated = loadBackMMapFromFile(Gen, Map, Progress, SrcCacheFile) == true &&
+	    UpdateCache(*Gen, Progress, CurrentSize, UpdateSize, List, SrcCacheFile.ModificationTime()) == true;
+	 if (srcpkgcache_updated == true)
+	 {
+	    _error->MergeWithStack();
+	    TotalSize += UpdateSize + ComputeSize(NULL, Files.begin(), Files.end());
+	 }
+	 else
+	 {
+	    _error->RevertToStack();
+	    if (Debug == true)
+	       std::clog << "srcpkgcache.bin can't be updated - rebuild" << std::endl;
+	    Gen.reset();
+	    Map = CreateDynamicMMap(NULL, 0);
+	    if (unlikely(Map->validData()) == false)
+	       return false;
+	    CurrentSize = 0;
+	 }
+      }
+      else if (Debug == true)
 	 std::clog << "srcpkgcache.bin is NOT valid - rebuild" << std::endl;
-      Gen.reset(new pkgCacheGenerator(Map.get(),Progress));
-      if (Gen->Start() == false)
-	 return false;
 
-      TotalSize += ComputeSize(&List, Files.begin(),Files.end());
-      if (BuildCache(*Gen, Progress, CurrentSize, TotalSize, &List,
-	       Files.end(),Files.end()) == false)
-	 return false;
+      if (srcpkgcache_updated == false)
+      {
+	 Gen.reset(new pkgCacheGenerator(Map.get(),Progress));
+	 if (Gen->Start() == false)
+	    return false;
+
+	 TotalSize += ComputeSize(&List, Files.begin(),Files.end());
+	 if (BuildCache(*Gen, Progress, CurrentSize, TotalSize, &List,
+		  Files.end(),Files.end()) == false)
+	    return false;
+      }
 
       if (Writeable == true && SrcCacheFileName.empty() == false)
 	 if (writeBackMMapToFile(Gen.get(), Map.get(), SrcCacheFileName) == false)
@@ -22,10 +22,13 @@
 #include <apt-pkg/mmap.h>
 #include <apt-pkg/pkgcache.h>
 
+#include <ctime>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
 #if __cplusplus >= 201103L
+#include <unordered_map>
 #include <unordered_set>
 #endif
 
@@ -118,6 +121,13 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
    std::unordered_set<std::string> include;
    std::unordered_set<std::string> exclude;
 
+   class IndexPrefetcher;
+   std::unique_ptr<IndexPrefetcher> Prefetcher;
+   std::unordered_map<std::string, map_pointer<pkgCache::PackageFile>> ReplacedFiles;
+   std::unordered_map<std::string, map_pointer<pkgCache::ReleaseFile>> ReplacedRlsFiles;
+   std::vector<map_pointer<pkgCache::Version>> ReplacedVersions;
+   std::vector<map_pointer<pkgCache::Description>> ReplacedDescriptions;
+
    bool NewGroup(pkgCache::GrpIterator &Grp, std::string_view Name);
    bool NewPackage(pkgCache::PkgIterator &Pkg, std::string_view Name, std::string_view Arch);
    map_pointer<pkgCache::Version> NewVersion(pkgCache::VerIterator &Ver, std::string_view VerStr,
@@ -143,6 +153,41 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
    bool SelectFile(const std::string &File, pkgIndexFile const &Index, std::string const &Architecture, std::string const &Component, const IndexTarget *target, unsigned long Flags = 0);
    bool SelectReleaseFile(const std::string &File, const std::string &Site, unsigned long Flags = 0);
    bool MergeList(ListParser &List,pkgCache::VerIterator *Ver = 0);
+   /** \brief read the given index files ahead of time on worker threads
+    *
+    * The files are read (and decompressed) in the given order by up to
+    * \b Workers threads while the caller merges the previous ones, see
+    * #TakePrefetchedFile. Merging itself stays serial, so the cache
+    * produced is the same with or without prefetching.
+    */
+   void PrefetchFiles(std::vector<std::string> const &FileNames, unsigned int Workers);
+   /** \brief hand out a file prepared by #PrefetchFiles
+    *
+    * \param FileName of the index file as passed to #PrefetchFiles
+    * \param[out] Fd is opened on the decompressed content of the file
+    * \param[out] Size of the index file on disk for the IMS data
+    * \param[out] ModificationTime of the index file on disk for the IMS data
+    * \return \b false if the file wasn't prefetched, so the caller
+    *  has to open it on its own
+    */
+   bool TakePrefetchedFile(std::string const &FileName, FileFd &Fd, map_filesize_t &Size, time_t &ModificationTime);
+   /** \brief drop everything merged from the given files so they can be merged again
+    *
+    * The files stay in the cache with their IDs and a following #SelectFile
+    * or #SelectReleaseFile for the same filename picks them up again, so
+    * the new content is merged at the old place in the order. Versions and
+    * descriptions stay in place until #FinishReplacingFiles, so that
+    * unchanged content of the files is attached to them again.
+    */
+   void ReplaceFiles(std::vector<pkgCache::RlsFileIterator> const &RlsFiles, std::vector<pkgCache::PkgFileIterator> const &Files);
+   /** \brief unlink what the files given to #ReplaceFiles don't contain anymore
+    *
+    * Versions left without a file are unlinked from the cache, but the
+    * space they occupy in the map is not reclaimed.
+    *
+    * \return the number of versions in the cache which are still reachable
+    */
+   map_id_t FinishReplacingFiles();
    inline pkgCache &GetCache() {return Cache;};
    inline pkgCache::PkgFileIterator GetCurFile()
          {return pkgCache::PkgFileIterator(Cache,CurrentFile);};
@@ -167,6 +212,9 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
    APT_HIDDEN bool MergeListPackage(ListParser &List, pkgCache::PkgIterator &Pkg);
    APT_HIDDEN bool MergeListVersion(ListParser &List, pkgCache::PkgIterator &Pkg,
 			 std::string_view Version, pkgCache::VerIterator* &OutVer);
+   APT_HIDDEN bool MergeListVersionDescriptions(ListParser &List, pkgCache::VerIterator &Ver, bool OnlyMissing);
+   APT_HIDDEN void UnlinkVersionRelations(pkgCache::VerIterator const &Ver);
+   APT_HIDDEN void UnlinkVersion(pkgCache::VerIterator const &Ver);
 
    APT_HIDDEN bool AddImplicitDepends(pkgCache::GrpIterator &G, pkgCache::PkgIterator &P,
 			   pkgCache::VerIterator &V);
@@ -26,6 +26,7 @@
 #include <apt-pkg/cacheset.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/macros.h>
+#include <apt-pkg/perf.h>
 #include <apt-pkg/pkgsystem.h>
 #include <apt-pkg/solver3.h>
 #include <apt-pkg/version.h>
@@ -35,6 +36,7 @@
 #include <ctime>
 #include <iomanip>
 #include <sstream>
+#include <thread>
 
 namespace APT::Solver
 {
@@ -69,12 +71,19 @@ constexpr bool Solver::Work::operator<(Solver::Work const &b) const noexcept
       return b.size < 2;
    if (size == 1 && b.size == 1) // Special case: 'shortcircuit' optional packages
       return clause->solutions.size() < b.clause->solutions.size();
-   return false;
+   return tiebreak < b.tiebreak;
 }
 
 std::string APT::Solver::Clause::toString(pkgCache &cache, bool pretty, bool showMerged) const
 {
    std::string out;
+   if (learned)
+   {
+      out.append("learned:");
+      for (auto lit : literals)
+	 out.append(lit == literals.front() ? " " : " | ").append(lit.toString(cache));
+      return out;
+   }
    if (showMerged)
       out.append(reason.toString(cache));
    if (dep && pretty)
@@ -132,6 +141,15 @@ constexpr Var Solver::bestReason(Clause const *clause, Var var) const noexcept
 {
    if (not clause)
       return Var{};
+   if (clause->learned)
+   {
+      // The other literal that was assigned last
+      Var best;
+      for (auto lit : clause->literals)
+	 if (lit.var() != var && (best.empty() || (*this)[lit.var()].position > (*this)[best].position))
+	    best = lit.var();
+      return best;
+   }
    if (clause->reason == var)
       for (auto choice : clause->solutions)
       {
@@ -181,7 +199,7 @@ std::string Solver::LongWhyStr(Var var, bool assignment, const Clause *rclause,
 	 strprintf(s, "%s is selected for removal", var.toString(cache).c_str());
       else if (auto ver = var.Ver(cache); assignment && ver && ver.ParentPkg().CurrentVer() && ver.ParentPkg().CurrentVer() != ver)
       {
-	 if (cache.VS->CmpVersion(ver.ParentPkg().CurrentVer().VerStr(), ver.VerStr()) < 0)
+	 if (cache.CmpVersion(ver.ParentPkg().CurrentVer(), ver) < 0)
 	    strprintf(s, "%s is selected as an upgrade", var.toString(cache).c_str());
 	 else
 	    strprintf(s, "%s is selected as a downgrade", var.toString(cache).c_str());
@@ -219,7 +237,8 @@ std::string Solver::LongWhyStr(Var var, bool assignment, const Clause *rclause,
    }
 
    // No reason given, probably a user request or manually installed or essential or whatnot.
-   if (not rclause)
+   // Learned clauses summarize earlier conflicts, they are leaves like backtracked choices.
+   if (not rclause || rclause->learned)
    {
       out << prefix << printSelection(var, assignment) << "\n";
       return out.str();
@@ -274,7 +293,7 @@ std::string Solver::LongWhyStr(Var var, bool assignment, const Clause *rclause,
 	 continue;
       }
       seen.insert(*it);
-      if (state.reason)
+      if (state.reason && not state.reason->learned)
       {
 	 out << prefix << std::setw(w) << i << ". " << state.reason->toString(cache, true) << "\n";
 	 if (state.reason->solutions.size() > 1)
@@ -353,6 +372,8 @@ bool Solver::Enqueue(Lit lit, const Clause *reason)
 	 std::unordered_set<Var> seen;
 	 err << "1. " << LongWhyStr(lit.var(), state.assignment == LiftedBool::True, state.reason, "   ", seen).substr(3) << "\n";
 	 err << "2. " << LongWhyStr(lit.var(), not lit.sign(), reason, "   ", seen).substr(3);
+	 conflictLit = lit;
+	 conflictReason = reason;
 	 return _error->Error("%s", err.str().c_str());
       }
       return true;
@@ -360,6 +381,7 @@ bool Solver::Enqueue(Lit lit, const Clause *reason)
 
    state.assignment = assignment;
    state.level = decisionLevel();
+   state.position = trail.size();
    state.reason = reason;
 
    // FIXME: Adjust call to bestReason to use lit
@@ -399,6 +421,24 @@ bool Solver::Propagate(const Clause *clause, Lit p)
 {
    if (debug >= 3)
       std::cerr << "Propagate " << p.toString(cache) << " to " << clause->toString(cache) << std::endl;
+   // Learned clauses are plain disjunctions; p made one of the literals false.
+   if (clause->learned)
+   {
+      const Lit *unassigned = nullptr;
+      for (auto const &lit : clause->literals)
+      {
+	 if (value(lit) == LiftedBool::True)
+	    return true;
+	 if (value(lit) == LiftedBool::Undefined)
+	 {
+	    if (unassigned)
+	       return true;
+	    unassigned = &lit;
+	 }
+      }
+      // Unit clause, or a conflict: We cannot have ~p.
+      return Enqueue(unassigned ? *unassigned : ~p, clause);
+   }
    // Negative clauses are trivial
    if (clause->negative)
    {
@@ -473,6 +513,20 @@ void Solver::UndoOne()
    // FIXME: Add the undo handling here once we have watchers.
 }
 
+void Solver::UndoLevels(level_type level)
+{
+   assert(level < decisionLevel());
+   for (auto itemsToUndo = trail.size() - trailLim[level]; itemsToUndo; --itemsToUndo)
+      UndoOne();
+
+   // We need to remove any work that is at a higher level.
+   trailLim.resize(level);
+   work.erase(std::remove_if(work.begin(), work.end(), [this](Work &w) -> bool
+			     { return w.level > decisionLevel(); }),
+	      work.end());
+   std::make_heap(work.begin(), work.end());
+}
+
 bool Solver::Pop()
 {
    if (decisionLevel() == 0)
@@ -484,12 +538,28 @@ bool Solver::Pop()
    if (now - startTime >= Timeout)
       return _error->Error("Solver timed out.");
 
+   ++stats.conflicts;
+
+   // A conflict at level 0 cannot be resolved, keep its error message.
+   std::vector<Lit> learned;
+   bool const analyzed = Learn && AnalyzeConflict(learned);
+   conflictLit = Lit();
+   conflictReason = nullptr;
+   if (analyzed && learned.empty())
+      return false;
+
    if (unlikely(debug >= 2))
       for (std::string msg; _error->PopMessage(msg);)
 	 std::cerr << "Branch failed: " << msg << std::endl;
 
    _error->Discard();
 
+   if (analyzed)
+      return Backjump(std::move(learned));
+
+   ++stats.backjumpDistance;
+   stats.maxBackjumpDistance = std::max<uint64_t>(stats.maxBackjumpDistance, 1);
+
    // Assume() actually failed to enqueue anything, abort here
    if (trailLim.back() == trail.size())
    {
@@ -498,18 +568,9 @@ bool Solver::Pop()
    }
 
    assert(trailLim.back() < trail.size());
-   int itemsToUndo = trail.size() - trailLim.back();
    auto choice = trail[trailLim.back()].assigned;
 
-   for (; itemsToUndo; --itemsToUndo)
-      UndoOne();
-
-   // We need to remove any work that is at a higher level.
-   trailLim.pop_back();
-   work.erase(std::remove_if(work.begin(), work.end(), [this](Work &w) -> bool
-			     { return w.level > decisionLevel(); }),
-	      work.end());
-   std::make_heap(work.begin(), work.end());
+   UndoLevels(decisionLevel() - 1);
 
    if (unlikely(debug >= 2))
       std::cerr << "Backtracking to choice " << choice.toString(cache) << "\n";
@@ -526,6 +587,204 @@ bool Solver::Pop()
    return true;
 }
 
+bool Solver::Explain(Lit lit, const Clause *clause, std::vector<Lit> &out) const
+{
+   if (clause == nullptr)
+      return false;
+
+   if (clause->learned)
+   {
+      clause->activity += activityIncrement;
+      for (auto other : clause->literals)
+	 if (other != lit)
+	    out.push_back(~other);
+   }
+   else if (clause->negative && lit == ~clause->reason)
+   {
+      // We were rejected by the solution that was installed first
+      const State *first = nullptr;
+      Var cause;
+      for (auto sol : clause->solutions)
+	 if (auto const &state = (*this)[sol]; state.assignment == LiftedBool::True && (first == nullptr || state.position < first->position))
+	    first = &state, cause = sol;
+      if (first == nullptr)
+	 return false;
+      out.push_back(cause);
+   }
+   else if (clause->negative)
+   {
+      if (not clause->reason.empty())
+	 out.push_back(clause->reason);
+   }
+   else if (lit == ~clause->reason)
+   {
+      // None of the solutions could be installed
+      for (auto sol : clause->solutions)
+	 out.push_back(~sol);
+   }
+   else
+   {
+      // The only solution that was left
+      if (not clause->reason.empty())
+	 out.push_back(clause->reason);
+      for (auto sol : clause->solutions)
+	 if (sol != lit.var())
+	    out.push_back(~sol);
+   }
+   return true;
+}
+
+bool Solver::AnalyzeConflict(std::vector<Lit> &learned)
+{
+   // The conflict: The existing assignment and what implied the opposite one
+   std::vector<Lit> reasons;
+   if (conflictLit.empty() || not Explain(conflictLit, conflictReason, reasons))
+      return false;
+   reasons.push_back(assigned(conflictLit.var()));
+
+   // We discover clauses lazily, so the conflict may be entirely below the current level
+   level_type conflictLevel = 0;
+   for (auto lit : reasons)
+      conflictLevel = std::max(conflictLevel, (*this)[lit.var()].level);
+
+   learned.clear();
+   if (conflictLevel == 0)
+      return true;
+
+   // Walk back the trail, replacing assignments at the conflict level by their reasons until only one
+   // is left, the first unique implication point. Assignments from lower levels are learned as is.
+   std::vector<Var> seen;
+   size_t pending = 0;
+   auto mark = [&](Lit lit)
+   {
+      auto &state = (*this)[lit.var()];
+      if (state.flags.seen || state.level == 0)
+	 return;
+      state.flags.seen = true;
+      seen.push_back(lit.var());
+      if (state.level == conflictLevel)
+	 ++pending;
+      else
+	 learned.push_back(~lit);
+   };
+
+   learned.push_back(Lit());
+   for (auto lit : reasons)
+      mark(lit);
+
+   bool explained = true;
+   for (auto index = trail.size(); explained;)
+   {
+      do
+	 --index;
+      while (trail[index].assigned.empty() || not(*this)[trail[index].assigned].flags.seen);
+
+      auto var = trail[index].assigned;
+      (*this)[var].flags.seen = false;
+      if (--pending == 0)
+      {
+	 learned.front() = ~assigned(var);
+	 break;
+      }
+
+      reasons.clear();
+      explained = Explain(assigned(var), (*this)[var].reason, reasons);
+      for (auto lit : reasons)
+	 mark(lit);
+   }
+
+   for (auto var : seen)
+      (*this)[var].flags.seen = false;
+
+   if (not explained)
+      learned.clear();
+   return explained;
+}
+
+bool Solver::Backjump(std::vector<Lit> &&learned)
+{
+   // Jump to the highest level of the other literals, where the learned clause becomes unit.
+   level_type level = 0;
+   for (auto lit : learned)
+      if (lit != learned.front())
+	 level = std::max(level, (*this)[lit.var()].level);
+
+   ++stats.learned;
+   stats.backjumpDistance += decisionLevel() - level;
+   stats.maxBackjumpDistance = std::max<uint64_t>(stats.maxBackjumpDistance, decisionLevel() - level);
+
+   UndoLevels(level);
+
+   // Decay the activity of older learned clauses by bumping newer ones more.
+   activityIncrement /= 0.999;
+   if (activityIncrement > 1e100)
+   {
+      for (auto &clause : learnedClauses)
+	 clause->activity *= 1e-100;
+      activityIncrement *= 1e-100;
+   }
+
+   if (learned.size() == 1)
+   {
+      if (unlikely(debug >= 2))
+	 std::cerr << "Learned fact " << learned.front().toString(cache) << "\n";
+      if (not Enqueue(learned.front(), nullptr))
+	 return false;
+      (*this)[learned.front().var()].reasonStr = "learned";
+      return true;
+   }
+
+   auto clause = std::make_unique<Clause>(Var(), Group::HoldOrDelete);
+   clause->learned = true;
+   clause->literals = std::move(learned);
+   clause->activity = activityIncrement;
+   for (auto lit : clause->literals)
+      watches(~lit).push_back(clause.get());
+   if (unlikely(debug >= 2))
+      std::cerr << "Backjumping to level " << level << " with " << clause->toString(cache) << "\n";
+
+   learnedClauses.push_back(std::move(clause));
+   if (not Enqueue(learnedClauses.back()->literals.front(), learnedClauses.back().get()))
+      return false;
+
+   if (learnedClauses.size() >= LearnLimit)
+      ForgetLearned();
+   return true;
+}
+
+void Solver::ForgetLearned()
+{
+   std::stable_sort(learnedClauses.begin(), learnedClauses.end(), [](auto const &a, auto const &b)
+		    { return a->activity < b->activity; });
+
+   // Clauses that are the reason for an assignment must stay
+   auto locked = [this](Clause const *clause)
+   {
+      return std::any_of(clause->literals.begin(), clause->literals.end(), [this, clause](auto lit)
+			 { return (*this)[lit.var()].reason == clause; });
+   };
+
+   size_t const forget = learnedClauses.size() / 2;
+   size_t forgotten = 0;
+   for (auto &clause : learnedClauses)
+   {
+      if (forgotten == forget)
+	 break;
+      if (locked(clause.get()))
+	 continue;
+      for (auto lit : clause->literals)
+	 std::erase(watches(~lit), clause.get());
+      clause.reset();
+      ++forgotten;
+   }
+   std::erase(learnedClauses, nullptr);
+
+   stats.forgotten += forgotten;
+   LearnLimit += LearnLimit / 10;
+   if (unlikely(debug >= 2))
+      std::cerr << "Forgot " << forgotten << " learned clauses, keeping " << learnedClauses.size() << "\n";
+}
+
 bool Solver::AddWork(Work &&w)
 {
    if (w.clause->negative)
@@ -543,6 +802,15 @@ bool Solver::AddWork(Work &&w)
 
       w.size = std::count_if(w.clause->solutions.begin(), w.clause->solutions.end(), [this](auto V)
 			     { return value(V) != LiftedBool::False; });
+      if (seed != 0)
+      {
+	 // Cheap deterministic mixing of the clause identity with our seed
+	 uint32_t hash = seed ^ w.clause->reason.value;
+	 if (not w.clause->solutions.empty())
+	    hash = hash * 31 + w.clause->solutions.front().value;
+	 hash *= 0x9E3779B1u;
+	 w.tiebreak = hash ^ (hash >> 16);
+      }
       work.push_back(std::move(w));
       std::push_heap(work.begin(), work.end());
    }
@@ -554,9 +822,17 @@ bool Solver::Solve()
    _error->PushToStack();
    DEFER([&]()
 	 { _error->MergeWithStack(); });
+   DEFER([&]()
+	 {
+	    if (unlikely(debug >= 2))
+	       std::cerr << "Solver statistics: " << stats.conflicts << " conflicts, " << stats.learned << " learned, " << stats.forgotten << " forgotten, "
+			 << stats.backjumpDistance << " levels backtracked (at most " << stats.maxBackjumpDistance << " at once)\n"; });
    startTime = time(nullptr);
    while (true)
    {
+      if (cancelled != nullptr && cancelled->load(std::memory_order_relaxed))
+	 return _error->Error("Solver cancelled.");
+
       while (_error->PendingError() || not Propagate())
       {
 	 if (not Pop())
@@ -656,7 +932,7 @@ struct CompareProviders3 /*{{{*/
 	    return pinA > pinB;
 
 	 // Then by version
-	 return _system->VS->CmpVersion(AV.VerStr(), BV.VerStr()) > 0;
+	 return Cache.CmpVersion(AV, BV) > 0;
       }
       // Try obsolete choices only after exhausting non-obsolete choices such that we install
       // packages replacing them and don't keep back upgrades depending on the replacement to
@@ -1307,8 +1583,8 @@ bool DependencySolver::FromDepCache(pkgDepCache &depcache)
    std::stable_sort(manualPackages.begin(), manualPackages.end(), CompareProviders3{cache, policy, {}, *this});
    for (auto assumption : manualPackages)
    {
-      if (not Assume(assumption, {}) || not Propagate())
-	 must_succeed(Pop());
+      if ((not Assume(assumption, {}) || not Propagate()) && not Pop())
+	 return false;
    }
 
    return true;
@@ -1332,7 +1608,13 @@ bool DependencySolver::ToDepCache(pkgDepCache &depcache) const
 	 auto reasonClause = (*this)[cand].reason;
 	 auto reason = reasonClause ? reasonClause->reason : Var();
 	 if (auto RP = reason.Pkg(); RP == P.MapPointer())
-	    reason = (*this)[P].reason ? (*this)[P].reason->reason : Var();
+	 {
+	    reasonClause = (*this)[P].reason;
+	    reason = reasonClause ? reasonClause->reason : Var();
+	 }
+	 // Learned clauses are not tied to a package, but we have been installed as a dependency all the same.
+	 if (reasonClause && reasonClause->learned)
+	    reason = bestReason(reasonClause, Var(cand));
 
 	 if (cand != P.CurrentVer())
 	 {
@@ -1413,4 +1695,97 @@ std::string DependencySolver::InternalCliWhy(pkgDepCache &cache, pkgCache::PkgIt
    }
    return doOne(Var(pkg));
 }
+
+// --------------------------------------------------------------------------------------------------------------------
+// -------------------------------------------- Portfolio -------------------------------------------------------------
+// --------------------------------------------------------------------------------------------------------------------
+Portfolio::Portfolio(pkgCache &cache, pkgDepCache::Policy &policy, EDSP::Request::Flags requestFlags, unsigned int size)
+{
+   uint32_t const baseSeed = _config->FindI("APT::Solver::Portfolio::Seed", 0);
+   for (unsigned int i = 0; i < std::max(1u, size); ++i)
+   {
+      solvers.push_back(std::make_unique<DependencySolver>(cache, policy, requestFlags));
+      // The first solver is the normal one, the others need a non-zero seed
+      if (i != 0)
+	 solvers.back()->seed = std::max(1u, baseSeed * 0x9E3779B1u + i);
+   }
+}
+
+Portfolio::~Portfolio() = default;
+
+bool Portfolio::FromDepCache(pkgDepCache &depcache)
+{
+   // The depcache is not thread-safe, so this is done one after another
+   return std::all_of(solvers.begin(), solvers.end(), [&](auto &solver)
+		      { return solver->FromDepCache(depcache); });
+}
+
+bool Portfolio::Solve()
+{
+   if (solvers.size() == 1)
+   {
+      winner = solvers.front().get();
+      return winner->Solve();
+   }
+
+   struct Result
+   {
+      bool solved{false};
+      std::vector<std::pair<bool, std::string>> messages;
+   };
+   std::vector<Result> results(solvers.size());
+   std::atomic<bool> cancel{false};
+   std::atomic<size_t> first{solvers.size()};
+
+   // Fill the architecture cache and the version keys now, it is not safe to do so from the threads
+   APT::Configuration::getArchitectures();
+   solvers.front()->cache.FillVersionKeys();
+
+   std::vector<std::thread> threads;
+   threads.reserve(solvers.size());
+   for (size_t i = 0; i < solvers.size(); ++i)
+   {
+      solvers[i]->cancelled = &cancel;
+      threads.emplace_back([this, i, &results, &cancel, &first]()
+			   {
+	 {
+	    std::string const name = "APT::Solver::Portfolio::" + std::to_string(i);
+	    APT::PerformanceContext perf{name.c_str()};
+	    results[i].solved = solvers[i]->Solve();
+	 }
+	 if (size_t none = solvers.size(); results[i].solved && first.compare_exchange_strong(none, i))
+	    cancel = true;
+	 // _error is thread local, so hand our messages over to the caller
+	 for (std::string msg; not _error->empty(GlobalError::DEBUG);)
+	 {
+	    bool const isError = _error->PopMessage(msg);
+	    results[i].messages.emplace_back(isError, std::move(msg));
+	 } });
+   }
+   for (auto &thread : threads)
+      thread.join();
+
+   bool const solved = first != solvers.size();
+   auto const &result = solved ? results[first] : results.front();
+   winner = solvers[&result - results.data()].get();
+   if (unlikely(winner->debug >= 1))
+      std::cerr << "Portfolio: Using result of solver " << (&result - results.data()) << "\n";
+   for (auto const &[isError, msg] : result.messages)
+      if (isError)
+	 _error->Error("%s", msg.c_str());
+      else
+	 _error->Warning("%s", msg.c_str());
+   return solved;
+}
+
+bool Portfolio::ToDepCache(pkgDepCache &depcache) const
+{
+   assert(winner != nullptr);
+   return winner->ToDepCache(depcache);
+}
+
+Solver::Statistics const &Portfolio::GetStatistics() const
+{
+   return (winner ? winner : solvers.front().get())->GetStatistics();
+}
 } // namespace APT::Solver
@@ -7,6 +7,8 @@
  * SPDX-License-Identifier: GPL-2.0+
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <memory>
 #include <optional>
@@ -242,6 +244,13 @@ struct Clause
    // \brief An optional clause may be eager
    bool eager;
 
+   // \brief A learned clause is a disjunction of its literals; reason and solutions are unused.
+   bool learned{false};
+   // \brief Literals of a learned clause
+   std::vector<Lit> literals{};
+   // \brief Activity of a learned clause, the least active ones are forgotten first
+   mutable double activity{0};
+
    // Clauses merged with this clause
    std::forward_list<Clause> merged;
 
@@ -281,6 +290,24 @@ constexpr LiftedBool operator~(LiftedBool value) noexcept
  */
 class Solver
 {
+   friend class Portfolio;
+
+   public:
+   /// \brief Counters describing the search, to compare different strategies
+   struct Statistics
+   {
+      /// \brief Number of conflicts we had to backtrack from
+      uint64_t conflicts{0};
+      /// \brief Number of clauses learned from conflicts, including units
+      uint64_t learned{0};
+      /// \brief Number of learned clauses that were forgotten again
+      uint64_t forgotten{0};
+      /// \brief Sum of the decision levels undone when backtracking
+      uint64_t backjumpDistance{0};
+      /// \brief Largest number of decision levels undone at once
+      uint64_t maxBackjumpDistance{0};
+   };
+
    protected:
    struct State;
    struct Work;
@@ -350,6 +377,17 @@ class Solver
    // \brief Propagation queue
    std::queue<Var> propQ;
 
+   // \brief The last conflict: A literal Enqueue() could not assign, and the clause implying it
+   Lit conflictLit;
+   const Clause *conflictReason{};
+
+   // \brief Clauses learned from conflicts
+   std::vector<std::unique_ptr<Clause>> learnedClauses;
+   // \brief The amount learned clause activities are bumped by, grows to decay old activities
+   double activityIncrement{1};
+
+   Statistics stats;
+
    // \brief The time we called Solve()
    time_t startTime{};
 
@@ -359,6 +397,15 @@ class Solver
    int debug{_config->FindI("Debug::APT::Solver")};
    // \brief If set, we use strict pinning.
    int Timeout{_config->FindI("APT::Solver::Timeout", 10)};
+   // \brief Learn clauses from conflicts and backjump instead of backtracking chronologically
+   bool Learn{_config->FindB("APT::Solver::Learn", false)};
+   // \brief Forget the less active half of the learned clauses when we reach this many
+   size_t LearnLimit{static_cast<size_t>(std::max(_config->FindI("APT::Solver::Learn::Limit", 1000), 2))};
+
+   // \brief Seed to order equally important work items, 0 keeps the insertion order
+   uint32_t seed{0};
+   // \brief Set from another thread if our result is not needed anymore
+   std::atomic<bool> const *cancelled{nullptr};
 
    // \brief Discover a variable, translating the underlying dependencies to the SAT presentation
    //
@@ -377,6 +424,21 @@ class Solver
    }
    constexpr Var bestReason(Clause const *clause, Var var) const noexcept;
    constexpr LiftedBool value(Lit lit) const noexcept;
+   // \brief The literal of the variable that is currently true
+   constexpr Lit assigned(Var var) const noexcept;
+
+   // \brief Collect the true literals which caused `clause` to imply `lit`, returns false if unknown
+   [[nodiscard]] bool Explain(Lit lit, const Clause *clause, std::vector<Lit> &out) const;
+   // \brief Analyze the last conflict into a clause whose first literal is the first unique implication point.
+   //
+   // Returns false if the conflict cannot be explained, and an empty clause if it is at level 0.
+   [[nodiscard]] bool AnalyzeConflict(std::vector<Lit> &learned);
+   // \brief Jump back to the level where the learned clause becomes unit and assert it
+   [[nodiscard]] bool Backjump(std::vector<Lit> &&learned);
+   // \brief Undo all assignments and work above the given level
+   void UndoLevels(level_type level);
+   // \brief Forget the less active half of the learned clauses
+   void ForgetLearned();
 
    public:
    // \brief Revert to the previous decision level.
@@ -398,6 +460,9 @@ class Solver
    // \brief Solve the dependencies
    [[nodiscard]] bool Solve();
 
+   // \brief Counters of the last Solve()
+   Statistics const &GetStatistics() const { return stats; }
+
    // Print dependency chain
    virtual std::string WhyStr(Var reason) const;
 
@@ -494,6 +559,39 @@ class DependencySolver final : public Solver
    /// \brief Temporary internal API with external linkage for the `apt why` and `apt why-not` commands.
    APT_PUBLIC static std::string InternalCliWhy(pkgDepCache &depcache, pkgCache::PkgIterator Pkg, bool assignment);
 };
+
+/**
+ * \brief Several dependency solvers racing each other
+ *
+ * The first solver uses the normal static ordering, the others order work
+ * items of equal importance differently based on a seed, so they take
+ * different paths through the search space. They all run in their own
+ * thread on the shared read-only cache.
+ *
+ * The first solver to succeed wins and cancels all others. All of them
+ * solve the same request under the same policy, they only differ in the
+ * order they try equally good choices in, so each success is an equally
+ * valid solution. If all of them fail, the errors of the first are shown.
+ */
+class Portfolio
+{
+   std::vector<std::unique_ptr<DependencySolver>> solvers;
+   DependencySolver *winner{nullptr};
+
+   public:
+   /// \brief Create \a size solvers, seeded from APT::Solver::Portfolio::Seed
+   Portfolio(pkgCache &Cache, pkgDepCache::Policy &Policy, EDSP::Request::Flags requestFlags, unsigned int size);
+   ~Portfolio();
+
+   /// \brief Apply the selections from the dep cache to all solvers
+   [[nodiscard]] bool FromDepCache(pkgDepCache &depcache);
+   /// \brief Solve the dependencies with all solvers in parallel
+   [[nodiscard]] bool Solve();
+   /// \brief Apply the result of the winning solver to the depCache
+   [[nodiscard]] bool ToDepCache(pkgDepCache &depcache) const;
+   /// \brief Counters of the winning solver, or the first one if we did not solve yet
+   Solver::Statistics const &GetStatistics() const;
+};
 }; // namespace APT::Solver
 /**
  * \brief A single work item
@@ -515,6 +613,9 @@ struct APT::Solver::Solver::Work
    /// Number of valid choices at insertion time
    size_t size{0};
 
+   /// Order between items of equal importance, see Solver::seed
+   uint32_t tiebreak{0};
+
    constexpr bool operator<(APT::Solver::Solver::Work const &b) const noexcept;
    std::string toString(pkgCache &cache) const;
    constexpr Work(const Clause *clause, level_type level) noexcept : clause(clause), level(level) {}
@@ -546,6 +647,9 @@ struct APT::Solver::Solver::State
    // \brief The level at which the value has been assigned
    level_type level{0};
 
+   // \brief The position in the trail at which the value has been assigned
+   level_type position{0};
+
    LiftedBool assignment{LiftedBool::Undefined};
 
    // \brief Flags.
@@ -553,6 +657,8 @@ struct APT::Solver::Solver::State
    {
       bool discovered{};
       bool manual{};
+      // \brief Marked during conflict analysis
+      bool seen{};
    } flags;
 
    static_assert(sizeof(flags) <= sizeof(int));
@@ -613,6 +719,11 @@ struct std::hash<APT::Solver::Lit>
    std::size_t operator()(const APT::Solver::Lit &v) const noexcept { return hash_value(v.value); }
 };
 
+constexpr APT::Solver::Lit APT::Solver::Solver::assigned(Var var) const noexcept
+{
+   return (*this)[var].assignment == LiftedBool::False ? ~var : Lit(var);
+}
+
 constexpr std::vector<const APT::Solver::Clause *> &APT::Solver::Solver::watches(Lit lit) noexcept
 {
    return (*this)[lit.var()].watches[lit.sign()];
@@ -15,17 +15,29 @@
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/mmap.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/tagfile-keys.h>
 #include <apt-pkg/tagfile.h>
 
+#include <atomic>
 #include <list>
+#include <memory>
 
 #include <cctype>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <utility>
+
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define APT_TAGFILE_SIMD
+#endif
 
 #include <apti18n.h>
 									/*}}}*/
@@ -34,12 +46,20 @@ using APT::Configuration::color;
 using std::string;
 using std::string_view;
 
+// a new id whenever the content of a buffer changes, see pkgTagFile::Step
+static uint64_t NewContentId()
+{
+   static std::atomic<uint64_t> Id{0};
+   return ++Id;
+}
 class APT_HIDDEN pkgTagFilePrivate					/*{{{*/
 {
 public:
    void Reset(FileFd * const pFd, unsigned long long const pSize, pkgTagFile::Flags const pFlags)
    {
-      if (Buffer != NULL)
+      if (Map != nullptr)
+	 Map.reset();
+      else if (Buffer != NULL)
 	 free(Buffer);
       Buffer = NULL;
       Fd = pFd;
@@ -51,6 +71,8 @@ public:
       Size = pSize;
       isCommentedLine = false;
       chunks.clear();
+      ContentId = NewContentId();
+      NoSIMD = _config->FindB("Debug::pkgTagSection::NoSIMD", false);
    }
 
    pkgTagFilePrivate(FileFd * const pFd, unsigned long long const Size, pkgTagFile::Flags const pFlags) : Buffer(NULL)
@@ -73,23 +95,133 @@ public:
       FileChunk(bool const pgood, size_t const plength) noexcept : good(pgood), length(plength) {}
    };
    std::list<FileChunk> chunks;
+   // the file if we parse it in place rather than reading it into Buffer
+   std::unique_ptr<MMap> Map;
+   uint64_t ContentId;
+   bool NoSIMD;
 
    bool FillBuffer();
    void RemoveCommentsFromBuffer();
+   bool MapFile();
 
    ~pkgTagFilePrivate()
    {
-      if (Buffer != NULL)
+      if (Map == nullptr && Buffer != NULL)
 	 free(Buffer);
    }
 };
 									/*}}}*/
-class APT_HIDDEN pkgTagSectionPrivate					/*{{{*/
+// TagScanner - find newlines and colons in a section			/*{{{*/
+// ---------------------------------------------------------------------
+/* The scanner classifies 64 bytes at a time with SSE2 or AVX2 and keeps
+   the positions of newlines and colons in a bitmask each, so walking over
+   the many short lines of a typical section doesn't need a call to memchr
+   per line. It finds the same characters as memchr over [p, End) would,
+   which is what we fall back to on other architectures and for the last
+   bytes of the buffer which do not fill a block anymore. */
+namespace {
+struct ScanMasks
 {
-public:
-   pkgTagSectionPrivate()
+   uint64_t Newlines;
+   uint64_t Colons;
+};
+typedef ScanMasks (*ScanBlockFunc)(char const *);
+
+#ifdef APT_TAGFILE_SIMD
+__attribute__((target("sse2"))) ScanMasks ScanBlockSSE2(char const *const Block)
+{
+   __m128i const Newline = _mm_set1_epi8('\n');
+   __m128i const Colon = _mm_set1_epi8(':');
+   ScanMasks Masks{0, 0};
+   for (unsigned int I = 0; I < 64; I += 16)
+   {
+      __m128i const Data = _mm_loadu_si128(reinterpret_cast<__m128i const *>(Block + I));
+      Masks.Newlines |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(Data, Newline)))) << I;
+      Masks.Colons |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(Data, Colon)))) << I;
+   }
+   return Masks;
+}
+__attribute__((target("avx2"))) ScanMasks ScanBlockAVX2(char const *const Block)
+{
+   __m256i const Newline = _mm256_set1_epi8('\n');
+   __m256i const Colon = _mm256_set1_epi8(':');
+   ScanMasks Masks{0, 0};
+   for (unsigned int I = 0; I < 64; I += 32)
    {
+      __m256i const Data = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(Block + I));
+      Masks.Newlines |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(Data, Newline)))) << I;
+      Masks.Colons |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(Data, Colon)))) << I;
    }
+   return Masks;
+}
+#endif
+
+ScanBlockFunc ChooseScanBlock()
+{
+#ifdef APT_TAGFILE_SIMD
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+      return ScanBlockAVX2;
+   if (__builtin_cpu_supports("sse2"))
+      return ScanBlockSSE2;
+#endif
+   return nullptr;
+}
+
+ScanBlockFunc BestScanBlock()
+{
+   static ScanBlockFunc const Best = ChooseScanBlock();
+   return Best;
+}
+
+class TagScanner
+{
+   ScanBlockFunc const ScanBlock;
+   char const *const End;
+   char const *&Block;
+   ScanMasks &Masks;
+
+   public:
+   char const *Find(char const *P, char const C)
+   {
+      if (ScanBlock != nullptr)
+      {
+	 while (true)
+	 {
+	    if (Block == nullptr || P < Block || P >= Block + 64)
+	    {
+	       if (End - P < 64)
+		  break;
+	       Block = P;
+	       Masks = ScanBlock(Block);
+	    }
+	    uint64_t const Found = (C == '\n' ? Masks.Newlines : Masks.Colons) >> (P - Block);
+	    if (Found != 0)
+	       return P + __builtin_ctzll(Found);
+	    P = Block + 64;
+	 }
+      }
+      if (P >= End)
+	 return nullptr;
+      return static_cast<char const *>(memchr(P, C, End - P));
+   }
+
+   TagScanner(ScanBlockFunc const ScanBlock, char const *const End, char const *&Block, ScanMasks &Masks) : ScanBlock(ScanBlock), End(End), Block(Block), Masks(Masks) {}
+};
+}
+									/*}}}*/
+class APT_HIDDEN pkgTagSectionPrivate					/*{{{*/
+{
+public:
+   ScanBlockFunc ScanBlock = BestScanBlock();
+   /* The block the last scan ended in is usually where the next section
+      starts. pkgTagFile::Step tells us the id of the buffer content, so we
+      only reuse the block while that content is still the same and every
+      byte of a file is classified just once. */
+   char const *Block = nullptr;
+   ScanMasks Masks{0, 0};
+   uint64_t BlockContentId = 0;
+   uint64_t ContentId = 0;
    struct TagData {
       unsigned int StartTag;
       unsigned int EndTag;
@@ -139,6 +271,8 @@ void pkgTagFile::Init(FileFd * const pFd, pkgTagFile::Flags const pFlags, unsign
 
    if (d->Fd->IsOpen() == false)
       d->Start = d->End = d->Buffer = 0;
+   else if (d->MapFile() == true)
+      return;
    else
       d->Buffer = (char*)malloc(sizeof(char) * Size);
 
@@ -157,6 +291,44 @@ void pkgTagFile::Init(FileFd * const pFd,unsigned long long Size)
    Init(pFd, pkgTagFile::STRICT, Size);
 }
 									/*}}}*/
+// TagFilePrivate::MapFile - Parse the file in place if possible	/*{{{*/
+// ---------------------------------------------------------------------
+/* Uncompressed files like the ones in the lists directory can be mapped
+   into memory as a whole, so the sections point directly into the page
+   cache instead of a copy in our buffer. We only do that if we never have
+   to modify the data: there are no comments to remove and the last
+   section is already terminated by an empty line. In all other cases the
+   file is read into the buffer as usual. */
+bool pkgTagFilePrivate::MapFile()
+{
+   if ((Flags & pkgTagFile::SUPPORT_COMMENTS) != 0 || Fd->IsCompressed() == true ||
+       _config->FindB("Debug::pkgTagFile::NoMMap", false) == true)
+      return false;
+   struct stat Buf;
+   if (fstat(Fd->Fd(), &Buf) != 0 || S_ISREG(Buf.st_mode) == false ||
+       Buf.st_size < 2 || Fd->Tell() != 0)
+      return false;
+
+   _error->PushToStack();
+   auto NewMap = std::make_unique<MMap>(*Fd, MMap::ReadOnly);
+   bool const Mapped = NewMap->validData() && NewMap->Size() == static_cast<unsigned long long>(Buf.st_size);
+   _error->RevertToStack();
+   if (Mapped == false)
+      return false;
+
+   char * const Data = static_cast<char *>(NewMap->Data());
+   char const * const Last = Data + NewMap->Size();
+   if (Last[-1] != '\n' || Last[-2] != '\n')
+      return false;
+
+   Map = std::move(NewMap);
+   Buffer = Start = Data;
+   End = Data + Map->Size();
+   Size = Map->Size();
+   Done = true;
+   return true;
+}
+									/*}}}*/
 // TagFile::~pkgTagFile - Destructor					/*{{{*/
 pkgTagFile::~pkgTagFile() = default;
 									/*}}}*/
@@ -173,6 +345,9 @@ APT_PURE unsigned long pkgTagFile::Offset()
  */
 bool pkgTagFile::Resize()
 {
+   // the mapping contains the whole file already
+   if (d->Map != nullptr)
+      return false;
    // fail is the buffer grows too big
    if(d->Size > 1024*1024+1)
       return false;
@@ -189,6 +364,7 @@ bool pkgTagFile::Resize(unsigned long long const newSize)
       return false;
    d->Buffer = newBuffer;
    d->Size = newSize;
+   d->ContentId = NewContentId();
 
    // update the start/end pointers to the new buffer
    d->Start = d->Buffer;
@@ -204,21 +380,26 @@ bool pkgTagFile::Resize(unsigned long long const newSize)
  */
 bool pkgTagFile::Step(pkgTagSection &Tag)
 {
-   if(Tag.Scan(d->Start,d->End - d->Start) == false)
+   auto const Scan = [&](bool const Restart) {
+      Tag.d->ScanBlock = d->NoSIMD ? nullptr : BestScanBlock();
+      Tag.d->ContentId = d->ContentId;
+      return Tag.Scan(d->Start, d->End - d->Start, Restart);
+   };
+   if (Scan(true) == false)
    {
       do
       {
 	 if (Fill() == false)
 	    return false;
 
-	 if(Tag.Scan(d->Start,d->End - d->Start, false))
+	 if (Scan(false))
 	    break;
 
 	 if (Resize() == false)
 	    return _error->Error(_("Unable to parse package file %s (%d)"),
 		  d->Fd->Name().c_str(), 1);
 
-      } while (Tag.Scan(d->Start,d->End - d->Start, false) == false);
+      } while (Scan(false) == false);
    }
 
    size_t tagSize = Tag.size();
@@ -384,6 +565,9 @@ void pkgTagFilePrivate::RemoveCommentsFromBuffer()
 bool pkgTagFile::Fill()
 {
    unsigned long long const EndSize = d->End - d->Start;
+   if (d->Map != nullptr)
+      return EndSize > 3;
+   d->ContentId = NewContentId();
    if (EndSize != 0)
    {
       memmove(d->Buffer,d->Start,EndSize);
@@ -434,6 +618,15 @@ bool pkgTagFile::Jump(pkgTagSection &Tag,unsigned long long Offset)
 {
    // Head back to the start of the buffer, in case we get called for the same section
    // again (d->Start will point to next section already)
+   if (d->Map != nullptr)
+   {
+      if (Offset >= d->Size)
+	 return false;
+      d->Start = d->Buffer + Offset;
+      d->iOffset = Offset;
+      return Tag.Scan(d->Start, d->End - d->Start);
+   }
+
    d->iOffset -= d->Start - d->Buffer;
    d->Start = d->Buffer;
 
@@ -492,6 +685,10 @@ bool pkgTagSection::Scan(const char *Start,unsigned long MaxLength, bool const R
    Section = Start;
    const char *End = Start + MaxLength;
 
+   if (d->ContentId == 0 || d->ContentId != d->BlockContentId || (d->Block != nullptr && d->Block + 64 > End))
+      d->Block = nullptr;
+   d->BlockContentId = std::exchange(d->ContentId, 0);
+
    if (Restart == false && d->Tags.empty() == false)
    {
       Stop = Section + d->Tags.back().StartTag;
@@ -518,6 +715,7 @@ bool pkgTagSection::Scan(const char *Start,unsigned long MaxLength, bool const R
    if (Stop == 0)
       return false;
 
+   TagScanner Scanner(d->ScanBlock, End, d->Block, d->Masks);
    pkgTagSectionPrivate::TagData lastTagData(0);
    Key lastTagKey = Key::Unknown;
    unsigned int lastTagHash = 0;
@@ -549,7 +747,7 @@ bool pkgTagSection::Scan(const char *Start,unsigned long MaxLength, bool const R
 	 ++TagCount;
 	 lastTagData = pkgTagSectionPrivate::TagData(Stop - Section);
 	 // find the colon separating tag and value
-	 char const * Colon = (char const *) memchr(Stop, ':', End - Stop);
+	 char const * Colon = Scanner.Find(Stop, ':');
 	 if (Colon == NULL)
 	    return false;
 	 // find the end of the tag (which might or might not be the colon)
@@ -572,7 +770,7 @@ bool pkgTagSection::Scan(const char *Start,unsigned long MaxLength, bool const R
 	 lastTagData.StartValue = Stop - Section;
       }
 
-      Stop = (const char *)memchr(Stop,'\n',End - Stop);
+      Stop = Scanner.Find(Stop, '\n');
 
       if (Stop == 0)
 	 return false;
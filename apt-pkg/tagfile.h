@@ -49,6 +49,7 @@ class APT_PUBLIC pkgTagSection
    unsigned int BetaIndexes[128];
 
    std::unique_ptr<pkgTagSectionPrivate> const d;
+   friend class pkgTagFile;
 
    APT_HIDDEN bool FindInternal(unsigned int Pos,const char *&Start, const char *&End) const;
    APT_HIDDEN std::string_view FindInternal(unsigned int Pos) const;
@@ -339,6 +339,10 @@ static bool CleanDownloadDirectories(bool const ListsToo)
    }
 
    pkgCacheFile::RemoveCaches();
+   // update keeps the search index as long as the lists it was built from are the same
+   std::string const searchindex = _config->FindFile("Dir::Cache::searchindex");
+   if (searchindex.empty() == false && RealFileExists(searchindex))
+      RemoveFile("DoClean", searchindex);
 
    return true;
 }
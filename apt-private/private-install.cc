@@ -23,15 +23,19 @@
 #include <apt-pkg/version.h>
 
 #include <algorithm>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <map>
 #include <set>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 #include <langinfo.h>
+#include <signal.h>
 #include <sys/statvfs.h>
+#include <unistd.h>
 
 #include <apt-private/acqprogress.h>
 #include <apt-private/private-cachefile.h>
@@ -182,6 +186,221 @@ static void RemoveDownloadNeedingItemsFromFetcher(pkgAcquire &Fetcher, bool &Tra
       I = Fetcher.ItemsBegin();
    }
 }
+// InstallWhileFetching - Hand downloaded packages to dpkg early	/*{{{*/
+// ---------------------------------------------------------------------
+/* The archives are fetched by a forked child which shows the usual
+   Get:/Err: lines and reports each archive it completed. Once enough
+   archives from the start of the fetch queue (which is in the unpack
+   order of the package manager) are available, they are installed while
+   the child continues downloading the rest.
+   The packages still missing are handled like for a media swap by the
+   ordering: it stops before the first of them and reports Incomplete. */
+class StreamingAcquireStatus : public pkgAcquireStatus
+{
+   int const Fd;
+   std::unordered_map<pkgAcquire::Item const *, size_t> const &Index;
+   // shows the usual progress and Get/Err lines of the download
+   pkgAcquireStatus &Progress;
+
+   void Report(pkgAcquire::ItemDesc const &Itm)
+   {
+      auto const Owner = Itm.Owner;
+      if (Owner->Status != pkgAcquire::Item::StatDone || Owner->Complete == false)
+	 return;
+      auto const I = Index.find(Owner);
+      if (I == Index.end())
+	 return;
+      std::string const Line = std::to_string(I->second) + ' ' + (Owner->Local ? '1' : '0') + ' ' + Owner->DestFile + '\n';
+      FileFd::Write(Fd, Line.data(), Line.size());
+   }
+   // pkgAcquire only looks at our flags to decide when to pulse
+   void SyncFlags()
+   {
+      Update = Progress.Update;
+      MorePulses = Progress.MorePulses;
+   }
+
+   public:
+   bool MediaChange(std::string, std::string) override { return false; }
+   void IMSHit(pkgAcquire::ItemDesc &Itm) override
+   {
+      Progress.IMSHit(Itm);
+      SyncFlags();
+      Report(Itm);
+   }
+   void Fetch(pkgAcquire::ItemDesc &Itm) override
+   {
+      Progress.Fetch(Itm);
+      SyncFlags();
+   }
+   void Done(pkgAcquire::ItemDesc &Itm) override
+   {
+      Progress.Done(Itm);
+      SyncFlags();
+      Report(Itm);
+   }
+   void Fail(pkgAcquire::ItemDesc &Itm) override
+   {
+      Progress.Fail(Itm);
+      SyncFlags();
+   }
+   void Fetched(unsigned long long Size, unsigned long long ResumePoint) override
+   {
+      Progress.Fetched(Size, ResumePoint);
+   }
+   bool Pulse(pkgAcquire *Owner) override
+   {
+      bool const Res = Progress.Pulse(Owner);
+      SyncFlags();
+      return Res;
+   }
+   void Start() override
+   {
+      Progress.Start();
+      SyncFlags();
+   }
+   void Stop() override
+   {
+      Progress.Stop();
+      SyncFlags();
+   }
+
+   StreamingAcquireStatus(int const Fd, std::unordered_map<pkgAcquire::Item const *, size_t> const &Index, pkgAcquireStatus &Progress) : Fd(Fd), Index(Index), Progress(Progress)
+   {
+      SyncFlags();
+   }
+};
+static bool InstallWhileFetching(pkgAcquire &Fetcher, pkgPackageManager &PM, bool &Completed)
+{
+   std::vector<pkgAcquire::Item *> Pending;
+   std::unordered_map<pkgAcquire::Item const *, size_t> Index;
+   for (auto I = Fetcher.ItemsBegin(); I != Fetcher.ItemsEnd(); ++I)
+   {
+      if ((*I)->Status == pkgAcquire::Item::StatDone && (*I)->Complete)
+	 continue;
+      Index.emplace(*I, Pending.size());
+      Pending.push_back(*I);
+   }
+   if (Pending.empty())
+      return true;
+
+   int Pipe[2];
+   if (pipe(Pipe) != 0)
+      return _error->Errno("pipe", "Failed to create IPC pipe to subprocess");
+   // the child would otherwise print what is still buffered a second time
+   std::cout.flush();
+   std::clog.flush();
+   pid_t const Child = ExecFork();
+   if (Child == 0)
+   {
+      close(Pipe[0]);
+      // dpkg shares the terminal with us, so no progress meter redrawing the last line:
+      // the Get:/Err: lines are still shown and the progress is sent to APT::Status-Fd
+      AcqTextStatus Progress(std::cout, ScreenWidth, std::max(1, _config->FindI("quiet", 0)));
+      StreamingAcquireStatus Stat(Pipe[1], Index, Progress);
+      Fetcher.SetLog(&Stat);
+      bool Failed = false;
+      bool Transient = false;
+      if (AcquireRun(Fetcher, 0, &Failed, &Transient) == false)
+	 Failed = true;
+      _error->DumpErrors();
+      std::cout.flush();
+      _exit(Failed ? 100 : 0);
+   }
+   close(Pipe[1]);
+
+   // the child fetches them now, so ordering sees them as missing until reported
+   for (auto const Item : Pending)
+      Item->Finished();
+
+   std::vector<std::pair<bool, std::string>> Reports(Pending.size());
+   std::vector<bool> Arrived(Pending.size(), false);
+   std::string Buffer;
+   bool Open = true;
+   auto const Receive = [&]() {
+      char Buf[4096];
+      ssize_t const Res = read(Pipe[0], Buf, sizeof(Buf));
+      if (Res < 0 && errno == EINTR)
+	 return;
+      if (Res <= 0)
+      {
+	 Open = false;
+	 return;
+      }
+      Buffer.append(Buf, Res);
+      for (size_t End; (End = Buffer.find('\n')) != std::string::npos; Buffer.erase(0, End + 1))
+      {
+	 std::string const Line = Buffer.substr(0, End);
+	 auto const First = Line.find(' ');
+	 if (First == std::string::npos || Line.length() < First + 3)
+	    continue;
+	 size_t const I = strtoul(Line.c_str(), nullptr, 10);
+	 if (I >= Pending.size())
+	    continue;
+	 Reports[I] = {Line[First + 1] == '1', Line.substr(First + 3)};
+	 Arrived[I] = true;
+      }
+   };
+
+   size_t const MinBatch = std::max(1, _config->FindI("APT::Install::Streaming::Min-Batch", 10));
+   bool const Debug = _config->FindB("Debug::APT::Install::Streaming", false);
+   size_t Fetched = 0;
+   auto const HandOver = [&](size_t const Until) {
+      for (; Fetched < Until; ++Fetched)
+      {
+	 // the file is no longer at the partial location, so Done takes the reported filename
+	 Pending[Fetched]->Done("Filename: " + Reports[Fetched].second, {}, nullptr);
+	 Pending[Fetched]->Local = Reports[Fetched].first;
+      }
+   };
+   bool Success = true;
+   while (Completed == false)
+   {
+      size_t Ready = Fetched;
+      while (Ready < Pending.size() && Arrived[Ready])
+	 ++Ready;
+      if (Ready == Pending.size() || Open == false)
+	 break;
+      if (Ready - Fetched < MinBatch)
+      {
+	 Receive();
+	 continue;
+      }
+      HandOver(Ready);
+      if (Debug)
+	 std::clog << "Installing while fetching with " << Fetched << " of " << Pending.size() << " archives" << std::endl;
+
+      auto const progress = APT::Progress::PackageManagerProgressFactory();
+      _system->UnLockInner();
+      pkgPackageManager::OrderResult const Res = PM.DoInstall(progress);
+      delete progress;
+      if (Res == pkgPackageManager::Failed || _error->PendingError() == true)
+      {
+	 Success = false;
+	 break;
+      }
+      _system->LockInner();
+      Completed = Res == pkgPackageManager::Completed;
+   }
+   if (Success == false || Completed)
+      kill(Child, SIGTERM);
+   else
+      while (Open)
+	 Receive();
+   close(Pipe[0]);
+   bool const ChildOkay = ExecWait(Child, "acquire", true);
+   if (Success == false || Completed)
+      return Success;
+
+   size_t Ready = Fetched;
+   while (Ready < Pending.size() && Arrived[Ready])
+      ++Ready;
+   if (ChildOkay == false || Ready != Pending.size())
+      return _error->Error(_("Unable to fetch some archives, maybe run apt update or try with --fix-missing?"));
+   HandOver(Ready);
+   return true;
+}
+									/*}}}*/
 #ifdef REQUIRE_MERGED_USR
 // \brief Issues a warning about usrmerge when destructed so we can call it after install finished or failed or whatever.
 struct WarnUsrMerge {
@@ -531,7 +750,14 @@ bool InstallPackages(CacheFile &Cache, APT::PackageVector &HeldBackPackages, boo
 
    // Run it
    bool Failed = false;
-   while (1)
+   bool Completed = false;
+   if (_config->FindB("APT::Install::Streaming", false) && DownloadAllowed &&
+       _config->FindB("APT::Get::Download-Only", false) == false &&
+       _config->FindB("APT::Get::Fix-Missing", false) == false &&
+       _config->Find("APT::Planner", "internal") == "internal" &&
+       InstallWhileFetching(Fetcher, *PM, Completed) == false)
+      return false;
+   while (Completed == false)
    {
       bool Transient = false;
       if (AcquireRun(Fetcher, 0, &Failed, &Transient) == false)
@@ -7,11 +7,14 @@
 #include <apt-pkg/cmndline.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/depcache.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
 #include <apt-pkg/macros.h>
 #include <apt-pkg/pkgcache.h>
 #include <apt-pkg/pkgrecords.h>
 #include <apt-pkg/policy.h>
 #include <apt-pkg/progress.h>
+#include <apt-pkg/strutl.h>
 
 #include <apt-private/private-cachefile.h>
 #include <apt-private/private-cacheset.h>
@@ -20,14 +23,22 @@
 #include <apt-private/private-search.h>
 #include <apt-private/private-show.h>
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <sys/mman.h>
+
 #include <apti18n.h>
 									/*}}}*/
 
@@ -48,6 +59,440 @@ static std::vector<pkgCache::DescIterator> const TranslatedDescriptionsList(pkgC
    return Descriptions;
 }
 
+									/*}}}*/
+// SearchIndex - Trigrams of the descriptions per package group	/*{{{*/
+/* The index maps each trigram of the ASCII-lowercased long descriptions
+   to the groups having a description containing it, so that a search only
+   needs to look at the descriptions of groups which contain all the
+   trigrams a pattern requires. It is built by update for the descriptions
+   in the index files in Dir::State::lists and is valid as long as those
+   are the same. Descriptions only available from other files like the
+   dpkg status are not in it, so those are always looked at. */
+namespace
+{
+struct SearchIndexHeader
+{
+   char Signature[8];
+   uint32_t Version;
+   uint32_t GroupCount;
+   uint32_t TrigramCount;
+   uint32_t Padding;
+   uint64_t Key;
+   uint64_t PostingsSize;
+};
+struct SearchIndexTrigram
+{
+   uint32_t Trigram;
+   uint32_t Count;
+   uint64_t Offset;
+};
+constexpr char SearchIndexSignature[8] = {'A', 'P', 'T', 'S', 'R', 'C', 'H', '\0'};
+constexpr uint32_t SearchIndexVersion = 1;
+} // namespace
+
+static uint64_t SearchIndexHash(uint64_t Hash, std::string_view const Data)
+{
+   // FNV-1a
+   for (unsigned char const c : Data)
+      Hash = (Hash ^ c) * 1099511628211ull;
+   return Hash;
+}
+static uint32_t SearchIndexGroupHash(pkgCache::GrpIterator const &G)
+{
+   return SearchIndexHash(14695981039346656037ull, G.Name());
+}
+// the files indexed are those downloaded by update
+static std::vector<bool> SearchIndexFiles(pkgCache &Cache)
+{
+   std::string const Lists = _config->FindDir("Dir::State::lists");
+   std::vector<bool> Indexed(Cache.Head().PackageFileCount, false);
+   for (auto F = Cache.FileBegin(); F.end() == false; ++F)
+      Indexed[F->ID] = F.FileName() != nullptr && flNotFile(F.FileName()) == Lists;
+   return Indexed;
+}
+static uint64_t SearchIndexKey(pkgCache &Cache, std::vector<bool> const &Indexed)
+{
+   uint64_t Key = 14695981039346656037ull;
+   for (auto F = Cache.FileBegin(); F.end() == false; ++F)
+   {
+      if (Indexed[F->ID] == false)
+	 continue;
+      Key = SearchIndexHash(Key, F.FileName());
+      Key = SearchIndexHash(Key, std::to_string(F->Size) + ' ' + std::to_string(F->mtime));
+   }
+   return Key;
+}
+/* The groups of a trigram are stored as variable length differences, or,
+   if a trigram is in so many groups that this is smaller, as a bitmap. */
+static bool SearchIndexIsBitmap(uint32_t const Count, uint32_t const GroupCount)
+{
+   return uint64_t(Count) * 8 >= GroupCount;
+}
+static std::vector<uint32_t> SearchIndexDifferences(unsigned char const *Data, unsigned char const *const End, uint32_t const Count)
+{
+   std::vector<uint32_t> Groups;
+   Groups.reserve(Count);
+   uint32_t Group = 0;
+   for (uint32_t i = 0; i < Count; ++i)
+   {
+      uint32_t Delta = 0;
+      for (unsigned int Shift = 0;; Shift += 7)
+      {
+	 if (Data == End || Shift > 28)
+	    return Groups;
+	 Delta |= static_cast<uint32_t>(*Data & 0x7f) << Shift;
+	 if ((*Data++ & 0x80) == 0)
+	    break;
+      }
+      Group += Delta;
+      Groups.push_back(Group);
+   }
+   return Groups;
+}
+static std::vector<uint32_t> SearchIndexGroups(unsigned char const *Data, unsigned char const *const End, uint32_t const Count, uint32_t const GroupCount)
+{
+   if (SearchIndexIsBitmap(Count, GroupCount) == false)
+      return SearchIndexDifferences(Data, End, Count);
+   std::vector<uint32_t> Groups;
+   Groups.reserve(Count);
+   for (uint32_t G = 0; G < GroupCount; ++G)
+      if ((Data[G / 8] & (1 << (G % 8))) != 0)
+	 Groups.push_back(G);
+   return Groups;
+}
+static void AddTrigrams(std::vector<uint32_t> &Trigrams, std::string_view const Text)
+{
+   if (Text.size() < 3)
+      return;
+   auto const Byte = [&](size_t const i) { return static_cast<uint32_t>(static_cast<unsigned char>(tolower_ascii(Text[i]))); };
+   uint32_t Trigram = (Byte(0) << 8) | Byte(1);
+   for (size_t i = 2; i < Text.size(); ++i)
+   {
+      Trigram = ((Trigram << 8) | Byte(i)) & 0xffffff;
+      Trigrams.push_back(Trigram);
+   }
+}
+									/*}}}*/
+// RequiredTrigrams - Trigrams each text matched by the regex contains	/*{{{*/
+/* Only literal parts of the pattern are considered. The pattern is given
+   up on for anything which could make them optional or alternatives, so
+   the result is never more than required, but might well be less. */
+static std::vector<uint32_t> RequiredTrigrams(std::string_view const Pattern)
+{
+   std::vector<uint32_t> Trigrams;
+   if (Pattern.find_first_of("|()") != std::string_view::npos ||
+       Pattern.find("[:") != std::string_view::npos || Pattern.find("[.") != std::string_view::npos ||
+       Pattern.find("[=") != std::string_view::npos)
+      return Trigrams;
+   std::string Run;
+   auto const EndRun = [&]() {
+      AddTrigrams(Trigrams, Run);
+      Run.clear();
+   };
+   for (size_t i = 0; i < Pattern.size(); ++i)
+   {
+      char const c = Pattern[i];
+      switch (c)
+      {
+      case '*':
+      case '?':
+      case '{':
+	 // the previous atom is optional
+	 if (Run.empty() == false)
+	    Run.pop_back();
+	 EndRun();
+	 if (c == '{')
+	    i = std::min(Pattern.find('}', i), Pattern.size());
+	 break;
+      case '+':
+	 EndRun();
+	 break;
+      case '[':
+	 EndRun();
+	 // a ] right at the start is part of the bracket expression
+	 i = Pattern.find(']', i + ((i + 1 < Pattern.size() && Pattern[i + 1] == '^') ? 3 : 2));
+	 if (i == std::string_view::npos)
+	    return {};
+	 // the next one might be optional, which doesn't matter as it isn't in the run
+	 break;
+      case '\\':
+	 // only escaped metacharacters are literals, glibc has anchors like \< and \` as well
+	 if (i + 1 < Pattern.size() && Pattern[i + 1] != '\0' && strchr(".[]{}()*+?^$|\\", Pattern[i + 1]) != nullptr)
+	    Run.push_back(Pattern[++i]);
+	 else
+	 {
+	    EndRun();
+	    ++i;
+	 }
+	 break;
+      case '.':
+      case '^':
+      case '$':
+	 EndRun();
+	 break;
+      default:
+	 if (isascii(c) == false)
+	    EndRun();
+	 else
+	    Run.push_back(c);
+	 break;
+      }
+   }
+   EndRun();
+   std::sort(Trigrams.begin(), Trigrams.end());
+   Trigrams.erase(std::unique(Trigrams.begin(), Trigrams.end()), Trigrams.end());
+   return Trigrams;
+}
+									/*}}}*/
+namespace
+{
+class SearchIndex							/*{{{*/
+{
+   void *Map = MAP_FAILED;
+   size_t MapSize = 0;
+   SearchIndexHeader const *Header = nullptr;
+   uint32_t const *GroupHashes = nullptr;
+   SearchIndexTrigram const *Table = nullptr;
+   unsigned char const *Postings = nullptr;
+   std::vector<bool> Indexed;
+   // per pattern the groups which might match it, nothing if all might
+   std::vector<std::optional<std::vector<bool>>> Candidates;
+
+   public:
+   SearchIndex() = default;
+   SearchIndex(SearchIndex const &) = delete;
+   SearchIndex &operator=(SearchIndex const &) = delete;
+   ~SearchIndex()
+   {
+      if (Map != MAP_FAILED)
+	 munmap(Map, MapSize);
+   }
+
+   bool Open(pkgCache &Cache)
+   {
+      std::string const IndexFile = _config->FindFile("Dir::Cache::searchindex");
+      if (IndexFile.empty() || RealFileExists(IndexFile) == false)
+	 return false;
+      _error->PushToStack();
+      FileFd Fd;
+      bool const Okay = Fd.Open(IndexFile, FileFd::ReadOnly);
+      _error->RevertToStack();
+      if (Okay == false || Fd.FileSize() < sizeof(SearchIndexHeader))
+	 return false;
+      MapSize = Fd.FileSize();
+      Map = mmap(nullptr, MapSize, PROT_READ, MAP_SHARED, Fd.Fd(), 0);
+      if (Map == MAP_FAILED)
+	 return false;
+
+      auto const Base = static_cast<unsigned char const *>(Map);
+      auto const Head = reinterpret_cast<SearchIndexHeader const *>(Base);
+      uint64_t const TableStart = sizeof(SearchIndexHeader) + (uint64_t(Head->GroupCount) + Head->GroupCount % 2) * sizeof(uint32_t);
+      uint64_t const PostingsStart = TableStart + uint64_t(Head->TrigramCount) * sizeof(SearchIndexTrigram);
+      if (memcmp(Head->Signature, SearchIndexSignature, sizeof(SearchIndexSignature)) != 0 ||
+	  Head->Version != SearchIndexVersion || PostingsStart + Head->PostingsSize != MapSize)
+	 return false;
+      Indexed = SearchIndexFiles(Cache);
+      if (Head->Key != SearchIndexKey(Cache, Indexed))
+	 return false;
+      // a list takes at least a byte per group, so a broken file can't make us read past it
+      auto const Trigrams = reinterpret_cast<SearchIndexTrigram const *>(Base + TableStart);
+      for (uint32_t T = 0; T < Head->TrigramCount; ++T)
+      {
+	 auto const &Trigram = Trigrams[T];
+	 uint64_t const Size = SearchIndexIsBitmap(Trigram.Count, Head->GroupCount) ? (uint64_t(Head->GroupCount) + 7) / 8 : Trigram.Count;
+	 if (Trigram.Count > Head->GroupCount || Trigram.Offset > Head->PostingsSize || Size > Head->PostingsSize - Trigram.Offset)
+	    return false;
+      }
+      Header = Head;
+      GroupHashes = reinterpret_cast<uint32_t const *>(Base + sizeof(SearchIndexHeader));
+      Table = Trigrams;
+      Postings = Base + PostingsStart;
+      return true;
+   }
+
+   /** \brief if the index has the groups of the cache with the same IDs */
+   bool HasGroupsOf(pkgCache &Cache) const
+   {
+      if (Header == nullptr || Header->GroupCount != Cache.Head().GroupCount)
+	 return false;
+      for (auto G = Cache.GrpBegin(); G.end() == false; ++G)
+	 if (GroupHashes[G->ID] != SearchIndexGroupHash(G))
+	    return false;
+      return true;
+   }
+
+   void AddPattern(char const *const Pattern)
+   {
+      auto &Result = Candidates.emplace_back();
+      auto const Trigrams = RequiredTrigrams(Pattern);
+      if (Header == nullptr || Trigrams.empty())
+	 return;
+      std::vector<SearchIndexTrigram const *> Lists;
+      for (auto const T : Trigrams)
+      {
+	 auto const L = std::lower_bound(Table, Table + Header->TrigramCount, T, [](auto const &A, uint32_t const B) { return A.Trigram < B; });
+	 if (L == Table + Header->TrigramCount || L->Trigram != T)
+	 {
+	    Lists.clear();
+	    break;
+	 }
+	 Lists.push_back(L);
+      }
+      Result.emplace(Header->GroupCount, false);
+      if (Lists.empty())
+	 return;
+      std::sort(Lists.begin(), Lists.end(), [](auto const A, auto const B) { return A->Count < B->Count; });
+      auto const GroupsOf = [&](SearchIndexTrigram const *const T) { return SearchIndexGroups(Postings + T->Offset, Postings + Header->PostingsSize, T->Count, Header->GroupCount); };
+      auto Groups = GroupsOf(Lists.front());
+      for (auto L = Lists.begin() + 1; L != Lists.end() && Groups.empty() == false; ++L)
+      {
+	 auto const Other = GroupsOf(*L);
+	 std::vector<uint32_t> Both;
+	 std::set_intersection(Groups.begin(), Groups.end(), Other.begin(), Other.end(), std::back_inserter(Both));
+	 Groups = std::move(Both);
+      }
+      for (auto const G : Groups)
+	 if (G < Header->GroupCount)
+	    (*Result)[G] = true;
+      if (_config->FindB("Debug::APT::Search::Index", false))
+	 std::clog << "Search index: " << Groups.size() << " of " << Header->GroupCount << " groups might match " << Pattern << std::endl;
+   }
+
+   /** \brief if the descriptions of this version can match the pattern
+    *
+    * The name has to be checked separately. */
+   bool MayMatch(size_t const Pattern, pkgCache::VerIterator const &V, std::vector<pkgCache::DescIterator> const &Descriptions) const
+   {
+      // without a usable index no pattern was added
+      if (Header == nullptr || Pattern >= Candidates.size() || Candidates[Pattern].has_value() == false)
+	 return true;
+      auto const G = V.ParentPkg().Group();
+      if (G->ID >= Header->GroupCount || GroupHashes[G->ID] != SearchIndexGroupHash(G))
+	 return true;
+      for (auto const &D : Descriptions)
+	 if (auto const DF = D.FileList(); DF.end() || Indexed[DF.File()->ID] == false)
+	    return true;
+      return (*Candidates[Pattern])[G->ID];
+   }
+};
+									/*}}}*/
+} // namespace
+bool BuildSearchIndex(pkgCacheFile &CacheFile)				/*{{{*/
+{
+   std::string const IndexFile = _config->FindFile("Dir::Cache::searchindex");
+   pkgCache *const Cache = CacheFile.GetPkgCache();
+   if (IndexFile.empty() || Cache == nullptr)
+      return true;
+
+   // nothing to do if neither the index files nor the groups changed
+   if (SearchIndex Existing; Existing.Open(*Cache) && Existing.HasGroupsOf(*Cache))
+      return true;
+
+   auto const Indexed = SearchIndexFiles(*Cache);
+   struct Posting
+   {
+      std::string Data;
+      uint32_t Last = 0;
+      uint32_t Count = 0;
+   };
+   std::unordered_map<uint32_t, Posting> Postings;
+   std::vector<uint32_t> GroupHashes(Cache->Head().GroupCount);
+   std::vector<uint32_t> DescSeen(Cache->Head().DescriptionCount, 0);
+   std::vector<uint32_t> Trigrams;
+   // the postings store differences between ascending groups, but GrpBegin iterates in hash order
+   std::vector<pkgCache::GrpIterator> Groups(Cache->Head().GroupCount);
+   for (auto G = Cache->GrpBegin(); G.end() == false; ++G)
+      Groups[G->ID] = G;
+   pkgRecords Recs(*Cache);
+   for (auto const &G : Groups)
+   {
+      GroupHashes[G->ID] = SearchIndexGroupHash(G);
+      Trigrams.clear();
+      for (auto P = G.PackageList(); P.end() == false; P = G.NextPkg(P))
+	 for (auto V = P.VersionList(); V.end() == false; ++V)
+	    for (auto D = V.DescriptionList(); D.end() == false; ++D)
+	    {
+	       // the architectures of a group usually share their descriptions
+	       if (DescSeen[D->ID] == G->ID + 1)
+		  continue;
+	       DescSeen[D->ID] = G->ID + 1;
+	       // search reads the description from the first file only
+	       if (auto const DF = D.FileList(); DF.end() == false && Indexed[DF.File()->ID])
+		  AddTrigrams(Trigrams, Recs.Lookup(DF).LongDesc());
+	    }
+      std::sort(Trigrams.begin(), Trigrams.end());
+      Trigrams.erase(std::unique(Trigrams.begin(), Trigrams.end()), Trigrams.end());
+      for (auto const T : Trigrams)
+      {
+	 auto &P = Postings[T];
+	 for (uint32_t Delta = G->ID - P.Last;; Delta >>= 7)
+	 {
+	    if (Delta < 0x80)
+	    {
+	       P.Data.push_back(static_cast<char>(Delta));
+	       break;
+	    }
+	    P.Data.push_back(static_cast<char>((Delta & 0x7f) | 0x80));
+	 }
+	 P.Last = G->ID;
+	 ++P.Count;
+      }
+   }
+
+   std::vector<SearchIndexTrigram> Table;
+   Table.reserve(Postings.size());
+   for (auto const &P : Postings)
+      Table.push_back({P.first, P.second.Count, 0});
+   std::sort(Table.begin(), Table.end(), [](auto const &A, auto const &B) { return A.Trigram < B.Trigram; });
+   uint64_t Offset = 0;
+   for (auto &T : Table)
+   {
+      if (SearchIndexIsBitmap(T.Count, Groups.size()))
+      {
+	 auto &Data = Postings[T.Trigram].Data;
+	 std::string Bitmap((Groups.size() + 7) / 8, '\0');
+	 auto const Begin = reinterpret_cast<unsigned char const *>(Data.data());
+	 for (auto const G : SearchIndexDifferences(Begin, Begin + Data.size(), T.Count))
+	    Bitmap[G / 8] |= 1 << (G % 8);
+	 Data = std::move(Bitmap);
+      }
+      T.Offset = Offset;
+      Offset += Postings[T.Trigram].Data.size();
+   }
+
+   SearchIndexHeader Header{};
+   memcpy(Header.Signature, SearchIndexSignature, sizeof(Header.Signature));
+   Header.Version = SearchIndexVersion;
+   Header.GroupCount = GroupHashes.size();
+   Header.TrigramCount = Table.size();
+   Header.Key = SearchIndexKey(*Cache, Indexed);
+   Header.PostingsSize = Offset;
+
+   // failing to write the index only makes searching slower
+   _error->PushToStack();
+   FileFd Out(IndexFile, FileFd::WriteAtomic);
+   bool Okay = Out.IsOpen() && Out.Write(&Header, sizeof(Header)) &&
+	       Out.Write(GroupHashes.data(), GroupHashes.size() * sizeof(GroupHashes[0]));
+   if (Okay && GroupHashes.size() % 2 != 0)
+   {
+      uint32_t const Padding = 0;
+      Okay = Out.Write(&Padding, sizeof(Padding));
+   }
+   Okay = Okay && Out.Write(Table.data(), Table.size() * sizeof(Table[0]));
+   for (auto I = Table.begin(); Okay && I != Table.end(); ++I)
+   {
+      auto const &Data = Postings[I->Trigram].Data;
+      Okay = Out.Write(Data.data(), Data.size());
+   }
+   Okay = Okay && Out.Close();
+   _error->RevertToStack();
+   if (Okay == false)
+   {
+      Out.OpFail();
+      _error->Warning(_("Unable to write the search index %s"), IndexFile.c_str());
+   }
+   return true;
+}
 									/*}}}*/
 static bool FullTextSearch(CommandLine &CmdL)				/*{{{*/
 {
@@ -101,6 +546,10 @@ static bool FullTextSearch(CommandLine &CmdL)				/*{{{*/
       format += "  ${LongDescription}\n";
 
    bool const NamesOnly = _config->FindB("APT::Cache::NamesOnly", false);
+   SearchIndex Index;
+   if (not NamesOnly && Index.Open(*Cache))
+      for (unsigned int I = 0; I != NumPatterns; ++I)
+	 Index.AddPattern(CmdL.FileList[I + 1]);
    int Done = 0;
    std::vector<bool> PkgsDone(Cache->Head().PackageCount, false);
    for ( ;V != bag.end(); ++V)
@@ -114,10 +563,17 @@ static bool FullTextSearch(CommandLine &CmdL)				/*{{{*/
       if (PkgsDone[P->ID] == true)
 	 continue;
 
+      char const * const PkgName = P.Name();
       std::vector<std::string> PkgDescriptions;
       if (not NamesOnly)
       {
-         for (auto &Desc: TranslatedDescriptionsList(V))
+	 auto const Descriptions = TranslatedDescriptionsList(V);
+	 bool MayMatch = true;
+	 for (unsigned int I = 0; I != NumPatterns && MayMatch; ++I)
+	    MayMatch = regexec(&Patterns[I], PkgName, 0, 0, 0) == 0 || Index.MayMatch(I, V, Descriptions);
+	 if (not MayMatch)
+	    continue;
+         for (auto &Desc: Descriptions)
          {
             pkgRecords::Parser &parser = records.Lookup(Desc.FileList());
             PkgDescriptions.push_back(parser.LongDesc());
@@ -126,7 +582,6 @@ static bool FullTextSearch(CommandLine &CmdL)				/*{{{*/
 
       bool all_found = true;
 
-      char const * const PkgName = P.Name();
       std::vector<bool> SkipDescription(PkgDescriptions.size(), false);
       for (std::vector<regex_t>::const_iterator pattern = Patterns.begin();
            pattern != Patterns.end(); ++pattern)
@@ -330,6 +785,11 @@ static bool Search(CommandLine &CmdL)
 
    LocalitySort(&DFList->Df, Cache->HeaderP->GroupCount, sizeof(*DFList));
 
+   SearchIndex Index;
+   if (not NamesOnly && Index.Open(*Cache))
+      for (unsigned I = 0; I < NumPatterns; ++I)
+	 Index.AddPattern(CmdL.FileList[I + 1]);
+
    // Create the text record parser
    pkgRecords Recs(*Cache);
    // Iterate over all the version records and check them
@@ -338,8 +798,14 @@ static bool Search(CommandLine &CmdL)
       size_t const PatternOffset = J->ID * NumPatterns;
       if (not NamesOnly)
       {
+	 auto const Descriptions = TranslatedDescriptionsList(J->V);
+	 bool MayMatch = true;
+	 for (unsigned I = 0; I < NumPatterns && MayMatch; ++I)
+	    MayMatch = PatternMatch[PatternOffset + I] || Index.MayMatch(I, J->V, Descriptions);
+	 if (not MayMatch)
+	    continue;
          std::vector<std::string> PkgDescriptions;
-         for (auto &Desc: TranslatedDescriptionsList(J->V))
+         for (auto &Desc: Descriptions)
          {
             pkgRecords::Parser &parser = Recs.Lookup(Desc.FileList());
             PkgDescriptions.push_back(parser.LongDesc());
@@ -5,8 +5,10 @@
 #include <apt-pkg/pkgcache.h>
 
 class CommandLine;
+class pkgCacheFile;
 
 APT_PUBLIC bool DoSearch(CommandLine &CmdL);
+bool BuildSearchIndex(pkgCacheFile &CacheFile);
 APT_PUBLIC void LocalitySort(pkgCache::VerFile ** const begin, unsigned long long const Count,size_t const Size);
 
 #endif
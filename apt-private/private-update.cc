@@ -17,6 +17,7 @@
 #include <apt-private/private-cachefile.h>
 #include <apt-private/private-download.h>
 #include <apt-private/private-output.h>
+#include <apt-private/private-search.h>
 #include <apt-private/private-update.h>
 
 #include <ostream>
@@ -78,10 +79,18 @@ bool DoUpdate()
    if (_config->FindB("pkgCacheFile::Generate", true) == false)
       return true;
 
-   // Rebuild the cache.
-   pkgCacheFile::RemoveCaches();
+   // Rebuild the cache. An incremental update needs the old source cache.
+   if (_config->FindB("APT::Cache-Incremental", false) == true)
+   {
+      std::string const pkgcache = _config->FindFile("Dir::Cache::pkgcache");
+      if (pkgcache.empty() == false && RealFileExists(pkgcache))
+	 RemoveFile("DoUpdate", pkgcache);
+   }
+   else
+      pkgCacheFile::RemoveCaches();
    if (Cache.BuildCaches(false) == false)
       return false;
+   BuildSearchIndex(Cache);
 
    bool const SLWarnings = _config->FindB("APT::Get::Update::SourceListWarnings", true);
    if (SLWarnings)
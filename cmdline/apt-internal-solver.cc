@@ -33,6 +33,7 @@
 #include <cstring>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <libgen.h>
@@ -150,10 +151,22 @@ int main(int argc,const char *argv[])					/*{{{*/
 
 	EDSP::WriteProgress(5, "Read scenario…", output);
 
-	pkgCacheFile CacheFile;
-	CacheFile.InhibitActionGroups(true);
-	if (CacheFile.Open(NULL, false) == false)
-		DIE("Failed to open CacheFile!");
+	std::unique_ptr<pkgCacheFile> Scenario;
+	if (flags & EDSP::Request::BINARY_SCENARIO)
+	{
+		Scenario = EDSP::ReadBinaryScenario(EDSP::BinaryScenarioFd);
+		if (Scenario == nullptr)
+			DIE("Failed to map the binary scenario!");
+		(*Scenario)->IncreaseActionGroupLevel();
+	}
+	else
+	{
+		Scenario = std::make_unique<pkgCacheFile>();
+		Scenario->InhibitActionGroups(true);
+		if (Scenario->Open(NULL, false) == false)
+			DIE("Failed to open CacheFile!");
+	}
+	pkgCacheFile &CacheFile = *Scenario;
 
 	EDSP::WriteProgress(50, "Apply request on scenario…", output);
 
@@ -40,6 +40,7 @@
 #include "cachedb.h"
 #include "multicompress.h"
 #include "override.h"
+#include "pdiffjumps.h"
 #include "writer.h"
 
 #include <apti18n.h>
@@ -623,6 +624,7 @@ static bool ShowHelp(CommandLine &)					/*{{{*/
       "          release path\n"
       "          generate config [groups]\n"
       "          clean config\n"
+      "          pdiff-jumps diffdir\n"
       "\n"
       "apt-ftparchive generates index files for Debian archives. It supports\n"
       "many styles of generation from fully automated to functional replacements\n"
@@ -773,6 +775,17 @@ static bool SimpleGenRelease(CommandLine &CmdL)
    return true;
 }
 
+									/*}}}*/
+// SimpleGenPDiffJumps - Add jump patches to a pdiff Index		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+static bool SimpleGenPDiffJumps(CommandLine &CmdL)
+{
+   if (CmdL.FileSize() < 2)
+      return ShowHelp(CmdL);
+
+   return GenPDiffJumps(CmdL.FileList[1]);
+}
 									/*}}}*/
 // DoGeneratePackagesAndSources - Helper for Generate                   /*{{{*/
 // ---------------------------------------------------------------------
@@ -1027,6 +1040,7 @@ static std::vector<aptDispatchWithHelp> GetCommands()			/*{{{*/
       {"release",&SimpleGenRelease, nullptr},
       {"generate",&Generate, nullptr},
       {"clean",&Clean, nullptr},
+      {"pdiff-jumps",&SimpleGenPDiffJumps, nullptr},
       {nullptr, nullptr, nullptr}
    };
 }
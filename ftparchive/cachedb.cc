@@ -31,15 +31,22 @@
 									/*}}}*/
 
 CacheDB::CacheDB(std::string const &DB)
-   : Dbp(0), Fd(NULL), DebFile(0)
+   : Dbp(0), Main(nullptr), SharedLock(nullptr), Fd(NULL), DebFile(0)
 {
    TmpKey[0]='\0';
    ReadyDB(DB);
 }
+CacheDB::CacheDB(CacheDB &Other)
+   : Dbp(Other.Dbp), DBLoaded(Other.DBLoaded.load()), ReadOnly(Other.ReadOnly), DBFile(Other.DBFile),
+     Main(&Other), SharedLock(&Other.DBLock), Fd(NULL), DebFile(0)
+{
+   Other.SharedLock = &Other.DBLock;
+}
 
 CacheDB::~CacheDB()
 {
-   ReadyDB();
+   if (Main == nullptr)
+      ReadyDB();
    delete DebFile;
    CloseFile();
 }
@@ -49,13 +56,10 @@ CacheDB::~CacheDB()
 /* This opens the DB2 file for caching package information */
 bool CacheDB::ReadyDB(std::string const &DB)
 {
-   int err;
-
    ReadOnly = _config->FindB("APT::FTPArchive::ReadOnlyDB",false);
    
    // Close the old DB
-   if (Dbp != 0) 
-      Dbp->close(Dbp,0);
+   delete Dbp;
    
    /* Check if the DB was disabled while running and deal with a 
       corrupted DB */
@@ -72,32 +76,9 @@ bool CacheDB::ReadyDB(std::string const &DB)
    if (DB.empty())
       return true;
 
-   db_create(&Dbp, NULL, 0);
-   if ((err = Dbp->open(Dbp, NULL, DB.c_str(), NULL, DB_BTREE,
-                        (ReadOnly?DB_RDONLY:DB_CREATE),
-                        0644)) != 0)
-   {
-      if (err == DB_OLD_VERSION)
-      {
-          _error->Warning(_("DB is old, attempting to upgrade %s"),DBFile.c_str());
-	  err = Dbp->upgrade(Dbp, DB.c_str(), 0);
-	  if (!err)
-	     err = Dbp->open(Dbp, NULL, DB.c_str(), NULL, DB_HASH,
-                            (ReadOnly?DB_RDONLY:DB_CREATE), 0644);
-
-      }
-      // the database format has changed from DB_HASH to DB_BTREE in 
-      // apt 0.6.44
-      if (err == EINVAL)
-      {
-	 _error->Error(_("DB format is invalid. If you upgraded from an older version of apt, please remove and re-create the database."));
-      }
-      if (err)
-      {
-          Dbp = 0;
-          return _error->Error(_("Unable to open DB file %s: %s"),DB.c_str(), db_strerror(err));
-      }
-   }
+   Dbp = CacheDBStore::Open(DB, ReadOnly);
+   if (Dbp == nullptr)
+      return false;
 
    DBFile = DB;
    DBLoaded = true;
@@ -192,21 +173,13 @@ bool CacheDB::GetFileStat(bool const &doStat)
 /* Read the old (32bit FileSize) StateStore format from disk */
 bool CacheDB::GetCurStatCompatOldFormat()
 {
-   InitQueryStats();
-   Data.data = &CurStatOldFormat;
-   Data.flags = DB_DBT_USERMEM;
-   Data.ulen = sizeof(CurStatOldFormat);
-   if (Get() == false)
-   {
-      CurStat.Flags = 0;
-   } else {
-      CurStat.Flags = CurStatOldFormat.Flags;
-      CurStat.mtime = CurStatOldFormat.mtime;
-      CurStat.FileSize = CurStatOldFormat.FileSize;
-      memcpy(CurStat.MD5, CurStatOldFormat.MD5, sizeof(CurStat.MD5));
-      memcpy(CurStat.SHA1, CurStatOldFormat.SHA1, sizeof(CurStat.SHA1));
-      memcpy(CurStat.SHA256, CurStatOldFormat.SHA256, sizeof(CurStat.SHA256));
-   }
+   memcpy(&CurStatOldFormat, Data.data(), sizeof(CurStatOldFormat));
+   CurStat.Flags = CurStatOldFormat.Flags;
+   CurStat.mtime = CurStatOldFormat.mtime;
+   CurStat.FileSize = CurStatOldFormat.FileSize;
+   memcpy(CurStat.MD5, CurStatOldFormat.MD5, sizeof(CurStat.MD5));
+   memcpy(CurStat.SHA1, CurStatOldFormat.SHA1, sizeof(CurStat.SHA1));
+   memcpy(CurStat.SHA256, CurStatOldFormat.SHA256, sizeof(CurStat.SHA256));
    return true;
 }
 									/*}}}*/
@@ -215,14 +188,7 @@ bool CacheDB::GetCurStatCompatOldFormat()
 /* Read the new (64bit FileSize) StateStore format from disk */
 bool CacheDB::GetCurStatCompatNewFormat()
 {
-   InitQueryStats();
-   Data.data = &CurStat;
-   Data.flags = DB_DBT_USERMEM;
-   Data.ulen = sizeof(CurStat);
-   if (Get() == false)
-   {
-      CurStat.Flags = 0;
-   }
+   memcpy(&CurStat, Data.data(), sizeof(CurStat));
    return true;
 }
 									/*}}}*/
@@ -236,27 +202,23 @@ bool CacheDB::GetCurStat()
    
    if (DBLoaded)
    {
-      // do a first query to just get the size of the data on disk
       InitQueryStats();
-      Data.data = &CurStat;
-      Data.flags = DB_DBT_USERMEM;
-      Data.ulen = 0;
       Get();
 
-      if (Data.size == 0)
+      if (Data.size() == 0)
       {
          // nothing needs to be done, we just have not data for this deb
       }
       // check if the record is written in the old format (32bit filesize)
-      else if(Data.size == sizeof(CurStatOldFormat))
+      else if(Data.size() == sizeof(CurStatOldFormat))
       {
          GetCurStatCompatOldFormat();
       }
-      else if(Data.size == sizeof(CurStat))
+      else if(Data.size() == sizeof(CurStat))
       {
          GetCurStatCompatNewFormat();
       } else {
-         return _error->Error("Cache record size mismatch (%ul)", Data.size);
+         return _error->Error("Cache record size mismatch (%zu)", Data.size());
       }
 
       CurStat.Flags = ntohl(CurStat.Flags);
@@ -306,7 +268,7 @@ bool CacheDB::LoadSource()						/*{{{*/
    {
       // Lookup the control information
       InitQuerySource();
-      if (Get() == true && Dsc.TakeDsc(Data.data, Data.size) == true)
+      if (Get() == true && Dsc.TakeDsc(Data.data(), Data.size()) == true)
       {
 	    return true;
       }
@@ -340,7 +302,7 @@ bool CacheDB::LoadControl()
    {
       // Lookup the control information
       InitQueryControl();
-      if (Get() == true && Control.TakeControl(Data.data,Data.size) == true)
+      if (Get() == true && Control.TakeControl(Data.data(),Data.size()) == true)
 	    return true;
       CurStat.Flags &= ~FlControl;
    }
@@ -377,7 +339,7 @@ bool CacheDB::LoadContents(bool const &GenOnly)
       InitQueryContent();
       if (Get() == true)
       {
-	 if (Contents.TakeContents(Data.data,Data.size) == true)
+	 if (Contents.TakeContents(Data.data(),Data.size()) == true)
 	    return true;
       }
       
@@ -538,42 +500,19 @@ bool CacheDB::Clean()
    if (DBLoaded == false)
       return true;
 
-   /* I'm not sure what VERSION_MINOR should be here.. 2.4.14 certainly
-      needs the lower one and 2.7.7 needs the upper.. */
-   DBC *Cursor;
-   if ((errno = Dbp->cursor(Dbp, NULL, &Cursor, 0)) != 0)
-      return _error->Error(_("Unable to get a cursor"));
-   
-   DBT Key;
-   DBT Data;
-   memset(&Key,0,sizeof(Key));
-   memset(&Data,0,sizeof(Data));
-   while ((errno = Cursor->c_get(Cursor,&Key,&Data,DB_NEXT)) == 0)
-   {
-      const char *Colon = (char*)memrchr(Key.data, ':', Key.size);
-      if (Colon)
-      {
-         if (stringcmp(Colon + 1, (char *)Key.data+Key.size,"st") == 0 ||
-             stringcmp(Colon + 1, (char *)Key.data+Key.size,"cl") == 0 ||
-             stringcmp(Colon + 1, (char *)Key.data+Key.size,"cs") == 0 ||
-             stringcmp(Colon + 1, (char *)Key.data+Key.size,"cn") == 0)
-	 {
-            std::string FileName = std::string((const char *)Key.data,Colon);
-            if (FileExists(FileName) == true) {
-		continue;
-            }
-	 }
-      }
-      Cursor->c_del(Cursor,0);
-   }
-   int res = Dbp->compact(Dbp, NULL, NULL, NULL, NULL, DB_FREE_SPACE, NULL);
-   if (res < 0)
-      _error->Warning("compact failed with result %i", res);
+   bool const Res = Dbp->Clean([](std::string_view const Key) {
+      auto const Colon = Key.rfind(':');
+      if (Colon == std::string_view::npos)
+	 return false;
+      auto const Type = Key.substr(Colon + 1);
+      if (Type != "st" && Type != "cl" && Type != "cs" && Type != "cn")
+	 return false;
+      return FileExists(std::string(Key.substr(0, Colon)));
+   });
 
    if(_config->FindB("Debug::APT::FTPArchive::Clean", false) == true)
-      Dbp->stat_print(Dbp, 0);
-
+      Dbp->PrintStats();
 
-   return true;
+   return Res;
 }
 									/*}}}*/
@@ -14,13 +14,16 @@
 #include <apt-pkg/debfile.h>
 #include <apt-pkg/hashes.h>
 
-#include <db.h>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
 #include <string>
+#include <string_view>
 
+#include "cachedbstore.h"
 #include "contents.h"
 #include "sources.h"
 
@@ -32,22 +35,25 @@ class CacheDB
    protected:
       
    // Database state/access
-   DBT Key;
-   DBT Data;
+   std::string_view Data;
    std::string TmpKey;
-   DB *Dbp;
-   bool DBLoaded;
+   CacheDBStore *Dbp;
+   // cleared by any thread sharing the handle once a write failed
+   std::atomic<bool> DBLoaded;
    bool ReadOnly;
    std::string DBFile;
 
+   // Sharing the handle with other threads, see CacheDB(CacheDB &)
+   CacheDB *Main;
+   std::mutex DBLock;
+   std::mutex *SharedLock;
+   std::string DataCopy;
+
    // Generate a key for the DB of a given type
    void _InitQuery(const char *Type)
    {
-      memset(&Key,0,sizeof(Key));
-      memset(&Data,0,sizeof(Data));
+      Data = {};
       TmpKey.assign(FileName).append(":").append(Type);
-      Key.data = TmpKey.data();
-      Key.size = TmpKey.size();
    }
    
    void InitQueryStats() {
@@ -65,17 +71,28 @@ class CacheDB
 
    inline bool Get() 
    {
-      return Dbp->get(Dbp,0,&Key,&Data,0) == 0;
+      if (SharedLock == nullptr)
+	 return Dbp->Get(TmpKey, Data);
+      std::lock_guard<std::mutex> Guard(*SharedLock);
+      if (Dbp->Get(TmpKey, Data) == false)
+	 return false;
+      // the store owns the data and reuses it for the next get of any thread
+      DataCopy.assign(Data);
+      Data = DataCopy;
+      return true;
    };
    inline bool Put(const void *In,unsigned long const &Length) 
    {
       if (ReadOnly == true)
 	 return true;
-      Data.size = Length;
-      Data.data = (void *)In;
-      if (DBLoaded == true && (errno = Dbp->put(Dbp,0,&Key,&Data,0)) != 0)
+      std::unique_lock<std::mutex> Guard;
+      if (SharedLock != nullptr)
+	 Guard = std::unique_lock<std::mutex>(*SharedLock);
+      auto &Loaded = Main != nullptr ? Main->DBLoaded : DBLoaded;
+      if (Loaded == true && Dbp->Put(TmpKey, std::string_view(static_cast<char const *>(In), Length)) == false)
       {
 	 DBLoaded = false;
+	 Loaded = false;
 	 return false;
       }
       return true;
@@ -190,6 +207,11 @@ class CacheDB
    bool Clean();
    
    explicit CacheDB(std::string const &DB);
+   /** \brief a CacheDB using the database of \a Main from another thread
+    *
+    *  Both serialize their access to the database afterwards, but \a Main
+    *  must outlive this one and stays responsible for closing it. */
+   explicit CacheDB(CacheDB &Main);
    ~CacheDB();
 };
     
@@ -0,0 +1,388 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   CacheDBStore
+
+   The key-value stores the CacheDB can keep its records in: Berkeley DB
+   and, if available, LMDB.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string_view>
+
+#include <db.h>
+#ifdef HAVE_LMDB
+#include <lmdb.h>
+#endif
+
+#include "cachedbstore.h"
+
+#include <apti18n.h>
+									/*}}}*/
+
+// BerkeleyStore - Records in a Berkeley DB B-tree			/*{{{*/
+class BerkeleyStore : public CacheDBStore
+{
+   DB *Dbp;
+
+   explicit BerkeleyStore(DB *const Dbp) : Dbp(Dbp) {}
+
+   public:
+   static BerkeleyStore *Open(std::string const &File, bool const ReadOnly)
+   {
+      int err;
+      DB *Dbp;
+      db_create(&Dbp, NULL, 0);
+      if ((err = Dbp->open(Dbp, NULL, File.c_str(), NULL, DB_BTREE,
+			   (ReadOnly?DB_RDONLY:DB_CREATE),
+			   0644)) != 0)
+      {
+	 if (err == DB_OLD_VERSION)
+	 {
+	    _error->Warning(_("DB is old, attempting to upgrade %s"),File.c_str());
+	    err = Dbp->upgrade(Dbp, File.c_str(), 0);
+	    if (!err)
+	       err = Dbp->open(Dbp, NULL, File.c_str(), NULL, DB_HASH,
+			       (ReadOnly?DB_RDONLY:DB_CREATE), 0644);
+
+	 }
+	 // the database format has changed from DB_HASH to DB_BTREE in
+	 // apt 0.6.44
+	 if (err == EINVAL)
+	 {
+	    _error->Error(_("DB format is invalid. If you upgraded from an older version of apt, please remove and re-create the database."));
+	 }
+	 if (err)
+	 {
+	    _error->Error(_("Unable to open DB file %s: %s"),File.c_str(), db_strerror(err));
+	    return nullptr;
+	 }
+      }
+      return new BerkeleyStore(Dbp);
+   }
+
+   bool Get(std::string const &Key, std::string_view &Value) override
+   {
+      DBT K, D;
+      memset(&K, 0, sizeof(K));
+      memset(&D, 0, sizeof(D));
+      K.data = const_cast<char *>(Key.data());
+      K.size = Key.size();
+      if (Dbp->get(Dbp, 0, &K, &D, 0) != 0)
+	 return false;
+      Value = std::string_view(static_cast<char const *>(D.data), D.size);
+      return true;
+   }
+   bool Put(std::string const &Key, std::string_view const Value) override
+   {
+      DBT K, D;
+      memset(&K, 0, sizeof(K));
+      memset(&D, 0, sizeof(D));
+      K.data = const_cast<char *>(Key.data());
+      K.size = Key.size();
+      D.data = const_cast<char *>(Value.data());
+      D.size = Value.size();
+      return (errno = Dbp->put(Dbp, 0, &K, &D, 0)) == 0;
+   }
+   // calls \a Callback with all records until it returns false
+   bool ForEach(std::function<bool(std::string_view const Key, std::string_view const Value)> const &Callback)
+   {
+      DBC *Cursor;
+      if ((errno = Dbp->cursor(Dbp, NULL, &Cursor, 0)) != 0)
+	 return _error->Error(_("Unable to get a cursor"));
+
+      DBT Key;
+      DBT Data;
+      memset(&Key,0,sizeof(Key));
+      memset(&Data,0,sizeof(Data));
+      bool Res = true;
+      while (Res == true && (errno = Cursor->c_get(Cursor,&Key,&Data,DB_NEXT)) == 0)
+	 Res = Callback(std::string_view(static_cast<char const *>(Key.data), Key.size),
+			std::string_view(static_cast<char const *>(Data.data), Data.size));
+      Cursor->c_close(Cursor);
+      return Res;
+   }
+   bool Clean(std::function<bool(std::string_view const Key)> const &Keep) override
+   {
+      /* I'm not sure what VERSION_MINOR should be here.. 2.4.14 certainly
+	 needs the lower one and 2.7.7 needs the upper.. */
+      DBC *Cursor;
+      if ((errno = Dbp->cursor(Dbp, NULL, &Cursor, 0)) != 0)
+	 return _error->Error(_("Unable to get a cursor"));
+
+      DBT Key;
+      DBT Data;
+      memset(&Key,0,sizeof(Key));
+      memset(&Data,0,sizeof(Data));
+      while ((errno = Cursor->c_get(Cursor,&Key,&Data,DB_NEXT)) == 0)
+	 if (Keep(std::string_view(static_cast<char const *>(Key.data), Key.size)) == false)
+	    Cursor->c_del(Cursor,0);
+      Cursor->c_close(Cursor);
+
+      int res = Dbp->compact(Dbp, NULL, NULL, NULL, NULL, DB_FREE_SPACE, NULL);
+      if (res < 0)
+	 _error->Warning("compact failed with result %i", res);
+      return true;
+   }
+   bool Sync() override
+   {
+      return Dbp->sync(Dbp, 0) == 0;
+   }
+   void PrintStats() override
+   {
+      Dbp->stat_print(Dbp, 0);
+   }
+   ~BerkeleyStore() override
+   {
+      Dbp->close(Dbp, 0);
+   }
+};
+									/*}}}*/
+#ifdef HAVE_LMDB
+// LMDBStore - Records in a memory mapped LMDB				/*{{{*/
+// ---------------------------------------------------------------------
+/* Reads are served from a read transaction which is kept open between
+   the writes, while writes are collected and committed in batches of
+   APT::FTPArchive::LMDB::BatchSize records. LMDB allows only one writer
+   at a time, so this also keeps other processes waiting on the database
+   for as short as possible. The map is grown as needed. */
+class LMDBStore : public CacheDBStore
+{
+   MDB_env *Env;
+   MDB_dbi Dbi;
+   MDB_txn *ReadTxn = nullptr;
+   bool ReadTxnActive = false;
+   std::map<std::string, std::string, std::less<>> Pending;
+   size_t const BatchSize;
+
+   LMDBStore(MDB_env *const Env, MDB_dbi const Dbi) : Env(Env), Dbi(Dbi),
+      BatchSize(std::max(1, _config->FindI("APT::FTPArchive::LMDB::BatchSize", 1000))) {}
+
+   void ResetRead()
+   {
+      if (ReadTxnActive == false)
+	 return;
+      mdb_txn_reset(ReadTxn);
+      ReadTxnActive = false;
+   }
+   static bool Migrate(std::string const &File);
+
+   public:
+   static LMDBStore *Open(std::string const &File, bool const ReadOnly, bool const AllowMigrate)
+   {
+      MDB_env *Env = nullptr;
+      MDB_dbi Dbi = 0;
+      int err = mdb_env_create(&Env);
+      if (err == 0)
+	 err = mdb_env_set_mapsize(Env, sizeof(size_t) > 4 ? 1ul << 30 : 1ul << 28);
+      if (err == 0)
+	 err = mdb_env_open(Env, File.c_str(), MDB_NOSUBDIR | MDB_NOTLS | (ReadOnly ? MDB_RDONLY : 0), 0644);
+      if (err == MDB_INVALID && ReadOnly == false && AllowMigrate == true)
+      {
+	 // not a LMDB, so it is likely a Berkeley DB written by earlier runs
+	 mdb_env_close(Env);
+	 if (Migrate(File) == false)
+	    return nullptr;
+	 return Open(File, ReadOnly, false);
+      }
+      if (err == 0)
+      {
+	 MDB_txn *Txn;
+	 err = mdb_txn_begin(Env, nullptr, ReadOnly ? MDB_RDONLY : 0, &Txn);
+	 if (err == 0 && (err = mdb_dbi_open(Txn, nullptr, 0, &Dbi)) != 0)
+	    mdb_txn_abort(Txn);
+	 else if (err == 0)
+	    err = mdb_txn_commit(Txn);
+      }
+      if (err != 0)
+      {
+	 if (Env != nullptr)
+	    mdb_env_close(Env);
+	 _error->Error(_("Unable to open DB file %s: %s"),File.c_str(), mdb_strerror(err));
+	 return nullptr;
+      }
+      return new LMDBStore(Env, Dbi);
+   }
+
+   bool Get(std::string const &Key, std::string_view &Value) override
+   {
+      if (auto const P = Pending.find(Key); P != Pending.end())
+      {
+	 Value = P->second;
+	 return true;
+      }
+      if (ReadTxnActive == false)
+      {
+	 int const err = ReadTxn == nullptr ? mdb_txn_begin(Env, nullptr, MDB_RDONLY, &ReadTxn) : mdb_txn_renew(ReadTxn);
+	 if (err != 0)
+	    return false;
+	 ReadTxnActive = true;
+      }
+      MDB_val K{Key.size(), const_cast<char *>(Key.data())};
+      MDB_val V;
+      if (mdb_get(ReadTxn, Dbi, &K, &V) != 0)
+	 return false;
+      Value = std::string_view(static_cast<char const *>(V.mv_data), V.mv_size);
+      return true;
+   }
+   bool Put(std::string const &Key, std::string_view const Value) override
+   {
+      Pending.insert_or_assign(Key, std::string(Value));
+      if (Pending.size() < BatchSize)
+	 return true;
+      return Sync();
+   }
+   bool Clean(std::function<bool(std::string_view const Key)> const &Keep) override
+   {
+      if (Sync() == false)
+	 return _error->Error("mdb_txn_commit: %s", mdb_strerror(errno));
+      ResetRead();
+
+      MDB_txn *Txn;
+      MDB_cursor *Cursor;
+      int err = mdb_txn_begin(Env, nullptr, 0, &Txn);
+      if (err == 0 && (err = mdb_cursor_open(Txn, Dbi, &Cursor)) != 0)
+	 mdb_txn_abort(Txn);
+      if (err != 0)
+	 return _error->Error(_("Unable to get a cursor"));
+
+      MDB_val K, V;
+      while ((err = mdb_cursor_get(Cursor, &K, &V, MDB_NEXT)) == 0)
+	 if (Keep(std::string_view(static_cast<char const *>(K.mv_data), K.mv_size)) == false &&
+	     (err = mdb_cursor_del(Cursor, 0)) != 0)
+	    break;
+      mdb_cursor_close(Cursor);
+      if (err != MDB_NOTFOUND)
+      {
+	 mdb_txn_abort(Txn);
+	 return _error->Error("mdb_cursor_del: %s", mdb_strerror(err));
+      }
+      if ((err = mdb_txn_commit(Txn)) != 0)
+	 return _error->Error("mdb_txn_commit: %s", mdb_strerror(err));
+      return true;
+   }
+   bool Sync() override
+   {
+      if (Pending.empty())
+	 return true;
+      ResetRead();
+      while (true)
+      {
+	 MDB_txn *Txn;
+	 int err = mdb_txn_begin(Env, nullptr, 0, &Txn);
+	 if (err != 0)
+	    return errno = err, false;
+	 for (auto const &[Key, Value] : Pending)
+	 {
+	    MDB_val K{Key.size(), const_cast<char *>(Key.data())};
+	    MDB_val V{Value.size(), const_cast<char *>(Value.data())};
+	    if ((err = mdb_put(Txn, Dbi, &K, &V, 0)) != 0)
+	       break;
+	 }
+	 if (err == 0)
+	    err = mdb_txn_commit(Txn);
+	 else
+	    mdb_txn_abort(Txn);
+
+	 if (err == MDB_MAP_FULL)
+	 {
+	    MDB_envinfo Info;
+	    if (mdb_env_info(Env, &Info) == 0 &&
+		(err = mdb_env_set_mapsize(Env, Info.me_mapsize * 2)) == 0)
+	       continue;
+	 }
+	 if (err != 0)
+	    return errno = err, false;
+	 break;
+      }
+      Pending.clear();
+      return true;
+   }
+   void PrintStats() override
+   {
+      MDB_stat Stat;
+      MDB_envinfo Info;
+      if (mdb_env_stat(Env, &Stat) != 0 || mdb_env_info(Env, &Info) != 0)
+	 return;
+      std::cout << Stat.ms_entries << "\tNumber of unique keys in the tree\n"
+		<< Stat.ms_depth << "\tNumber of levels in the tree\n"
+		<< Stat.ms_branch_pages + Stat.ms_leaf_pages + Stat.ms_overflow_pages << "\tNumber of pages in use\n"
+		<< Info.me_mapsize << "\tSize of the memory map\n";
+   }
+   ~LMDBStore() override
+   {
+      if (Sync() == false)
+	 _error->Warning("mdb_txn_commit: %s", mdb_strerror(errno));
+      if (ReadTxn != nullptr)
+	 mdb_txn_abort(ReadTxn);
+      mdb_env_close(Env);
+   }
+};
+									/*}}}*/
+// LMDBStore::Migrate - Convert a Berkeley DB into a LMDB		/*{{{*/
+// ---------------------------------------------------------------------
+/* The records are copied into a new file which replaces the old one only
+   if all went well. */
+bool LMDBStore::Migrate(std::string const &File)
+{
+   std::unique_ptr<BerkeleyStore> Old(BerkeleyStore::Open(File, true));
+   if (Old == nullptr)
+      return false;
+
+   std::string const NewFile = File + ".new";
+   RemoveFile("LMDBStore::Migrate", NewFile);
+   RemoveFile("LMDBStore::Migrate", NewFile + "-lock");
+   std::unique_ptr<LMDBStore> New(Open(NewFile, false, false));
+   if (New == nullptr)
+      return false;
+
+   std::string Key;
+   bool Res = Old->ForEach([&](std::string_view const K, std::string_view const V) {
+      Key.assign(K);
+      return New->Put(Key, V);
+   });
+   Res &= New->Sync();
+   New.reset();
+   Old.reset();
+   RemoveFile("LMDBStore::Migrate", NewFile + "-lock");
+   if (Res == false)
+   {
+      RemoveFile("LMDBStore::Migrate", NewFile);
+      return _error->Error(_("Unable to migrate DB file %s to LMDB"), File.c_str());
+   }
+   if (rename(NewFile.c_str(), File.c_str()) != 0)
+      return _error->Errno("rename", _("Failed to rename %s to %s"), NewFile.c_str(), File.c_str());
+   _error->Notice(_("Migrated DB file %s to LMDB"), File.c_str());
+   return true;
+}
+									/*}}}*/
+#endif
+// CacheDBStore::Open - Open the store with the configured backend	/*{{{*/
+CacheDBStore *CacheDBStore::Open(std::string const &File, bool const ReadOnly)
+{
+   std::string const Backend = _config->Find("APT::FTPArchive::DBBackend", "bdb");
+   if (Backend == "bdb")
+      return BerkeleyStore::Open(File, ReadOnly);
+#ifdef HAVE_LMDB
+   if (Backend == "lmdb")
+      return LMDBStore::Open(File, ReadOnly, true);
+#endif
+   _error->Error(_("Unknown DB backend %s"), Backend.c_str());
+   return nullptr;
+}
+									/*}}}*/
@@ -0,0 +1,41 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   CacheDBStore
+
+   The key-value stores the CacheDB can keep its records in: Berkeley DB
+   and, if available, LMDB.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef CACHEDBSTORE_H
+#define CACHEDBSTORE_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+class CacheDBStore
+{
+   public:
+   /** \brief looks up the record stored for \a Key
+    *
+    *  \a Value points into memory owned by the store which stays valid
+    *  only until the next call to the store. */
+   virtual bool Get(std::string const &Key, std::string_view &Value) = 0;
+   /** \brief stores a record, sets errno on failure */
+   virtual bool Put(std::string const &Key, std::string_view const Value) = 0;
+   /** \brief removes all records \a Keep returns false for */
+   virtual bool Clean(std::function<bool(std::string_view const Key)> const &Keep) = 0;
+   /** \brief writes all changes to disk */
+   virtual bool Sync() = 0;
+   virtual void PrintStats() = 0;
+   virtual ~CacheDBStore() = default;
+
+   /** \brief opens the store in \a File with the backend chosen by
+    *  APT::FTPArchive::DBBackend, NULL on failure */
+   static CacheDBStore *Open(std::string const &File, bool const ReadOnly);
+};
+
+#endif
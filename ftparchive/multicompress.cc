@@ -6,9 +6,9 @@
 
    This class is very complicated in order to optimize for the common
    case of its use, writing a large set of compressed files that are 
-   different from the old set. It spawns off compressors in parallel
-   to maximize compression throughput and has a separate task managing
-   the data going into the compressors.
+   different from the old set. It runs the compressors in parallel
+   threads to maximize compression throughput and has a separate thread
+   managing the data going into the compressors.
    
    ##################################################################### */
 									/*}}}*/
@@ -23,6 +23,7 @@
 
 #include <array>
 #include <cctype>
+#include <cerrno>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -55,9 +56,10 @@ static std::vector<APT::Configuration::Compressor>::const_iterator findMatchingC
 
 // MultiCompress::MultiCompress - Constructor				/*{{{*/
 // ---------------------------------------------------------------------
-/* Setup the file outputs, compression modes and fork the writer child */
+/* Setup the file outputs, compression modes and start the writer threads */
 MultiCompress::MultiCompress(string const &Output, string const &Compress,
-			     mode_t const &Permissions, bool const &Write) : Outputter{-1}, Permissions(Permissions)
+			     mode_t const &Permissions, bool const &Write) : Permissions(Permissions),
+			     ChunksStart(0), InputDone(false), InputSize(0)
 {
    Outputs = 0;
    UpdateMTime = 0;
@@ -76,6 +78,8 @@ MultiCompress::MultiCompress(string const &Output, string const &Compress,
       Outputs = NewOut;
       NewOut->CompressProg = *Comp;
       NewOut->Output = Output + Comp->Extension;
+      NewOut->Consumed = 0;
+      NewOut->Finished = false;
 
       struct stat St;
       if (stat(NewOut->Output.c_str(),&St) == 0)
@@ -143,9 +147,10 @@ bool MultiCompress::GetStat(string const &Output,string const &Compress,struct s
    return DidStat;
 }
 									/*}}}*/
-// MultiCompress::Start - Start up the writer child			/*{{{*/
+// MultiCompress::Start - Start up the writer threads			/*{{{*/
 // ---------------------------------------------------------------------
-/* Fork a child and setup the communication pipe. */
+/* Setup the communication pipe and start a compressor thread for each
+   output as well as the thread feeding them. */
 bool MultiCompress::Start()
 {
    // Create a data pipe
@@ -154,42 +159,51 @@ bool MultiCompress::Start()
       return _error->Errno("pipe",_("Failed to create IPC pipe to subprocess"));
    for (int I = 0; I != 2; I++)
       SetCloseExec(Pipe[I],true);
-   
-   // The child..
-   Outputter = fork();
-   if (Outputter == 0)
-   {
-      close(Pipe[1]);
-      Child(Pipe[0]);
-      if (_error->PendingError() == true)
-      {
-	 _error->DumpErrors();
-	 _exit(100);
-      }      
-      _exit(0);
-   };
 
-   close(Pipe[0]);
    if (Input.OpenDescriptor(Pipe[1], FileFd::WriteOnly, true) == false)
+   {
+      close(Pipe[0]);
       return false;
+   }
 
-   if (Outputter == -1)
-      return _error->Errno("fork",_("Failed to fork"));
+   for (Files *I = Outputs; I != 0; I = I->Next)
+      I->Compressor = std::thread(&MultiCompress::Compress, this, std::ref(*I));
+   Outputter = std::thread(&MultiCompress::Child, this, Pipe[0]);
    return true;
 }
 									/*}}}*/
 // MultiCompress::Die - Clean up the writer				/*{{{*/
 // ---------------------------------------------------------------------
-/* */
+/* Wait for the threads and report their errors in this thread. If all
+   went well the new files replace the old ones. */
 bool MultiCompress::Die()
 {
    if (Input.IsOpen() == false)
       return true;
 
    Input.Close();
-   bool Res = ExecWait(Outputter,_("Compress child"),false);
-   Outputter = -1;
-   return Res;
+   Outputter.join();
+
+   bool Res = true;
+   auto const Report = [&Res](std::vector<std::pair<bool, std::string>> &Errors) {
+      for (auto const &E : Errors)
+      {
+	 if (E.first)
+	 {
+	    _error->Error("%s", E.second.c_str());
+	    Res = false;
+	 }
+	 else
+	    _error->Warning("%s", E.second.c_str());
+      }
+      Errors.clear();
+   };
+   Report(Errors);
+   for (Files *I = Outputs; I != 0; I = I->Next)
+      Report(I->Errors);
+   if (Res == false)
+      return false;
+   return Replace();
 }
 									/*}}}*/
 // MultiCompress::Finalize - Finish up writing				/*{{{*/
@@ -205,7 +219,7 @@ bool MultiCompress::Finalize(unsigned long long &OutSize)
    time(&Now);
    
    // Check the mtimes to see if the files were replaced.
-   bool Changed = false;
+   bool Replaced = false;
    for (Files *I = Outputs; I != 0; I = I->Next)
    {
       struct stat St;
@@ -214,7 +228,7 @@ bool MultiCompress::Finalize(unsigned long long &OutSize)
 			       I->Output.c_str());
       
       if (I->OldMTime != St.st_mtime)
-	 Changed = true;
+	 Replaced = true;
       else
       {
 	 // Update the mtime if necessary
@@ -222,7 +236,7 @@ bool MultiCompress::Finalize(unsigned long long &OutSize)
 	     (Now - St.st_mtime > (signed)UpdateMTime || St.st_mtime > Now))
 	 {
 	    utimes(I->Output.c_str(), NULL);
-	    Changed = true;
+	    Replaced = true;
 	 }
       }
       
@@ -233,7 +247,7 @@ bool MultiCompress::Finalize(unsigned long long &OutSize)
       OutSize += St.st_size;
    }
    
-   if (Changed == false)
+   if (Replaced == false)
       OutSize = 0;
    
    return true;
@@ -253,45 +267,119 @@ bool MultiCompress::OpenOld(FileFd &Fd)
    return Fd.Open(Best->Output, FileFd::ReadOnly, FileFd::Extension);
 }
 									/*}}}*/
-// MultiCompress::Child - The writer child				/*{{{*/
+// MultiCompress::Child - The feeding thread				/*{{{*/
 // ---------------------------------------------------------------------
-/* The child process forks a bunch of compression children and takes 
-   input on FD and passes it to all the compressor child. On the way it
-   computes the MD5 of the raw data. After this the raw data in the 
-   original files is compared to see if this data is new. If the data
-   is new then the temp files are renamed, otherwise they are erased. */
-bool MultiCompress::Child(int const &FD)
+/* The thread takes input on FD and queues it for all the compressor
+   threads. On the way it computes the MD5 of the raw data, which Replace
+   compares to the old files later on. */
+void MultiCompress::Child(int const FD)
 {
-   /* Okay, now we just feed data from FD to all the other FDs. Also
-      stash a hash of the data to use later. */
-   SetNonBlock(FD,false);
    std::array<unsigned char, APT_BUFFER_SIZE> Buffer;
    unsigned long long FileSize = 0;
    Hashes MD5(Hashes::MD5SUM);
    while (1)
    {
-      WaitFd(FD,false);
-      int Res = read(FD,Buffer.data(),Buffer.size());
+      ssize_t const Res = read(FD,Buffer.data(),Buffer.size());
       if (Res == 0)
 	 break;
       if (Res < 0)
-	 continue;
+      {
+	 if (errno == EINTR)
+	    continue;
+	 _error->Errno("read",_("IO to subprocess/file failed"));
+	 break;
+      }
 
       MD5.Add(Buffer.data(),Res);
       FileSize += Res;
-      for (Files *I = Outputs; I != 0; I = I->Next)
+
+      // don't run too far ahead of the slowest compressor
+      std::unique_lock<std::mutex> Guard(Lock);
+      Changed.wait(Guard, [&] { return Chunks.size() < 64; });
+      Chunks.emplace_back(Buffer.data(), Buffer.data() + Res);
+      Changed.notify_all();
+   }
+   close(FD);
+
+   {
+      std::lock_guard<std::mutex> Guard(Lock);
+      InputDone = true;
+      Changed.notify_all();
+   }
+   for (Files *I = Outputs; I != 0; I = I->Next)
+      I->Compressor.join();
+
+   InputMD5 = MD5.GetHashString(Hashes::MD5SUM).toStr();
+   InputSize = FileSize;
+   std::string Msg;
+   while (_error->empty() == false)
+   {
+      bool const Type = _error->PopMessage(Msg);
+      Errors.emplace_back(Type, Msg);
+   }
+}
+									/*}}}*/
+// MultiCompress::Compress - A compressor thread			/*{{{*/
+// ---------------------------------------------------------------------
+/* Writes all the queued data to one of the outputs. */
+void MultiCompress::Compress(Files &Out)
+{
+   std::unique_lock<std::mutex> Guard(Lock);
+   while (1)
+   {
+      Changed.wait(Guard, [&] { return Out.Consumed != ChunksStart + Chunks.size() || InputDone; });
+      if (Out.Consumed == ChunksStart + Chunks.size())
+	 break;
+
+      // the chunk stays as the others can only drop it after we are done
+      auto const &Chunk = Chunks[Out.Consumed - ChunksStart];
+      Guard.unlock();
+      bool const Res = Out.TmpFile.Write(Chunk.data(), Chunk.size());
+      Guard.lock();
+      ++Out.Consumed;
+      DropChunks();
+      if (Res == false)
       {
-	 if (I->TmpFile.Write(Buffer.data(), Res) == false)
-	 {
-	    _error->Errno("write",_("IO to subprocess/file failed"));
-	    break;
-	 }
-      }      
-   }   
+	 _error->Errno("write",_("IO to subprocess/file failed"));
+	 break;
+      }
+   }
+   Out.Finished = true;
+   DropChunks();
+   Guard.unlock();
 
-   if (_error->PendingError() == true)
-      return false;
-   
+   Out.TmpFile.Close();
+   std::string Msg;
+   while (_error->empty() == false)
+   {
+      bool const Type = _error->PopMessage(Msg);
+      Out.Errors.emplace_back(Type, Msg);
+   }
+}
+									/*}}}*/
+// MultiCompress::DropChunks - Forget data written to all outputs	/*{{{*/
+// ---------------------------------------------------------------------
+/* Must be called with the Lock held. */
+void MultiCompress::DropChunks()
+{
+   while (Chunks.empty() == false)
+   {
+      for (Files *I = Outputs; I != 0; I = I->Next)
+	 if (I->Finished == false && I->Consumed == ChunksStart)
+	    return;
+      Chunks.pop_front();
+      ++ChunksStart;
+      Changed.notify_all();
+   }
+}
+									/*}}}*/
+// MultiCompress::Replace - Install the new files			/*{{{*/
+// ---------------------------------------------------------------------
+/* The raw data in the original files is compared to see if the new data
+   is new. If the data is new then the temp files are renamed, otherwise
+   they are erased. */
+bool MultiCompress::Replace()
+{
    /* Now we have to copy the files over, or erase them if they
       have not changed. First find the cheapest decompressor */
    bool Missing = false;
@@ -315,6 +403,7 @@ bool MultiCompress::Child(int const &FD)
       }
 
       // Compute the hash
+      std::array<unsigned char, APT_BUFFER_SIZE> Buffer;
       Hashes OldMD5(Hashes::MD5SUM);
       unsigned long long NewFileSize = 0;
       while (1)
@@ -330,14 +419,11 @@ bool MultiCompress::Child(int const &FD)
       CompFd.Close();
 
       // Check the hash
-      if (OldMD5.GetHashString(Hashes::MD5SUM) == MD5.GetHashString(Hashes::MD5SUM) &&
-	  FileSize == NewFileSize)
+      if (OldMD5.GetHashString(Hashes::MD5SUM).toStr() == InputMD5 &&
+	  InputSize == NewFileSize)
       {
 	 for (Files *I = Outputs; I != 0; I = I->Next)
-	 {
-	    I->TmpFile.Close();
-	    RemoveFile("MultiCompress::Child", I->TmpFile.Name());
-	 }
+	    RemoveFile("MultiCompress::Replace", I->TmpFile.Name());
 	 return !_error->PendingError();
       }      
       break;
@@ -352,10 +438,8 @@ bool MultiCompress::Child(int const &FD)
       if (rename(I->TmpFile.Name().c_str(),I->Output.c_str()) != 0)
 	 _error->Errno("rename",_("Failed to rename %s to %s"),
 		       I->TmpFile.Name().c_str(),I->Output.c_str());
-      I->TmpFile.Close();
    }
    
    return !_error->PendingError();
 }
 									/*}}}*/
-
@@ -18,9 +18,15 @@
 #include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/fileutl.h>
 
+#include <condition_variable>
 #include <cstdio>
 #include <ctime>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <sys/types.h>
 
 class MultiCompress
@@ -32,15 +38,31 @@ class MultiCompress
       APT::Configuration::Compressor CompressProg;
       Files *Next;
       FileFd TmpFile;
-      pid_t CompressProc;
+      std::thread Compressor;
+      unsigned long long Consumed;
+      bool Finished;
+      std::vector<std::pair<bool, std::string>> Errors;
       time_t OldMTime;
    };
    
    Files *Outputs;
-   pid_t Outputter;
+   std::thread Outputter;
    mode_t Permissions;
 
-   bool Child(int const &Fd);
+   // The data read from Input which is not yet compressed by all outputs
+   std::mutex Lock;
+   std::condition_variable Changed;
+   std::deque<std::vector<unsigned char>> Chunks;
+   unsigned long long ChunksStart;
+   bool InputDone;
+   std::vector<std::pair<bool, std::string>> Errors;
+   std::string InputMD5;
+   unsigned long long InputSize;
+
+   void Child(int const Fd);
+   void Compress(Files &Out);
+   void DropChunks();
+   bool Replace();
    bool Start();
    bool Die();
    
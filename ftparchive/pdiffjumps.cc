@@ -0,0 +1,223 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   PDiff Jumps
+
+   A client which is several states behind has to download and apply
+   every patch from its state on. For each state in the history of the
+   Index file a jump patch is composed from all these patches with rred,
+   and if it is smaller than the patches it replaces, it is listed in the
+   X-Jump-*-History, -Patches and -Download fields of the Index. Like in
+   History, the hashes listed in X-Jump-*-History are those of the file
+   the jump patch applies to.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/strutl.h>
+#include <apt-pkg/tagfile.h>
+
+#include <algorithm>
+#include <iostream>
+#include <locale>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apt-ftparchive.h"
+#include "pdiffjumps.h"
+
+#include <apti18n.h>
+									/*}}}*/
+
+namespace {
+struct HistoryEntry
+{
+   std::string Name;
+   HashStringList Hashes;
+};
+}
+
+// ReadHistory - Collect the entries of all *-History fields		/*{{{*/
+static std::vector<HistoryEntry> ReadHistory(pkgTagSection const &Section, std::string const &Prefix,
+					     std::vector<std::string> const &Types)
+{
+   std::vector<HistoryEntry> History;
+   for (auto const &Type : Types)
+   {
+      std::istringstream ss(std::string{Section.Find(Prefix + Type + "-History")});
+      ss.imbue(std::locale::classic());
+      std::string hash, name;
+      unsigned long long size;
+      while (ss >> hash >> size >> name)
+      {
+	 auto const E = std::find_if(History.begin(), History.end(), [&](auto const &E) { return E.Name == name; });
+	 if (E != History.end())
+	    E->Hashes.push_back(HashString(Type, hash));
+	 else
+	 {
+	    HistoryEntry N{name, {}};
+	    N.Hashes.push_back(HashString(Type, hash));
+	    N.Hashes.FileSize(size);
+	    History.push_back(std::move(N));
+	 }
+      }
+   }
+   return History;
+}
+									/*}}}*/
+// MergePatches - Let rred compose the given patches into one		/*{{{*/
+static bool MergePatches(std::vector<std::string> const &Patches, std::string const &Output)
+{
+   std::string const Rred = _config->FindDir("Dir::Bin::Methods") + "rred";
+   int const Fd = open(Output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (Fd == -1)
+      return _error->Errno("open", _("Unable to open %s for writing"), Output.c_str());
+
+   std::vector<char const *> Args;
+   Args.push_back(Rred.c_str());
+   for (auto const &P : Patches)
+      Args.push_back(P.c_str());
+   Args.push_back(nullptr);
+
+   pid_t const Process = ExecFork({Fd});
+   if (Process == 0)
+   {
+      dup2(Fd, STDOUT_FILENO);
+      execv(Args[0], const_cast<char **>(Args.data()));
+      _exit(100);
+   }
+   close(Fd);
+   return ExecWait(Process, Rred.c_str());
+}
+									/*}}}*/
+// GenPDiffJumps - Replace the jump patches of an Index			/*{{{*/
+bool GenPDiffJumps(std::string const &DiffDir)
+{
+   std::string const Index = flCombine(DiffDir, "Index");
+   // the section points into the tagfile, so both have to live until it is written
+   FileFd Fd(Index, FileFd::ReadOnly);
+   pkgTagFile TF(&Fd);
+   pkgTagSection Section;
+   if (Fd.IsOpen() == false || Fd.Failed() || TF.Step(Section) == false)
+      return _error->Error(_("Unable to read the pdiff index %s"), Index.c_str());
+   if (Section.Find("X-Patch-Precedence") == "merged")
+      return _error->Error(_("The patches in %s are already merged"), Index.c_str());
+
+   std::vector<std::string> Types;
+   for (char const *const *type = HashString::SupportedHashes(); *type != nullptr; ++type)
+      if (Section.Exists(std::string(*type) + "-History"))
+	 Types.push_back(*type);
+   if (Types.empty())
+      return _error->Error(_("No patch history found in %s"), Index.c_str());
+
+   std::vector<HistoryEntry> const History = ReadHistory(Section, "", Types);
+   std::vector<HistoryEntry> const OldJumps = ReadHistory(Section, "X-Jump-", Types);
+
+   struct Jump
+   {
+      std::string Name;
+      HashStringList From, Patch, Download;
+   };
+   std::vector<Jump> Jumps;
+   if (History.size() > 1)
+   {
+      /* Going back in history, each jump patch is composed of the patch of
+	 its state and the jump patch of the next state. */
+      std::string const Current = History.back().Name;
+      std::string const CurrentPatch = flCombine(DiffDir, Current + ".gz");
+      std::string Next = CurrentPatch;
+      struct stat Buf;
+      if (stat(Next.c_str(), &Buf) != 0)
+	 return _error->Errno("stat", _("Failed to stat %s"), Next.c_str());
+      unsigned long long ChainSize = Buf.st_size;
+      for (auto H = History.rbegin() + 1; H != History.rend(); ++H)
+      {
+	 std::string const Patch = flCombine(DiffDir, H->Name + ".gz");
+	 if (stat(Patch.c_str(), &Buf) != 0)
+	    return _error->Errno("stat", _("Failed to stat %s"), Patch.c_str());
+	 ChainSize += Buf.st_size;
+
+	 Jump J{"T-" + Current + "-F-" + H->Name, H->Hashes, {}, {}};
+	 std::string const JumpFile = flCombine(DiffDir, J.Name);
+	 if (MergePatches({Patch, Next}, JumpFile) == false)
+	    return false;
+	 if (Next != CurrentPatch)
+	    RemoveFile("GenPDiffJumps", Next);
+	 Next = JumpFile;
+
+	 {
+	    FileFd In(JumpFile, FileFd::ReadOnly);
+	    FileFd Out(JumpFile + ".gz", FileFd::WriteOnly | FileFd::Create | FileFd::Empty | FileFd::BufferedWrite, FileFd::Gzip);
+	    if (In.IsOpen() == false || Out.IsOpen() == false || CopyFile(In, Out) == false || Out.Close() == false)
+	       return false;
+	    Hashes PatchHashes, DownloadHashes;
+	    FileFd Compressed(JumpFile + ".gz", FileFd::ReadOnly);
+	    if (In.Seek(0) == false || PatchHashes.AddFD(In) == false || DownloadHashes.AddFD(Compressed) == false)
+	       return false;
+	    J.Patch = PatchHashes.GetHashStringList();
+	    J.Download = DownloadHashes.GetHashStringList();
+	 }
+
+	 // a jump which isn't smaller than the patches it replaces is of no use
+	 if (J.Download.FileSize() >= ChainSize)
+	 {
+	    if (_config->FindB("Debug::APT::FTPArchive::PDiffJumps", false))
+	       std::clog << "Skipping " << J.Name << " with " << J.Download.FileSize()
+			 << " bytes for patches with " << ChainSize << " bytes" << std::endl;
+	    RemoveFile("GenPDiffJumps", JumpFile + ".gz");
+	    continue;
+	 }
+	 Jumps.push_back(std::move(J));
+      }
+      if (Next != CurrentPatch)
+	 RemoveFile("GenPDiffJumps", Next);
+   }
+
+   // like History the fields are sorted from the oldest state on
+   std::vector<pkgTagSection::Tag> Rewrite;
+   for (char const *const *type = HashString::SupportedHashes(); *type != nullptr; ++type)
+   {
+      bool const Known = std::find(Types.begin(), Types.end(), *type) != Types.end();
+      auto const Set = [&](std::string const &Field, HashStringList Jump::*const List, std::string const &Suffix) {
+	 std::string const Tag = std::string("X-Jump-") + *type + Field;
+	 std::string Value;
+	 for (auto J = Jumps.crbegin(); Known && J != Jumps.crend(); ++J)
+	 {
+	    auto const hs = ((*J).*List).find(*type);
+	    if (hs != nullptr)
+	       strprintf(Value, "%s\n %s %llu %s%s", Value.c_str(), hs->HashValue().c_str(),
+			 ((*J).*List).FileSize(), J->Name.c_str(), Suffix.c_str());
+	 }
+	 if (Value.empty())
+	    Rewrite.push_back(pkgTagSection::Tag::Remove(Tag));
+	 else
+	    Rewrite.push_back(pkgTagSection::Tag::Rewrite(Tag, Value));
+      };
+      Set("-History", &Jump::From, "");
+      Set("-Patches", &Jump::Patch, "");
+      Set("-Download", &Jump::Download, ".gz");
+   }
+   FileFd Out(Index, FileFd::WriteAtomic);
+   if (Out.IsOpen() == false || Section.Write(Out, nullptr, Rewrite) == false || Out.Close() == false)
+      return false;
+
+   for (auto const &Old : OldJumps)
+      if (std::none_of(Jumps.begin(), Jumps.end(), [&](auto const &J) { return J.Name == Old.Name; }))
+	 RemoveFile("GenPDiffJumps", flCombine(DiffDir, Old.Name + ".gz"));
+
+   c1out << Jumps.size() << " jump patches for " << History.size() << " patches in " << DiffDir << std::endl;
+   return true;
+}
+									/*}}}*/
@@ -0,0 +1,21 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   PDiff Jumps
+
+   Composes the patches of a pdiff Index into patches leading from older
+   states directly to the current one
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef PDIFFJUMPS_H
+#define PDIFFJUMPS_H
+
+#include <string>
+
+// Replaces the jump patches listed in the Index file of DiffDir by new
+// ones from each state in its history to the current state
+bool GenPDiffJumps(std::string const &DiffDir);
+
+#endif
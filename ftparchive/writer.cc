@@ -27,12 +27,15 @@
 #include <algorithm>
 #include <cctype>
 #include <clocale>
+#include <condition_variable>
 #include <cstring>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <utility>
 #include <fnmatch.h>
 #include <ftw.h>
@@ -137,23 +140,29 @@ int FTWScanner::ScannerFile(const char *const File, bool const ReadLink) /*{{{*/
    return 0;
 }
 									/*}}}*/
-int FTWScanner::ProcessFile(const char *const File, bool const ReadLink) /*{{{*/
+static std::string ResolveLink(const char *const File, bool const ReadLink) /*{{{*/
 {
-   /* Process it. If the file is a link then resolve it into an absolute
-      name.. This works best if the directory components the scanner are
-      given are not links themselves. */
+   /* If the file is a link then resolve it into an absolute name.. This
+      works best if the directory components the scanner are given are not
+      links themselves. */
    char Jnk[2];
    char *RealPath = NULL;
-   Owner->OriginalPath = File;
    if (ReadLink &&
        readlink(File,Jnk,sizeof(Jnk)) != -1 &&
        (RealPath = realpath(File,NULL)) != 0)
    {
-      Owner->DoPackage(RealPath);
+      std::string const Resolved = RealPath;
       free(RealPath);
+      return Resolved;
    }
-   else
-      Owner->DoPackage(File);
+   return File;
+}
+									/*}}}*/
+int FTWScanner::ProcessFile(const char *const File, bool const ReadLink) /*{{{*/
+{
+   // Process it.
+   Owner->OriginalPath = File;
+   Owner->DoPackage(ResolveLink(File, ReadLink));
 
    if (_error->empty() == false)
    {
@@ -214,10 +223,17 @@ bool FTWScanner::RecursiveScan(string const &Dir)
    std::sort(FilesToProcess.begin(), FilesToProcess.end(), [](PairType a, PairType b) {
       return a.first < b.first;
    });
-   if (not std::all_of(FilesToProcess.cbegin(), FilesToProcess.cend(), [](auto &&it) { return ProcessFile(it.first.c_str(), it.second) == 0; }))
-      return false;
+   return ProcessFiles();
+}
+									/*}}}*/
+// FTWScanner::ProcessFiles - Process the collected files in order	/*{{{*/
+bool FTWScanner::ProcessFiles()
+{
+   PrefetchFiles(FilesToProcess);
+   bool const Res = std::all_of(FilesToProcess.cbegin(), FilesToProcess.cend(), [](auto &&it) { return ProcessFile(it.first.c_str(), it.second) == 0; });
+   PrefetchFiles({});
    FilesToProcess.clear();
-   return true;
+   return Res;
 }
 									/*}}}*/
 // FTWScanner::LoadFileList - Load the file list from a file		/*{{{*/
@@ -265,13 +281,12 @@ bool FTWScanner::LoadFileList(string const &Dir, string const &File)
       if (FileMatchesPatterns(FileName, Patterns) == false)
 	 continue;
 
-      if (ProcessFile(FileName, false) != 0)
-	 break;
+      FilesToProcess.emplace_back(FileName, false);
    }
 
    free(Line);
    fclose(List);
-   return true;
+   return ProcessFiles();
 }
 									/*}}}*/
 // FTWScanner::Delink - Delink symlinks					/*{{{*/
@@ -375,6 +390,7 @@ PackagesWriter::PackagesWriter(FileFd * const GivenOutput, TranslationWriter * c
    DoContents = _config->FindB("APT::FTPArchive::Contents",true);
    NoOverride = _config->FindB("APT::FTPArchive::NoOverrideMsg",false);
    LongDescription = _config->FindB("APT::FTPArchive::LongDescription",true);
+   Workers = std::max(0, _config->FindI("APT::FTPArchive::Workers", 0));
 
    if (Db.Loaded() == false)
       DoContents = false;
@@ -391,6 +407,143 @@ PackagesWriter::PackagesWriter(FileFd * const GivenOutput, TranslationWriter * c
    _error->DumpErrors();
 }
                                                                         /*}}}*/
+// PackagesWriter::Prefetcher - Read the packages on worker threads	/*{{{*/
+// ---------------------------------------------------------------------
+/* Extracting the control data and hashing the packages is done by a pool
+   of threads ahead of DoPackage, each file with a CacheDB of its own which
+   shares the database of the writer. DoPackage takes the results in the
+   usual order and does the rest, so the output doesn't change. The number
+   of CacheDBs limits how far the workers can run ahead. */
+class PackagesWriter::Prefetcher
+{
+   struct Item
+   {
+      std::string File;
+      bool ReadLink;
+      std::unique_ptr<CacheDB> Db;
+      bool Result = false;
+      std::vector<std::pair<bool, std::string>> Messages;
+      bool Done = false;
+      Item(std::string const &File, bool const ReadLink) : File(File), ReadLink(ReadLink) {}
+   };
+   PackagesWriter &Owner;
+   std::vector<Item> Items;
+   std::vector<std::unique_ptr<CacheDB>> Free;
+   size_t NextItem = 0;
+   size_t Consumed = 0;
+   bool Cancel = false;
+   std::mutex Lock;
+   std::condition_variable Changed;
+   std::vector<std::thread> Workers;
+
+   void Run();
+
+   public:
+   std::unique_ptr<CacheDB> Take(std::string const &FileName, bool &Result);
+   void Release(std::unique_ptr<CacheDB> FileDb);
+
+   Prefetcher(PackagesWriter &Owner, vector<std::pair<string, bool>> const &Files, unsigned int const WorkerCount);
+   ~Prefetcher();
+};
+PackagesWriter::Prefetcher::Prefetcher(PackagesWriter &Owner, vector<std::pair<string, bool>> const &Files, unsigned int const WorkerCount)
+   : Owner(Owner)
+{
+   Items.reserve(Files.size());
+   for (auto const &F : Files)
+      Items.emplace_back(F.first, F.second);
+   for (unsigned int i = 0; i < 2 * WorkerCount; ++i)
+      Free.push_back(std::make_unique<CacheDB>(Owner.Db));
+   for (unsigned int i = 0; i < WorkerCount && i < Items.size(); ++i)
+      Workers.emplace_back(&Prefetcher::Run, this);
+}
+PackagesWriter::Prefetcher::~Prefetcher()
+{
+   {
+      std::lock_guard<std::mutex> guard(Lock);
+      Cancel = true;
+   }
+   Changed.notify_all();
+   for (auto &W : Workers)
+      W.join();
+}
+void PackagesWriter::Prefetcher::Run()
+{
+   std::unique_lock<std::mutex> guard(Lock);
+   while (true)
+   {
+      Changed.wait(guard, [&] { return Cancel || NextItem >= Items.size() || Free.empty() == false; });
+      if (Cancel || NextItem >= Items.size())
+	 return;
+      Item &I = Items[NextItem++];
+      std::unique_ptr<CacheDB> FileDb = std::move(Free.back());
+      Free.pop_back();
+      guard.unlock();
+
+      bool const Result = FileDb->GetFileInfo(ResolveLink(I.File.c_str(), I.ReadLink),
+	    true, /* DoControl */
+	    Owner.DoContents,
+	    true, /* GenContentsOnly */
+	    false, /* DoSource */
+	    Owner.DoHashes, Owner.DoAlwaysStat);
+      // the errors are reported by the main thread along with the others for this file
+      std::vector<std::pair<bool, std::string>> Messages;
+      while (_error->empty() == false)
+      {
+	 std::string Msg;
+	 bool const Type = _error->PopMessage(Msg);
+	 Messages.emplace_back(Type, std::move(Msg));
+      }
+
+      guard.lock();
+      I.Db = std::move(FileDb);
+      I.Result = Result;
+      I.Messages = std::move(Messages);
+      I.Done = true;
+      Changed.notify_all();
+   }
+}
+std::unique_ptr<CacheDB> PackagesWriter::Prefetcher::Take(std::string const &FileName, bool &Result)
+{
+   std::unique_lock<std::mutex> guard(Lock);
+   if (Consumed >= Items.size())
+      return nullptr;
+   Item &I = Items[Consumed++];
+   Changed.wait(guard, [&] { return I.Done; });
+   std::unique_ptr<CacheDB> FileDb = std::move(I.Db);
+   if (ResolveLink(I.File.c_str(), I.ReadLink) != FileName)
+   {
+      Free.push_back(std::move(FileDb));
+      Changed.notify_all();
+      return nullptr;
+   }
+   for (auto const &M : I.Messages)
+   {
+      if (M.first)
+	 _error->Error("%s", M.second.c_str());
+      else
+	 _error->Warning("%s", M.second.c_str());
+   }
+   I.Messages.clear();
+   Result = I.Result;
+   Owner.Db.Stats.Add(FileDb->Stats);
+   FileDb->Stats = {};
+   return FileDb;
+}
+void PackagesWriter::Prefetcher::Release(std::unique_ptr<CacheDB> FileDb)
+{
+   std::lock_guard<std::mutex> guard(Lock);
+   Free.push_back(std::move(FileDb));
+   Changed.notify_all();
+}
+									/*}}}*/
+// PackagesWriter::PrefetchFiles - Start the workers if requested	/*{{{*/
+void PackagesWriter::PrefetchFiles(vector<std::pair<string, bool>> const &Files)
+{
+   Prefetch.reset();
+   if (Workers != 0 && Files.empty() == false)
+      Prefetch.reset(new Prefetcher(*this, Files, Workers));
+}
+									/*}}}*/
 // PackagesWriter::DoPackage - Process a single package			/*{{{*/
 // ---------------------------------------------------------------------
 /* This method takes a package and gets its control information and
@@ -398,6 +551,19 @@ PackagesWriter::PackagesWriter(FileFd * const GivenOutput, TranslationWriter * c
    rewritten and the path/size/hash appended. */
 bool PackagesWriter::DoPackage(string FileName)
 {
+   if (Prefetch != nullptr)
+   {
+      bool Result = false;
+      std::unique_ptr<CacheDB> FileDb = Prefetch->Take(FileName, Result);
+      if (FileDb != nullptr)
+      {
+	 if (Result == true)
+	    Result = WritePackage(*FileDb, std::move(FileName));
+	 Prefetch->Release(std::move(FileDb));
+	 return Result;
+      }
+   }
+
    // Pull all the data we need form the DB
    if (Db.GetFileInfo(FileName,
 	    true, /* DoControl */
@@ -408,13 +574,16 @@ bool PackagesWriter::DoPackage(string FileName)
    {
      return false;
    }
-
-   unsigned long long FileSize = Db.GetFileSize();
+   return WritePackage(Db, std::move(FileName));
+}
+bool PackagesWriter::WritePackage(CacheDB &FileDb, string FileName)
+{
+   unsigned long long FileSize = FileDb.GetFileSize();
    if (Delink(FileName,OriginalPath,Stats.DeLinkBytes,FileSize) == false)
       return false;
 
    // Lookup the override information
-   pkgTagSection &Tags = Db.Control.Section;
+   pkgTagSection &Tags = FileDb.Control.Section;
    auto const Package = Tags.Find(pkgTagSection::Key::Package);
    string_view Architecture;
    // if we generate a Packages file for a given arch, we use it to
@@ -469,7 +638,7 @@ bool PackagesWriter::DoPackage(string FileName)
    std::vector<pkgTagSection::Tag> Changes;
    Changes.push_back(pkgTagSection::Tag::Rewrite("Size", std::to_string(FileSize)));
 
-   for (HashStringList::const_iterator hs = Db.HashesList.begin(); hs != Db.HashesList.end(); ++hs)
+   for (HashStringList::const_iterator hs = FileDb.HashesList.begin(); hs != FileDb.HashesList.end(); ++hs)
    {
       if (hs->HashType() == "MD5Sum")
 	 Changes.push_back(pkgTagSection::Tag::Rewrite("MD5sum", hs->HashValue()));
@@ -518,11 +687,12 @@ bool PackagesWriter::DoPackage(string FileName)
 	 Output->Write("\n", 1) == false)
       return false;
 
-   return Db.Finish();
+   return FileDb.Finish();
 }
 									/*}}}*/
 PackagesWriter::~PackagesWriter()					/*{{{*/
 {
+   Prefetch.reset();
 }
 									/*}}}*/
 
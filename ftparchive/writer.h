@@ -18,6 +18,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
@@ -52,6 +53,7 @@ class FTWScanner
    static int ScannerFTW(const char *File,const struct stat *sb,int Flag);
    static int ScannerFile(const char *const File, bool const ReadLink);
    static int ProcessFile(const char *const File, bool const ReadLink);
+   bool ProcessFiles();
 
    bool Delink(string &FileName,const char *OriginalPath,
 	       unsigned long long &Bytes,unsigned long long const &FileSize);
@@ -74,6 +76,10 @@ class FTWScanner
    string InternalPrefix;
 
    virtual bool DoPackage(string FileName) = 0;
+   /* Called with the files in the order DoPackage will be called for them
+      (and an empty list once done), so the expensive parts of it can be
+      done ahead on other threads. */
+   virtual void PrefetchFiles(vector<std::pair<string, bool>> const &/*Files*/) {};
    bool RecursiveScan(string const &Dir);
    bool LoadFileList(string const &BaseDir,string const &File);
    void ClearPatterns() { Patterns.clear(); };
@@ -106,6 +112,11 @@ class PackagesWriter : public FTWScanner
    Override Over;
    CacheDB Db;
 
+   class Prefetcher;
+   std::unique_ptr<Prefetcher> Prefetch;
+
+   bool WritePackage(CacheDB &FileDb, string FileName);
+
    public:
 
    // Some flags
@@ -113,6 +124,7 @@ class PackagesWriter : public FTWScanner
    bool NoOverride;
    bool DoContents;
    bool LongDescription;
+   unsigned int Workers;
 
    // General options
    string PathPrefix;
@@ -124,6 +136,7 @@ class PackagesWriter : public FTWScanner
    inline bool ReadExtraOverride(string const &File)
       {return Over.ReadExtraOverride(File);};
    bool DoPackage(string FileName) override;
+   void PrefetchFiles(vector<std::pair<string, bool>> const &Files) override;
 
    PackagesWriter(FileFd * const Output, TranslationWriter * const TransWriter, string const &DB,
                   string const &Overrides,
@@ -16,10 +16,16 @@
 #include <string>
 #include <vector>
 
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -27,6 +33,7 @@
 
 #ifdef HAVE_SECCOMP
 #include <csignal>
+#include <sched.h>
 
 #include <seccomp.h>
 #endif
@@ -109,6 +116,15 @@ public:
 
 class aptMethod : public pkgAcqMethod, public aptConfigWrapperForMethods
 {
+   char const *const Version;
+   unsigned long const Flags;
+   bool SeccompLoaded = false;
+
+   // Serving successive acquire runs as a daemon, see StartDaemon()
+   int DaemonFd = -1;
+   uid_t DaemonUid = 0;
+   std::string DaemonSocket;
+
 protected:
    std::string const Binary;
    unsigned long SeccompFlags;
@@ -119,6 +135,105 @@ protected:
       DIRECTORY = (1 << 3),
    };
 
+   /** \brief Become a daemon if pkgAcquire::Worker started us as one
+    *
+    *  The worker passes the socket to listen on in APT_METHOD_DAEMON and
+    *  waits for us to exit, so we detach once the socket is set up. The
+    *  clients connecting to it take turns as our stdin and stdout, which
+    *  keeps whatever the method caches (like open connections) around for
+    *  the next acquire run.
+    */
+   bool StartDaemon()
+   {
+      char const *const Socket = getenv("APT_METHOD_DAEMON");
+      if (Socket == nullptr)
+	 return true;
+      DaemonSocket = Socket;
+      unsetenv("APT_METHOD_DAEMON");
+
+      struct sockaddr_un Addr;
+      memset(&Addr, 0, sizeof(Addr));
+      Addr.sun_family = AF_UNIX;
+      if (DaemonSocket.length() >= sizeof(Addr.sun_path))
+	 return _error->Error("Socket path %s is too long", DaemonSocket.c_str());
+      strcpy(Addr.sun_path, DaemonSocket.c_str());
+
+      DaemonFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (DaemonFd == -1)
+	 return _error->Errno("socket", "Failed to create socket %s", DaemonSocket.c_str());
+      // a previous daemon might have left it behind
+      unlink(DaemonSocket.c_str());
+      if (bind(DaemonFd, reinterpret_cast<struct sockaddr *>(&Addr), sizeof(Addr)) != 0 ||
+	  listen(DaemonFd, 1) != 0)
+	 return _error->Errno("bind", "Failed to listen on socket %s", DaemonSocket.c_str());
+      DaemonUid = getuid();
+
+      pid_t const Pid = fork();
+      if (Pid < 0)
+	 return _error->Errno("fork", "Failed to fork");
+      if (Pid != 0)
+	 _exit(0);
+      setsid();
+
+      if (NextClient() == false)
+	 exit(0);
+      return true;
+   }
+
+   /** \brief Wait for the next client if we are a daemon
+    *
+    *  Returns false if we are not a daemon or nobody came in time, in
+    *  which case the method should exit.
+    */
+   bool NextClient()
+   {
+      if (DaemonFd == -1)
+	 return false;
+
+      int const Timeout = ConfigFindI("Daemon::Idle-Timeout", 300);
+      while (true)
+      {
+	 struct pollfd Listen = {DaemonFd, POLLIN, 0};
+	 int const Res = poll(&Listen, 1, Timeout * 1000);
+	 if (Res < 0 && errno == EINTR)
+	    continue;
+	 if (Res <= 0)
+	    break;
+
+	 int const Client = accept4(DaemonFd, nullptr, nullptr, SOCK_CLOEXEC);
+	 if (Client == -1)
+	    continue;
+	 // only serve the user who started us, or root
+	 struct ucred Cred;
+	 socklen_t CredLen = sizeof(Cred);
+	 if (getsockopt(Client, SOL_SOCKET, SO_PEERCRED, &Cred, &CredLen) != 0 ||
+	     (Cred.uid != 0 && Cred.uid != DaemonUid))
+	 {
+	    close(Client);
+	    continue;
+	 }
+
+	 dup2(Client, STDIN_FILENO);
+	 dup2(Client, STDOUT_FILENO);
+	 close(Client);
+	 SetNonBlock(STDIN_FILENO, true);
+	 std::cout.clear();
+
+	 // the new client sends its own configuration
+	 Messages.clear();
+	 FailReason.clear();
+	 _config->Clear();
+	 methodNames.erase(std::remove_if(methodNames.begin(), methodNames.end(), hasDoubleColon), methodNames.end());
+	 SendCapabilities(Version, Flags);
+	 return true;
+      }
+
+      close(DaemonFd);
+      DaemonFd = -1;
+      unlink(DaemonSocket.c_str());
+      return false;
+   }
+
    public:
    bool Configuration(std::string Message) override
    {
@@ -169,7 +284,7 @@ protected:
       int rc;
       scmp_filter_ctx ctx = NULL;
 
-      if (SeccompFlags == 0)
+      if (SeccompFlags == 0 || SeccompLoaded)
 	 return true;
 
       if (_config->FindB("APT::Sandbox::Seccomp", false) == false)
@@ -340,8 +455,26 @@ protected:
       ALLOW(write);
       ALLOW(writev);
 
+      // big files are hashed in threads, but a method must not fork
+#ifdef __s390__
+      if ((rc = seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clone), 1, SCMP_A1(SCMP_CMP_MASKED_EQ, CLONE_THREAD, CLONE_THREAD))))
+#else
+      if ((rc = seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clone), 1, SCMP_A0(SCMP_CMP_MASKED_EQ, CLONE_THREAD, CLONE_THREAD))))
+#endif
+	 return _error->FatalE("HttpMethod::Configuration", "Cannot allow %s: %s", "clone", strerror(-rc));
+#ifdef __NR_clone3
+      // the flags of clone3 can't be checked, so let glibc fall back to clone
+      if ((rc = seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOSYS), SCMP_SYS(clone3), 0)))
+	 return _error->FatalE("HttpMethod::Configuration", "Cannot deny %s: %s", "clone3", strerror(-rc));
+#endif
+#ifdef __NR_rseq
+      ALLOW(rseq);
+#endif
+
       if ((SeccompFlags & Seccomp::NETWORK) != 0)
       {
+	 ALLOW(accept);
+	 ALLOW(accept4);
 	 ALLOW(bind);
 	 ALLOW(connect);
 	 ALLOW(getsockname);
@@ -388,6 +521,7 @@ protected:
 #undef ALLOW
 
       rc = seccomp_load(ctx);
+      SeccompLoaded = rc == 0;
       if (rc == -EINVAL)
       {
 	 std::string msg;
@@ -526,7 +660,7 @@ protected:
    }
 
    aptMethod(std::string &&Binary, char const *const Ver, unsigned long const Flags) APT_NONNULL(3)
-       : pkgAcqMethod(Ver, Flags), aptConfigWrapperForMethods(Binary), Binary(std::move(Binary)), SeccompFlags(0)
+       : pkgAcqMethod(Ver, Flags), aptConfigWrapperForMethods(Binary), Version(Ver), Flags(Flags), Binary(std::move(Binary)), SeccompFlags(0)
    {
       try {
 	 std::locale::global(std::locale(""));
@@ -553,7 +687,9 @@ class aptAuthConfMethod : public aptMethod
 
       // ignore errors with opening the auth file as it doesn't need to exist
       _error->PushToStack();
-      auto const netrc = _config->FindFile("Dir::Etc::netrc");
+      // as a daemon we have no privileges left to reopen them for later clients
+      bool const OpenAuthConfs = authconfs.empty();
+      auto const netrc = OpenAuthConfs ? _config->FindFile("Dir::Etc::netrc") : "";
       if (netrc.empty() == false)
       {
 	 authconfs.emplace_back(new FileFd());
@@ -566,7 +702,7 @@ class aptAuthConfMethod : public aptMethod
 	 }
       }
 
-      auto const netrcparts = _config->FindDir("Dir::Etc::netrcparts");
+      auto const netrcparts = OpenAuthConfs ? _config->FindDir("Dir::Etc::netrcparts") : "";
       if (netrcparts.empty() == false)
       {
 	 for (auto &&netrcpart : GetListOfFilesInDir(netrcparts, "conf", true, true))
@@ -14,8 +14,10 @@
 #include <apt-pkg/debversion.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
 #include <apt-pkg/strutl.h>
 
+#include <algorithm>
 #include <cctype>
 #include <csignal>
 #include <cstdio>
@@ -62,14 +64,8 @@ ServerState::RunHeadersResult ServerState::RunHeaders(RequestState &Req,
       if (Owner->Debug == true)
 	 clog << "Answer for: " << Uri << endl << Data;
 
-      for (string::const_iterator I = Data.begin(); I < Data.end(); ++I)
-      {
-	 string::const_iterator J = I;
-	 for (; J != Data.end() && *J != '\n' && *J != '\r'; ++J);
-	 if (Req.HeaderLine(string(I,J)) == false)
-	    return RUN_HEADERS_PARSE_ERROR;
-	 I = J;
-      }
+      if (Req.HeaderLines(Data) == false)
+	 return RUN_HEADERS_PARSE_ERROR;
 
       // 100 Continue is a Nop...
       if (Req.Result == 100)
@@ -85,6 +81,19 @@ ServerState::RunHeadersResult ServerState::RunHeaders(RequestState &Req,
    return RUN_HEADERS_IO_ERROR;
 }
 									/*}}}*/
+bool RequestState::HeaderLines(string const &Data)			/*{{{*/
+{
+   for (string::const_iterator I = Data.begin(); I < Data.end(); ++I)
+   {
+      string::const_iterator J = I;
+      for (; J != Data.end() && *J != '\n' && *J != '\r'; ++J);
+      if (HeaderLine(string(I,J)) == false)
+	 return false;
+      I = J;
+   }
+   return true;
+}
+									/*}}}*/
 bool RequestState::HeaderLine(string const &Line)			/*{{{*/
 {
    if (Line.empty() == true)
@@ -245,6 +254,7 @@ bool RequestState::HeaderLine(string const &Line)			/*{{{*/
    {
       if (RFC1123StrToTime(Val, Date) == false)
 	 return _error->Error(_("Unknown date format"));
+      HaveLastModified = true;
       return true;
    }
 
@@ -260,6 +270,8 @@ bool RequestState::HeaderLine(string const &Line)			/*{{{*/
       ranges.erase(std::remove(ranges.begin(), ranges.end(), ' '), ranges.end());
       if (ranges.find(",bytes,") == std::string::npos)
 	 Server->RangesAllowed = false;
+      else
+	 AcceptRanges = true;
       return true;
    }
 
@@ -308,7 +320,15 @@ ServerState::ServerState(URI Srv, BaseHttpMethod *Owner) :
 									/*}}}*/
 bool RequestState::AddPartialFileToHashes(FileFd &File)			/*{{{*/
 {
+   // truncating changes the modification time, so check the kept hashes first
+   auto Hash = Owner->ResumeHashes(File, StartPos);
    File.Truncate(StartPos);
+   if (Hash != nullptr)
+   {
+      // nothing was read, so the data has to be appended explicitly
+      Server->SetHashes(std::move(Hash));
+      return File.Seek(StartPos);
+   }
    return Server->GetHashes()->AddFD(File, StartPos);
 }
 									/*}}}*/
@@ -525,6 +545,17 @@ BaseHttpMethod::DealWithHeaders(FetchResult &Res, RequestState &Req)
       return ERROR_UNRECOVERABLE;
    }
 
+   // a partial reply to our If-Range means the file has the date of our partial file
+   if (Req.Result == 206 && Req.HaveLastModified == false && Req.StartPos != 0)
+   {
+      struct stat SBuf;
+      if (stat(Queue->DestFile.c_str(), &SBuf) == 0 && static_cast<unsigned long long>(SBuf.st_size) == Req.StartPos)
+      {
+	 Req.Date = SBuf.st_mtime;
+	 Req.HaveLastModified = true;
+      }
+   }
+
    // This is some sort of 2xx 'data follows' reply
    Res.LastModified = Req.Date;
    Res.Size = Req.TotalFileSize;
@@ -628,8 +659,14 @@ int BaseHttpMethod::Loop()
    signal(SIGINT,SigTerm);
    
    Server = 0;
+   if (StartDaemon() == false)
+   {
+      _error->DumpErrors();
+      return 100;
+   }
    
    int FailCounter = 0;
+   bool NewClient = false;
    while (1)
    {      
       // We have no commands, wait for some to arrive
@@ -644,6 +681,14 @@ int BaseHttpMethod::Loop()
       int Result = Run(true);
       if (Result != -1 && (Result != 0 || Queue == 0))
       {
+	 // As a daemon we keep our connection for the next client
+	 if (Result == 0 && Queue == 0 && NextClient())
+	 {
+	    NewClient = true;
+	    if (Server != nullptr && Server->IsOpen() && Server->IsStale())
+	       Server->Close();
+	    continue;
+	 }
 	 if(FailReason.empty() == false ||
 	    ConfigFindB("DependOnSTDIN", true) == true)
 	    return 100;
@@ -655,18 +700,21 @@ int BaseHttpMethod::Loop()
 	 continue;
       
       // Connect to the server
-      if (Server == 0 || Server->Comp(URI(Queue->Uri)) == false)
+      if (Server == 0 || Server->Comp(URI(Queue->Uri)) == false || NewClient)
       {
 	 if (!Queue->Proxy().empty())
 	 {
 	    URI uri(Queue->Uri);
 	    _config->Set("Acquire::" + uri.Access + "::proxy::" + uri.Host, Queue->Proxy());
 	 }
-	 Server = CreateServerState(URI(Queue->Uri));
+	 if (Server == 0 || Server->Comp(URI(Queue->Uri)) == false)
+	    Server = CreateServerState(URI(Queue->Uri));
+	 NewClient = false;
 	 setPostfixForMethodNames(::URI(Queue->Uri).Host.c_str());
 	 AllowRedirect = ConfigFindB("AllowRedirect", true);
 	 PipelineDepth = ConfigFindI("Pipeline-Depth", 10);
 	 Server->RangesAllowed = ConfigFindB("AllowRanges", true);
+	 Server->Segments = std::max(1, ConfigFindI("Segments", 1));
 	 Debug = DebugEnabled();
       }
 
@@ -790,7 +838,12 @@ int BaseHttpMethod::Loop()
 		  }
 	       }
 	       if (Result == ResultState::SUCCESSFUL)
-		  Result = Server->RunData(Req);
+	       {
+		  if (auto const Segments = SegmentsFor(Req); Segments > 1)
+		     Result = RunSegments(Req, Segments);
+		  else
+		     Result = Server->RunData(Req);
+	       }
 	    }
 
 	    /* If the server is sending back sizeless responses then fill in
@@ -858,6 +911,7 @@ int BaseHttpMethod::Loop()
 		  Server->PipelineAnswersReceived = 0;
 	       }
 
+	       KeepPartialHashes();
 	       Server->Close();
 	       FailCounter = 0;
 	       switch (Result)
@@ -950,6 +1004,66 @@ int BaseHttpMethod::Loop()
    return 0;
 }
 									/*}}}*/
+// BaseHttpMethod::SegmentsFor - Decide if a response is split up	/*{{{*/
+// ---------------------------------------------------------------------
+/* Big files can be fetched over multiple connections at once in byte
+   ranges. That only works if we know the size, the server supports ranges
+   and gave us a date to make sure all ranges are from the same file, and
+   we can verify the result as a whole afterwards. */
+unsigned long long BaseHttpMethod::SegmentsFor(RequestState const &Req)
+{
+   if (Server->Segments < 2 || Server->RangesAllowed == false ||
+       Req.AcceptRanges == false || Req.HaveLastModified == false)
+      return 1;
+   if ((Req.Result != 200 && Req.Result != 206) || Req.Encoding != RequestState::Stream ||
+       Req.JunkSize != 0 || Req.DownloadSize == 0 ||
+       Req.StartPos + Req.DownloadSize != Req.TotalFileSize ||
+       (Req.MaximumSize != 0 && Req.DownloadSize > Req.MaximumSize) ||
+       Queue->ExpectedHashes.usable() == false)
+      return 1;
+   unsigned long long const SegmentSize = std::max(1, ConfigFindI("Segment-Size", 4096)) * 1024ull;
+   return std::min<unsigned long long>(Server->Segments, Req.DownloadSize / SegmentSize);
+}
+									/*}}}*/
+// BaseHttpMethod::KeepPartialHashes - Remember the hashes of a failure	/*{{{*/
+// ---------------------------------------------------------------------
+/* The hashes only cover what was written to the file, which isn't all of
+   it if it was fetched in segments, so the sizes have to agree. */
+void BaseHttpMethod::KeepPartialHashes()
+{
+   Partial.Hash = Server->TakeHashes();
+   if (Partial.Hash == nullptr || stat(Queue->DestFile.c_str(), &Partial.Stat) != 0 ||
+       Partial.Hash->GetHashStringList().FileSize() != static_cast<unsigned long long>(Partial.Stat.st_size))
+   {
+      Partial.Hash.reset();
+      return;
+   }
+   Partial.Name = Queue->DestFile;
+   Partial.ExpectedHashes = Queue->ExpectedHashes;
+}
+									/*}}}*/
+// BaseHttpMethod::ResumeHashes - Reuse the hashes of a failure		/*{{{*/
+// ---------------------------------------------------------------------
+/* The kept hashes are only good for the same download if the file wasn't
+   touched since. The inode change time can't tell us as the acquire system
+   changes owner and permissions of the partial file before each try, but
+   writing to it would change its modification time. */
+std::unique_ptr<Hashes> BaseHttpMethod::ResumeHashes(FileFd &File, unsigned long long const StartPos)
+{
+   auto Hash = std::move(Partial.Hash);
+   if (Hash == nullptr || StartPos == 0 || Partial.Name != Queue->DestFile ||
+       Partial.ExpectedHashes != Queue->ExpectedHashes)
+      return nullptr;
+   struct stat Buf;
+   if (fstat(File.Fd(), &Buf) != 0 || Buf.st_dev != Partial.Stat.st_dev || Buf.st_ino != Partial.Stat.st_ino ||
+       static_cast<unsigned long long>(Buf.st_size) != StartPos || Buf.st_size != Partial.Stat.st_size ||
+       Buf.st_mtim.tv_sec != Partial.Stat.st_mtim.tv_sec || Buf.st_mtim.tv_nsec != Partial.Stat.st_mtim.tv_nsec)
+      return nullptr;
+   if (Debug == true)
+      std::clog << "Resuming the hashes of " << Queue->DestFile << " at " << StartPos << std::endl;
+   return Hash;
+}
+									/*}}}*/
 unsigned long long BaseHttpMethod::FindMaximumObjectSizeInQueue() const	/*{{{*/
 {
    unsigned long long MaxSizeInQueue = 0;
@@ -13,6 +13,7 @@
 
 #include "aptmethod.h"
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
 #include <apt-pkg/strutl.h>
 
 #include <ctime>
@@ -20,6 +21,8 @@
 #include <memory>
 #include <string>
 
+#include <sys/stat.h>
+
 using std::cout;
 using std::endl;
 
@@ -52,6 +55,9 @@ struct RequestState
    unsigned long long MaximumSize = 0;
 
    time_t Date;
+   // the server sent a Last-Modified date and supports byte ranges
+   bool HaveLastModified = false;
+   bool AcceptRanges = false;
    HaveContent haveContent = HaveContent::TRI_UNKNOWN;
 
    enum {Closes,Chunked,Stream} Encoding = Closes;
@@ -65,6 +71,7 @@ struct RequestState
    ServerState * const Server;
 
    bool HeaderLine(std::string const &Line);
+   bool HeaderLines(std::string const &Data);
    bool AddPartialFileToHashes(FileFd &File);
 
    RequestState(BaseHttpMethod * const Owner, ServerState * const Server) :
@@ -75,6 +82,7 @@ struct ServerState
    bool Persistent;
    bool PipelineAllowed;
    bool RangesAllowed;
+   unsigned long Segments;
    unsigned long PipelineAnswersReceived;
 
    bool Pipeline;
@@ -112,12 +120,18 @@ struct ServerState
 
    virtual ResultState Open() = 0;
    virtual bool IsOpen() = 0;
+   /** \brief The idle connection was closed or is otherwise unusable */
+   virtual bool IsStale() = 0;
    virtual bool Close() = 0;
    virtual bool InitHashes(HashStringList const &ExpectedHashes) = 0;
    virtual ResultState Die(RequestState &Req) = 0;
    virtual bool Flush(FileFd *const File, bool MustComplete = false) = 0;
    virtual ResultState Go(bool ToFile, RequestState &Req) = 0;
    virtual Hashes * GetHashes() = 0;
+   /** \brief Hand over the hashes of the data written so far */
+   virtual std::unique_ptr<Hashes> TakeHashes() = 0;
+   /** \brief Continue with hashes already covering the partial file */
+   virtual void SetHashes(std::unique_ptr<Hashes> &&Hash) = 0;
 
    ServerState(URI Srv, BaseHttpMethod *Owner);
    virtual ~ServerState() {};
@@ -136,6 +150,19 @@ class BaseHttpMethod : public aptAuthConfMethod
    // Find the biggest item in the fetch queue for the checking of the maximum
    // size
    unsigned long long FindMaximumObjectSizeInQueue() const APT_PURE;
+   // Number of ranges the rest of the current response is fetched in
+   unsigned long long SegmentsFor(RequestState const &Req);
+
+   /* The hashes of a transfer which failed midway, so that a resume of it
+      doesn't have to read the partial file again if it wasn't changed */
+   struct
+   {
+      std::string Name;
+      HashStringList ExpectedHashes;
+      struct stat Stat{};
+      std::unique_ptr<Hashes> Hash;
+   } Partial;
+   void KeepPartialHashes();
 
    public:
    bool Debug;
@@ -168,11 +195,19 @@ class BaseHttpMethod : public aptAuthConfMethod
    int Loop();
 
    virtual void SendReq(FetchItem *Itm) = 0;
+   /** \brief Fetch the rest of the response in \a Count byte ranges in parallel
+    *
+    *  The headers of \a Req are already handled and the file is open. The
+    *  hashes of the server state cover the whole file once this succeeded.
+    */
+   virtual ResultState RunSegments(RequestState &Req, unsigned long long Count) = 0;
    virtual std::unique_ptr<ServerState> CreateServerState(URI const &uri) = 0;
    virtual void RotateDNS() = 0;
    bool Configuration(std::string Message) override;
 
    bool AddProxyAuth(URI &Proxy, URI const &Server);
+   /** \brief The kept hashes if they cover the first \a StartPos bytes of \a File */
+   std::unique_ptr<Hashes> ResumeHashes(FileFd &File, unsigned long long StartPos);
 
    BaseHttpMethod(std::string &&Binary, char const * const Ver,unsigned long const Flags);
    virtual ~BaseHttpMethod() {};
@@ -17,6 +17,7 @@
 #include <apt-pkg/hashes.h>
 #include <apt-pkg/strutl.h>
 
+#include <array>
 #include <string>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -35,6 +36,20 @@ class CopyMethod final : public aptMethod
    }
 };
 
+// CopyAndHash - Copy the file and hash the data on the way		/*{{{*/
+static bool CopyAndHash(FileFd &From, FileFd &To, Hashes &Hash)
+{
+   std::array<unsigned char, APT_BUFFER_SIZE> Buf;
+   unsigned long long ToRead = 0;
+   do {
+      if (From.Read(Buf.data(), Buf.size(), &ToRead) == false ||
+	  Hash.Add(Buf.data(), ToRead) == false ||
+	  To.Write(Buf.data(), ToRead) == false)
+	 return false;
+   } while (ToRead != 0);
+   return true;
+}
+									/*}}}*/
 // CopyMethod::Fetch - Fetch a file					/*{{{*/
 bool CopyMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
 {
@@ -81,7 +96,8 @@ bool CopyMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
 
       // Copy the file
       URIStart(Res);
-      if (not CopyFile(From, To))
+      Hashes Hash(Itm->ExpectedHashes);
+      if (not CopyAndHash(From, To, Hash))
       {
 	 To.OpFail();
 	 continue;
@@ -89,7 +105,7 @@ bool CopyMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
       From.Close();
       To.Close();
 
-      CalculateHashes(Itm, Res);
+      Res.TakeHashes(Hash);
       if (not Itm->ExpectedHashes.empty() && Itm->ExpectedHashes != Res.Hashes)
 	 continue;
 
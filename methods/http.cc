@@ -23,8 +23,10 @@
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/hashes.h>
 #include <apt-pkg/proxy.h>
+#include <apt-pkg/reactor.h>
 #include <apt-pkg/strutl.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <chrono>
 #include <csignal>
@@ -35,8 +37,10 @@
 #include <iostream>
 #include <iterator>
 #include <sstream>
+#include <utility>
+#include <vector>
 #include <arpa/inet.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -543,6 +547,7 @@ ResultState HttpServerState::Open()
 /* */
 bool HttpServerState::Close()
 {
+   Events.Forget(ServerFd->Fd());
    ServerFd->Close();
    return true;
 }
@@ -678,6 +683,14 @@ APT_PURE bool HttpServerState::IsOpen()					/*{{{*/
    return (ServerFd->Fd() != -1);
 }
 									/*}}}*/
+bool HttpServerState::IsStale()						/*{{{*/
+{
+   // Nothing should arrive while we have no requests pending, so this is
+   // either the server closing the connection or garbage.
+   struct pollfd Idle = {ServerFd->Fd(), POLLIN, 0};
+   return In.WriteSpace() || ServerFd->HasPending() || poll(&Idle, 1, 0) != 0;
+}
+									/*}}}*/
 bool HttpServerState::InitHashes(HashStringList const &ExpectedHashes)	/*{{{*/
 {
    delete In.Hash;
@@ -688,6 +701,7 @@ bool HttpServerState::InitHashes(HashStringList const &ExpectedHashes)	/*{{{*/
 void HttpServerState::Reset()						/*{{{*/
 {
    ServerState::Reset();
+   Events.Forget(ServerFd->Fd());
    ServerFd->Close();
 }
 									/*}}}*/
@@ -697,6 +711,17 @@ APT_PURE Hashes * HttpServerState::GetHashes()				/*{{{*/
    return In.Hash;
 }
 									/*}}}*/
+std::unique_ptr<Hashes> HttpServerState::TakeHashes()			/*{{{*/
+{
+   return std::unique_ptr<Hashes>(std::exchange(In.Hash, nullptr));
+}
+									/*}}}*/
+void HttpServerState::SetHashes(std::unique_ptr<Hashes> &&Hash)		/*{{{*/
+{
+   delete In.Hash;
+   In.Hash = Hash.release();
+}
+									/*}}}*/
 // HttpServerState::Die - The server has closed the connection.		/*{{{*/
 ResultState HttpServerState::Die(RequestState &Req)
 {
@@ -759,7 +784,7 @@ bool HttpServerState::Flush(FileFd *const File, bool MustComplete)
 									/*}}}*/
 // HttpServerState::Go - Run a single loop				/*{{{*/
 // ---------------------------------------------------------------------
-/* This runs the select loop over the server FDs, Output file FDs and
+/* This runs the event loop over the server FDs, Output file FDs and
    stdin. */
 ResultState HttpServerState::Go(bool ToFile, RequestState &Req)
 {
@@ -769,71 +794,73 @@ ResultState HttpServerState::Go(bool ToFile, RequestState &Req)
       return ResultState::TRANSIENT_ERROR;
 
    // Record if we have data pending to read in the server, so that we can
-   // skip the wait in select(). This can happen if data has already been
+   // skip the wait for events. This can happen if data has already been
    // read into a methodfd's buffer - the TCP queue might be empty at that
    // point.
    bool ServerPending = ServerFd->HasPending();
 
-   fd_set rfds,wfds;
-   FD_ZERO(&rfds);
-   FD_ZERO(&wfds);
-   
    /* Add the server. We only send more requests if the connection will 
       be persisting */
+   unsigned ServerEvents = 0;
    if (Out.WriteSpace() == true && ServerFd->Fd() != -1 && Persistent == true)
-      FD_SET(ServerFd->Fd(), &wfds);
+      ServerEvents |= APT::Reactor::Write;
    if (In.ReadSpace() == true && ServerFd->Fd() != -1)
-      FD_SET(ServerFd->Fd(), &rfds);
+      ServerEvents |= APT::Reactor::Read;
+   if (not Events.Watch(ServerFd->Fd(), ServerEvents, ServerFd.get()))
+      return ResultState::TRANSIENT_ERROR;
 
-   // Add the file. Note that we need to add the file to the select and
+   // Add the file. Note that we need to add the file to the wait and
    // then write before we read from the server so we do not have content
    // left to write if the server closes the connection when we read from it.
    //
    // An alternative would be to just flush the file in those circumstances
    // and then return. Because otherwise we might end up blocking indefinitely
-   // in the select() call if we were to continue but all that was left to do
+   // in the wait if we were to continue but all that was left to do
    // was write to the local file.
    if (In.WriteSpace() == true && ToFile == true && Req.File.IsOpen())
-      FD_SET(Req.File.Fd(), &wfds);
+      if (not Events.Watch(Req.File.Fd(), APT::Reactor::Write, &Req.File))
+	 return ResultState::TRANSIENT_ERROR;
 
    // Add stdin
    if (Owner->ConfigFindB("DependOnSTDIN", true) == true)
-      FD_SET(STDIN_FILENO,&rfds);
-	  
-   // Figure out the max fd
-   int MaxFd = Req.File.Fd();
-   if (MaxFd < ServerFd->Fd())
-      MaxFd = ServerFd->Fd();
-
-   // Select
-   struct timeval tv;
-   tv.tv_sec = ServerPending ? 0 : TimeOut;
-   tv.tv_usec = 0;
-   int Res = 0;
-   if ((Res = select(MaxFd+1,&rfds,&wfds,0,&tv)) < 0)
-   {
-      if (errno == EINTR)
-	 return ResultState::SUCCESSFUL;
-      _error->Errno("select", _("Select failed"));
+      if (not Events.Watch(STDIN_FILENO, APT::Reactor::Read, Owner))
+	 return ResultState::TRANSIENT_ERROR;
+
+   // Wait
+   auto const Deadline = APT::Reactor::clock::now() + std::chrono::seconds(ServerPending ? 0 : TimeOut);
+   if (not Events.Wait(Ready, Deadline))
       return ResultState::TRANSIENT_ERROR;
-   }
-   
-   if (Res == 0 && not ServerPending)
+
+   if (Ready.empty() && not ServerPending)
    {
       _error->Error(_("Connection timed out"));
       return ResultState::TRANSIENT_ERROR;
    }
 
+   bool ServerRead = false, ServerWrite = false, FileWrite = false, StdinRead = false;
+   for (auto const &Event : Ready)
+   {
+      if (Event.data == ServerFd.get())
+      {
+	 ServerRead = Event.events & APT::Reactor::Read;
+	 ServerWrite = Event.events & APT::Reactor::Write;
+      }
+      else if (Event.data == &Req.File)
+	 FileWrite = true;
+      else if (Event.data == Owner)
+	 StdinRead = true;
+   }
+
    // Flush any data before talking to the server, in case the server
    // closed the connection, we want to be done writing.
-   if (Req.File.IsOpen() && FD_ISSET(Req.File.Fd(), &wfds))
+   if (Req.File.IsOpen() && FileWrite)
    {
       if (not Flush(&Req.File, false))
 	 return ResultState::TRANSIENT_ERROR;
    }
 
    // Handle server IO
-   if (ServerPending || (ServerFd->Fd() != -1 && FD_ISSET(ServerFd->Fd(), &rfds)))
+   if (ServerPending || (ServerFd->Fd() != -1 && ServerRead))
    {
       errno = 0;
       if (In.Read(ServerFd) == false)
@@ -847,7 +874,7 @@ ResultState HttpServerState::Go(bool ToFile, RequestState &Req)
 	 return ResultState::TRANSIENT_ERROR;
    }
 
-   if (ServerFd->Fd() != -1 && FD_ISSET(ServerFd->Fd(), &wfds))
+   if (ServerFd->Fd() != -1 && ServerWrite)
    {
       errno = 0;
       if (Out.Write(ServerFd) == false)
@@ -863,7 +890,7 @@ ResultState HttpServerState::Go(bool ToFile, RequestState &Req)
    }
 
    // Handle commands from APT
-   if (FD_ISSET(STDIN_FILENO,&rfds))
+   if (StdinRead)
    {
       if (Owner->Run(true) != -1)
 	 exit(100);
@@ -873,10 +900,11 @@ ResultState HttpServerState::Go(bool ToFile, RequestState &Req)
 }
 									/*}}}*/
 
-// HttpMethod::SendReq - Send the HTTP request				/*{{{*/
+// HttpMethod::BuildRequest - Build the HTTP request			/*{{{*/
 // ---------------------------------------------------------------------
-/* This places the http request in the outbound buffer */
-void HttpMethod::SendReq(FetchItem *Itm)
+/* Conditions are the header fields deciding which part of the file we get,
+   if any */
+std::string HttpMethod::BuildRequest(FetchItem const *Itm, ServerState *Srv, std::string const &Conditions)
 {
    URI Uri(Itm->Uri);
    {
@@ -898,7 +926,7 @@ void HttpMethod::SendReq(FetchItem *Itm)
       but while its a must for all servers to accept absolute URIs,
       it is assumed clients will sent an absolute path for non-proxies */
    std::string requesturi;
-   if ((Server->Proxy.Access != "http" && Server->Proxy.Access != "https") || APT::String::Endswith(Uri.Access, "https") || Server->Proxy.empty() == true || Server->Proxy.Host.empty())
+   if ((Srv->Proxy.Access != "http" && Srv->Proxy.Access != "https") || APT::String::Endswith(Uri.Access, "https") || Srv->Proxy.empty() == true || Srv->Proxy.Host.empty())
       requesturi = Uri.Path;
    else
       requesturi = Uri;
@@ -938,18 +966,12 @@ void HttpMethod::SendReq(FetchItem *Itm)
 	 Req << "Accept: text/*\r\n";
    }
 
-   // Check for a partial file and send if-queries accordingly
-   struct stat SBuf;
-   if (Server->RangesAllowed && stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
-      Req << "Range: bytes=" << std::to_string(SBuf.st_size) << "-\r\n"
-	 << "If-Range: " << TimeRFC1123(SBuf.st_mtime, false) << "\r\n";
-   else if (Itm->LastModified != 0)
-      Req << "If-Modified-Since: " << TimeRFC1123(Itm->LastModified, false).c_str() << "\r\n";
+   Req << Conditions;
 
-   if ((Server->Proxy.Access == "http" || Server->Proxy.Access == "https") &&
-       (Server->Proxy.User.empty() == false || Server->Proxy.Password.empty() == false))
+   if ((Srv->Proxy.Access == "http" || Srv->Proxy.Access == "https") &&
+       (Srv->Proxy.User.empty() == false || Srv->Proxy.Password.empty() == false))
       Req << "Proxy-Authorization: Basic "
-	 << Base64Encode(Server->Proxy.User + ":" + Server->Proxy.Password) << "\r\n";
+	 << Base64Encode(Srv->Proxy.User + ":" + Srv->Proxy.Password) << "\r\n";
 
    MaybeAddAuthTo(Uri);
    if (Uri.User.empty() == false || Uri.Password.empty() == false)
@@ -986,7 +1008,270 @@ void HttpMethod::SendReq(FetchItem *Itm)
    if (Debug == true)
       cerr << Req.str() << endl;
 
-   Server->WriteResponse(Req.str());
+   return Req.str();
+}
+									/*}}}*/
+// HttpMethod::SendReq - Send the HTTP request				/*{{{*/
+// ---------------------------------------------------------------------
+/* This places the http request in the outbound buffer */
+void HttpMethod::SendReq(FetchItem *Itm)
+{
+   // Check for a partial file and send if-queries accordingly
+   std::string Conditions;
+   struct stat SBuf;
+   if (Server->RangesAllowed && stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
+      Conditions = "Range: bytes=" + std::to_string(SBuf.st_size) + "-\r\n" +
+		   "If-Range: " + TimeRFC1123(SBuf.st_mtime, false) + "\r\n";
+   else if (Itm->LastModified != 0)
+      Conditions = "If-Modified-Since: " + TimeRFC1123(Itm->LastModified, false) + "\r\n";
+
+   Server->WriteResponse(BuildRequest(Itm, Server.get(), Conditions));
+}
+									/*}}}*/
+// PositionalFd - Write to a file at a fixed position			/*{{{*/
+// ---------------------------------------------------------------------
+/* The segments of a file share its descriptor, so rather than moving the
+   shared file position each of them writes at its own offset */
+struct PositionalFd final : public MethodFd
+{
+   int const fd;
+   off_t Offset;
+
+   int Fd() override { return fd; }
+   ssize_t Read(void *, size_t) override
+   {
+      errno = EBADF;
+      return -1;
+   }
+   ssize_t Write(void *buf, size_t count) override
+   {
+      ssize_t Res;
+      do
+	 Res = pwrite(fd, buf, count, Offset);
+      while (Res < 0 && errno == EINTR);
+      if (Res > 0)
+	 Offset += Res;
+      return Res;
+   }
+   int Close() override { return 0; }
+
+   PositionalFd(int const fd, off_t const Offset) : fd(fd), Offset(Offset) {}
+};
+									/*}}}*/
+// HttpSegment - A byte range of a file and the connection fetching it	/*{{{*/
+struct HttpSegment
+{
+   HttpServerState *Srv = nullptr;
+   std::unique_ptr<HttpServerState> Owned;
+   std::unique_ptr<MethodFd> File;
+   unsigned long long Offset = 0;
+   unsigned long long Length = 0;
+   bool Headers = false;
+   bool Done = false;
+   bool Readable = false;
+   bool Writable = false;
+
+   unsigned long long Written() const { return static_cast<PositionalFd const &>(*File).Offset - Offset; }
+};
+									/*}}}*/
+// HttpMethod::RunSegments - Fetch a file in parallel byte ranges	/*{{{*/
+// ---------------------------------------------------------------------
+/* The response we already have the headers of continues as the first
+   segment, the others are requested with If-Range on fresh connections
+   just like a resume of a partial file would be. All connections are
+   served from one event loop and write into the file at their offsets.
+   The ranges can arrive in any order, so the file is hashed once all of
+   them are complete. */
+ResultState HttpMethod::RunSegments(RequestState &Req, unsigned long long const Count)
+{
+   auto &Main = static_cast<HttpServerState &>(*Server);
+   unsigned long long const Start = Req.StartPos;
+   unsigned long long const End = Req.TotalFileSize;
+   unsigned long long const Length = (End - Start) / Count;
+   std::string const Date = TimeRFC1123(Req.Date, false);
+   Req.State = RequestState::Data;
+
+   std::vector<HttpSegment> Segments(Count);
+   for (unsigned long long I = 0; I < Count; ++I)
+   {
+      auto &S = Segments[I];
+      S.Offset = Start + I * Length;
+      S.Length = (I + 1 == Count) ? End - S.Offset : Length;
+      S.File = std::make_unique<PositionalFd>(Req.File.Fd(), S.Offset);
+   }
+   Segments[0].Srv = &Main;
+   Segments[0].Headers = true;
+   Main.In.Limit(Segments[0].Length);
+   // the data is hashed in file order at the end, not as it arrives
+   Hashes * const Hash = std::exchange(Main.In.Hash, nullptr);
+
+   if (Debug == true)
+      clog << "Fetching " << Queue->Uri << " in " << Count << " segments" << endl;
+
+   ResultState Result = ResultState::SUCCESSFUL;
+   for (auto S = Segments.begin() + 1; S != Segments.end(); ++S)
+   {
+      S->Owned = std::make_unique<HttpServerState>(Main.ServerName, this);
+      S->Srv = S->Owned.get();
+      S->Srv->RangesAllowed = true;
+      S->Srv->Segments = 1;
+      if ((Result = S->Srv->Open()) != ResultState::SUCCESSFUL)
+	 break;
+      std::string const Range = "Range: bytes=" + std::to_string(S->Offset) + "-" +
+				std::to_string(S->Offset + S->Length - 1) + "\r\n" +
+				"If-Range: " + Date + "\r\n";
+      S->Srv->Out.Read(BuildRequest(Queue, S->Srv, Range));
+   }
+
+   APT::Reactor Events;
+   std::vector<APT::Reactor::Event> Ready;
+   bool const DependOnSTDIN = ConfigFindB("DependOnSTDIN", true);
+   auto Deadline = APT::Reactor::clock::now() + std::chrono::seconds(Main.TimeOut);
+   auto const Active = [](HttpSegment const &S) { return S.Done == false; };
+   while (Result == ResultState::SUCCESSFUL && std::any_of(Segments.begin(), Segments.end(), Active))
+   {
+      bool Pending = false;
+      for (auto &S : Segments)
+      {
+	 if (S.Done)
+	    continue;
+	 unsigned Wanted = 0;
+	 if (S.Srv->Out.WriteSpace())
+	    Wanted |= APT::Reactor::Write;
+	 if (S.Srv->In.ReadSpace())
+	    Wanted |= APT::Reactor::Read;
+	 if (not Events.Watch(S.Srv->ServerFd->Fd(), Wanted, &S))
+	    Result = ResultState::TRANSIENT_ERROR;
+	 S.Readable = S.Writable = false;
+	 Pending |= S.Srv->ServerFd->HasPending();
+      }
+      if (DependOnSTDIN && not Events.Watch(STDIN_FILENO, APT::Reactor::Read, this))
+	 Result = ResultState::TRANSIENT_ERROR;
+      if (Result != ResultState::SUCCESSFUL ||
+	  not Events.Wait(Ready, Pending ? APT::Reactor::clock::now() : Deadline))
+      {
+	 Result = ResultState::TRANSIENT_ERROR;
+	 break;
+      }
+      if (Ready.empty() && not Pending)
+      {
+	 _error->Error(_("Connection timed out"));
+	 Result = ResultState::TRANSIENT_ERROR;
+	 break;
+      }
+      Deadline = APT::Reactor::clock::now() + std::chrono::seconds(Main.TimeOut);
+
+      bool StdinRead = false;
+      for (auto const &Event : Ready)
+      {
+	 if (Event.data == this)
+	 {
+	    StdinRead = true;
+	    continue;
+	 }
+	 auto &S = *static_cast<HttpSegment *>(Event.data);
+	 S.Readable = Event.events & APT::Reactor::Read;
+	 S.Writable = Event.events & APT::Reactor::Write;
+      }
+
+      for (auto &S : Segments)
+      {
+	 if (S.Done)
+	    continue;
+	 auto &Srv = *S.Srv;
+	 errno = 0;
+	 bool Closed = S.Writable && Srv.Out.Write(Srv.ServerFd) == false;
+	 if (Closed == false && (S.Readable || Srv.ServerFd->HasPending()))
+	    Closed = Srv.In.Read(Srv.ServerFd) == false;
+	 int const LErrno = errno;
+
+	 if (S.Headers == false)
+	 {
+	    std::string Data;
+	    if (Srv.In.WriteTillEl(Data))
+	    {
+	       if (Debug == true)
+		  clog << "Answer for: " << Queue->Uri << " at " << S.Offset << endl << Data;
+	       RequestState SegReq(this, &Srv);
+	       if (SegReq.HeaderLines(Data) == false)
+	       {
+		  Result = ResultState::TRANSIENT_ERROR;
+		  break;
+	       }
+	       // the file changed or the server ignored our range
+	       if (SegReq.Result != 206 || SegReq.StartPos != S.Offset || SegReq.TotalFileSize != End)
+	       {
+		  _error->Error(_("This HTTP server has broken range support"));
+		  Result = ResultState::TRANSIENT_ERROR;
+		  break;
+	       }
+	       S.Headers = true;
+	       Srv.In.Limit(S.Length);
+	    }
+	 }
+
+	 if (S.Headers && Srv.In.WriteSpace() && Srv.In.Write(S.File) == false)
+	 {
+	    _error->Errno("write", _("Error writing to file"));
+	    Result = ResultState::TRANSIENT_ERROR;
+	    break;
+	 }
+
+	 if (S.Headers && Srv.In.IsLimit())
+	 {
+	    // the main connection is in the middle of a response we do not
+	    // want the rest of, so it has to go as well
+	    S.Done = true;
+	    Srv.In.Limit(-1);
+	    Events.Forget(Srv.ServerFd->Fd());
+	    Srv.Close();
+	 }
+	 else if (Closed)
+	 {
+	    if (LErrno == 0)
+	       _error->Error(_("Error reading from server. Remote end closed connection"));
+	    else
+	    {
+	       errno = LErrno;
+	       _error->Errno("read", _("Error reading from server"));
+	    }
+	    Result = ResultState::TRANSIENT_ERROR;
+	    break;
+	 }
+      }
+
+      // Handle commands from APT
+      if (StdinRead && Run(true) != -1)
+	 exit(100);
+   }
+
+   Main.In.Limit(-1);
+   Main.In.Hash = Hash;
+   Main.Close();
+
+   if (Result == ResultState::SUCCESSFUL)
+   {
+      if (Req.File.Seek(Start) == false || Hash->AddFD(Req.File, End - Start) == false)
+      {
+	 _error->Errno("read", _("Problem hashing file"));
+	 return ResultState::TRANSIENT_ERROR;
+      }
+      return ResultState::SUCCESSFUL;
+   }
+
+   /* Keep the data we have without holes, so that the retry can resume
+      from there. The server might not like our ranges, so the retry will
+      not use any. */
+   unsigned long long Complete = Start;
+   for (auto const &S : Segments)
+   {
+      Complete += S.Written();
+      if (S.Done == false)
+	 break;
+   }
+   Req.File.Truncate(Complete);
+   Server->Segments = 1;
+   return Result;
 }
 									/*}}}*/
 std::unique_ptr<ServerState> HttpMethod::CreateServerState(URI const &uri)/*{{{*/
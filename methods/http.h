@@ -10,12 +10,14 @@
 #ifndef APT_HTTP_H
 #define APT_HTTP_H
 
+#include <apt-pkg/reactor.h>
 #include <apt-pkg/strutl.h>
 
 #include <chrono>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 #include <sys/time.h>
 
 #include "basehttp.h"
@@ -96,6 +98,9 @@ struct HttpServerState final : public ServerState
    CircleBuf In;
    CircleBuf Out;
    std::unique_ptr<MethodFd> ServerFd;
+   // Kept across Go() calls, so the watched descriptors persist
+   APT::Reactor Events;
+   std::vector<APT::Reactor::Event> Ready;
 
    protected:
    bool ReadHeaderLines(std::string &Data) override;
@@ -110,9 +115,12 @@ struct HttpServerState final : public ServerState
 
    ResultState Open() override;
    bool IsOpen() override;
+   bool IsStale() override;
    bool Close() override;
    bool InitHashes(HashStringList const &ExpectedHashes) override;
    Hashes * GetHashes() override;
+   std::unique_ptr<Hashes> TakeHashes() override;
+   void SetHashes(std::unique_ptr<Hashes> &&Hash) override;
    ResultState Die(RequestState &Req) override;
    bool Flush(FileFd *File, bool MustComplete = true) override;
    ResultState Go(bool ToFile, RequestState &Req) override;
@@ -123,8 +131,11 @@ struct HttpServerState final : public ServerState
 
 class HttpMethod final : public BaseHttpMethod
 {
+   std::string BuildRequest(FetchItem const *Itm, ServerState *Srv, std::string const &Conditions);
+
    public:
    void SendReq(FetchItem *Itm) override;
+   ResultState RunSegments(RequestState &Req, unsigned long long Count) override;
 
    std::unique_ptr<ServerState> CreateServerState(URI const &uri) override;
    void RotateDNS() override;
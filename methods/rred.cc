@@ -9,10 +9,10 @@
 
 #ifndef APT_EXCLUDE_RRED_METHOD_CODE
 #include "aptmethod.h"
-#include <apt-pkg/configuration.h>
 #include <apt-pkg/init.h>
 #endif
 
+#include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/hashes.h>
@@ -20,8 +20,10 @@
 
 #include <apt-private/private-cmndline.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <string>
 #include <vector>
@@ -31,8 +33,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include <apti18n.h>
 
@@ -433,6 +437,70 @@ class Patch {
       retry_fwrite(p, s, o, nullptr, hash);
    }
 
+   /* An uncompressed input file is mapped as a whole, so the unchanged
+      parts between two changes can be written and hashed in one go instead
+      of line by line. The pages are read once from start to end and dropped
+      from the mapping again behind us, so even big indexes only keep a few
+      blocks of the input resident. */
+   bool apply_against_map(FileFd &out, FileFd &in,
+	 Hashes * const start_hash, Hashes * const end_hash)
+   {
+      if (in.IsCompressed() || _config->FindB("Debug::Rred::NoMMap", false))
+	 return false;
+      // a pipe can't be mapped and its position can't even be asked for
+      struct stat Buf;
+      if (fstat(in.Fd(), &Buf) != 0 || not S_ISREG(Buf.st_mode) || Buf.st_size == 0 ||
+	    in.Tell() != 0)
+	 return false;
+
+      size_t const size = Buf.st_size;
+      void * const map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, in.Fd(), 0);
+      if (map == MAP_FAILED)
+	 return false;
+      DEFER([&] { munmap(map, size); });
+
+      char *cur = static_cast<char *>(map);
+      char * const end = cur + size;
+      char *resident = cur;
+      size_t const pagesize = sysconf(_SC_PAGESIZE);
+      posix_madvise(cur, size, POSIX_MADV_SEQUENTIAL);
+      // passes the next n lines to the output or only to the start_hash
+      auto const consume = [&](size_t n, bool const output) {
+	 while (n > 0 && cur != end) {
+	    char * const limit = cur + std::min<size_t>(end - cur, APT_MEMBLOCK_SIZE);
+	    char *p = cur;
+	    while (n > 0 && p != limit) {
+	       char * const nl = static_cast<char *>(memchr(p, '\n', limit - p));
+	       if (nl == nullptr) {
+		  p = limit;
+		  break;
+	       }
+	       p = nl + 1;
+	       --n;
+	    }
+	    if (output)
+	       retry_fwrite(cur, p - cur, out, start_hash, end_hash);
+	    else if (start_hash != nullptr)
+	       start_hash->Add(reinterpret_cast<unsigned char *>(cur), p - cur);
+	    cur = p;
+	    size_t const done = (cur - resident) / pagesize * pagesize;
+	    if (done >= APT_MEMBLOCK_SIZE) {
+	       madvise(resident, done, MADV_DONTNEED);
+	       resident += done;
+	    }
+	 }
+      };
+      for (auto const &ch : filechanges) {
+	 consume(ch.offset, true);
+	 consume(ch.del_cnt, false);
+	 if (ch.add_len != 0)
+	    dump_mem(out, ch.add, ch.add_len, end_hash);
+      }
+      consume(std::numeric_limits<size_t>::max(), true);
+      out.Flush();
+      return true;
+   }
+
    public:
 
    bool read_diff(FileFd &f, Hashes * const h)
@@ -585,6 +653,8 @@ class Patch {
    void apply_against_file(FileFd &out, FileFd &in,
 	 Hashes * const start_hash = nullptr, Hashes * const end_hash = nullptr)
    {
+      if (apply_against_map(out, in, start_hash, end_hash))
+	 return;
       std::list<struct Change>::iterator ch;
       for (ch = filechanges.begin(); ch != filechanges.end(); ++ch) {
 	 dump_lines(out, in, ch->offset, start_hash, end_hash);
@@ -16,6 +16,7 @@
 #include <ctime>
 #include <dirent.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <regex.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -23,8 +24,10 @@
 
 #include <array>
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <sstream>
 #include <string>
@@ -207,16 +210,18 @@ static bool sendHead(std::ostream &log, int const client, int const httpcode, st
    return Success;
 }
 									/*}}}*/
-static bool sendFile(int const client, std::list<std::string> const &headers, FileFd &data)/*{{{*/
+static bool sendFile(int const client, std::list<std::string> const &headers, FileFd &data,
+		     unsigned long long length = std::numeric_limits<unsigned long long>::max())/*{{{*/
 {
    bool Success = true;
    bool const chunked = chunkedTransferEncoding(headers);
    char buffer[500];
    unsigned long long actual = 0;
-   while ((Success &= data.Read(buffer, sizeof(buffer), &actual)) == true)
+   while (length != 0 && (Success &= data.Read(buffer, std::min<unsigned long long>(sizeof(buffer), length), &actual)) == true)
    {
       if (actual == 0)
 	 break;
+      length -= actual;
 
       if (chunked == true)
       {
@@ -743,6 +748,10 @@ static void * handleClient(int const client, size_t const id)		/*{{{*/
 	    }
 	 }
 
+	 // pretend to be a far away server which needs time for each request
+	 if (auto const delay = _config->FindI("aptwebserver::response-delay", 0); delay > 0)
+	    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
 	 // string replacements in the requested filename
 	 ::Configuration::Item const *Replaces = _config->Tree("aptwebserver::redirect::replace");
 	 if (Replaces != NULL)
@@ -864,28 +873,31 @@ static void * handleClient(int const client, size_t const id)		/*{{{*/
 	       {
 		  size_t start = 6;
 		  unsigned long long filestart = strtoull(condition.c_str() + start, NULL, 10);
-		  // FIXME: no support for last-byte-pos being not the end of the file (APT clients do not do this)
 		  size_t dash = condition.find('-') + 1;
 		  unsigned long long fileend = strtoull(condition.c_str() + dash, NULL, 10);
 		  unsigned long long filesize = data.FileSize();
-		  if ((fileend == 0 || (fileend == filesize && fileend >= filestart)) &&
+		  // a last-byte-pos within the file is used by segmented downloads
+		  bool const closedrange = fileend != 0 && fileend >= filestart && fileend < filesize &&
+		     _config->FindB("aptwebserver::support::range-end", true) == true;
+		  if ((fileend == 0 || closedrange || (fileend == filesize && fileend >= filestart)) &&
 			validrange == true)
 		  {
 		     if (filesize > filestart)
 		     {
+			unsigned long long const lastbyte = closedrange ? fileend : filesize - 1;
 			data.Skip(filestart);
                         // make sure to send content-range before conent-length
                         // as regression test for LP: #1445239
 			std::ostringstream contentrange;
 			contentrange << "Content-Range: bytes " << filestart << "-"
-			   << filesize - 1 << "/" << filesize;
+			   << lastbyte << "/" << filesize;
 			headers.push_back(contentrange.str());
 			std::ostringstream contentlength;
-			contentlength << "Content-Length: " << (filesize - filestart);
+			contentlength << "Content-Length: " << (lastbyte - filestart + 1);
 			headers.push_back(contentlength.str());
 			sendHead(log, client, 206, headers);
 			if (sendContent == true)
-			   sendFile(client, headers, data);
+			   sendFile(client, headers, data, lastbyte - filestart + 1);
 			continue;
 		     }
 		     else
@@ -905,6 +917,16 @@ static void * handleClient(int const client, size_t const id)		/*{{{*/
 
 	    addFileHeaders(headers, data);
 	    sendHead(log, client, 200, headers);
+	    // interrupted downloads can be tested with this: close after the given amount of bytes
+	    unsigned long long const interrupt = _config->FindI("aptwebserver::interruptrequest::" + filename, 0);
+	    if (sendContent == true && interrupt != 0)
+	    {
+	       _config->Clear("aptwebserver::interruptrequest::" + filename);
+	       sendFile(client, headers, data, interrupt);
+	       log << "INTERRUPT client " << client << " after " << interrupt << " bytes" << std::endl;
+	       closeConnection = true;
+	       break;
+	    }
 	    if (sendContent == true)
 	       sendFile(client, headers, data);
 	 }
@@ -1109,6 +1131,8 @@ int main(int const argc, const char * argv[])
 	 _error->DumpErrors(std::cerr);
 	 return 6;
       }
+      // headers are written line by line, don't let the client wait for an ACK
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
 
       std::thread t(handleClient, client, ++id);
       t.detach();
@@ -21,10 +21,18 @@
 #include <apt-pkg/debversion.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/tagfile.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iostream>
+#include <random>
 #include <string>
+#include <vector>
+#include <glob.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -180,3 +188,107 @@ TEST(CompareVersionTest,CuptTests)
    EXPECT_VERSION("2.2.4-47978_Debian_lenny", EQUAL, "2.2.4-47978_Debian_lenny"); // and underscore...
    // */
 }
+
+static int sign(int const Res)
+{
+   return (Res < 0) ? -1 : ((Res > 0) ? 1 : 0);
+}
+static int CmpKeys(std::string const &A, std::string const &B)
+{
+   int const Res = memcmp(A.data(), B.data(), std::min(A.size(), B.size()));
+   if (Res != 0 || A.size() == B.size())
+      return sign(Res);
+   return A.size() < B.size() ? -1 : 1;
+}
+static void ExpectSameKeyOrder(std::string const &A, std::string const &B)
+{
+   std::string KeyA, KeyB;
+   if (debVersioningSystem::ComparisonKey(KeyA, A.data(), A.data() + A.size()) == false ||
+       debVersioningSystem::ComparisonKey(KeyB, B.data(), B.data() + B.size()) == false)
+      return;
+   EXPECT_EQ(sign(debVS.CmpVersion(A, B)), CmpKeys(KeyA, KeyB)) << "A: »" << A << "« B: »" << B << "«";
+}
+TEST(CompareVersionTest,ComparisonKey)
+{
+   for (auto const &V : {"1.2.3", "0:1.2.3", "1.2.3-0", "1.2.3-", "1.2.3-1", "009ab5", "9ab5",
+			 "1.2a+~bCd3", "1.2a++", "1.2a+~", "1.0~", "1.0", "1.0~~", "1.0~a", "a0~",
+			 "a", "a0b", "ab", "1:2:123", "1:12:3", "5.005", "1.2-3-5", "00:1", "~:1"})
+      for (auto const &W : {"1.2.3", "1.2.3-", "1.0", "1.0~", "a", "a0", "a00b", "1:2:123", "1.2-3"})
+      {
+	 ExpectSameKeyOrder(V, W);
+	 ExpectSameKeyOrder(W, V);
+      }
+
+   std::string Key;
+   std::string const Long(100, '9');
+   EXPECT_FALSE(debVersioningSystem::ComparisonKey(Key, Long.data(), Long.data() + Long.size()));
+   std::string const Umlaut = "1.0\xc3\xa4";
+   EXPECT_FALSE(debVersioningSystem::ComparisonKey(Key, Umlaut.data(), Umlaut.data() + Umlaut.size()));
+
+   // versions made of the characters which are treated differently
+   std::mt19937 rng(42);
+   char const alphabet[] = "000123456789~~.+-::abzAZ";
+   auto const version = [&]() {
+      std::string V;
+      for (auto i = rng() % 12; i > 0; --i)
+	 V.push_back(alphabet[rng() % (sizeof(alphabet) - 1)]);
+      return V;
+   };
+   for (size_t i = 0; i < 100000; ++i)
+   {
+      std::string const A = version();
+      std::string B = A;
+      if (B.empty() || rng() % 2 == 0)
+	 B = version();
+      else
+	 B[rng() % B.size()] = alphabet[rng() % (sizeof(alphabet) - 1)];
+      ExpectSameKeyOrder(A, B);
+   }
+}
+TEST(CompareVersionTest,ComparisonKeyBenchmark)
+{
+   char const *const pattern = getenv("APT_BENCHMARK_PACKAGES");
+   if (pattern == nullptr)
+      GTEST_SKIP() << "APT_BENCHMARK_PACKAGES is not set";
+   glob_t files;
+   if (glob(pattern, 0, nullptr, &files) != 0)
+      GTEST_SKIP() << "No files match " << pattern;
+
+   std::vector<std::string> versions;
+   for (size_t i = 0; i < files.gl_pathc; ++i)
+   {
+      FileFd fd(files.gl_pathv[i], FileFd::ReadOnly, FileFd::Extension);
+      ASSERT_TRUE(fd.IsOpen());
+      pkgTagFile tfile(&fd);
+      pkgTagSection section;
+      while (tfile.Step(section))
+	 if (section.Exists("Version"))
+	    versions.emplace_back(section.Find("Version"));
+   }
+   globfree(&files);
+   ASSERT_FALSE(versions.empty());
+
+   auto const start = std::chrono::steady_clock::now();
+   std::vector<std::string> keys(versions.size());
+   for (size_t i = 0; i < versions.size(); ++i)
+      ASSERT_TRUE(debVersioningSystem::ComparisonKey(keys[i], versions[i].data(), versions[i].data() + versions[i].size())) << versions[i];
+   auto const keyed = std::chrono::steady_clock::now();
+
+   // compare each version with a few others spread over the archive
+   size_t const step = versions.size() / 16 + 1;
+   std::vector<int> cmp, key;
+   for (size_t i = 0; i < versions.size(); ++i)
+      for (size_t j = i % step; j < versions.size(); j += step)
+	 cmp.push_back(sign(debVS.CmpVersion(versions[i], versions[j])));
+   auto const compared = std::chrono::steady_clock::now();
+   for (size_t i = 0; i < versions.size(); ++i)
+      for (size_t j = i % step; j < versions.size(); j += step)
+	 key.push_back(CmpKeys(keys[i], keys[j]));
+   auto const keycompared = std::chrono::steady_clock::now();
+
+   auto const ms = [](auto const a, auto const b) { return std::chrono::duration_cast<std::chrono::milliseconds>(b - a).count(); };
+   std::cout << versions.size() << " versions keyed in " << ms(start, keyed) << "ms, "
+	     << cmp.size() << " comparisons in " << ms(keyed, compared) << "ms (CmpVersion) and "
+	     << ms(compared, keycompared) << "ms (keys)" << std::endl;
+   EXPECT_EQ(cmp, key);
+}
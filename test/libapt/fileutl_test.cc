@@ -223,6 +223,34 @@ TEST(FileUtlTest, FileFD)
    EXPECT_EQ(0, chdir(startdir.c_str()));
    removeDirectory(tempdir);
 }
+TEST(FileUtlTest, ThreadedCompression)
+{
+   std::string content;
+   for (int i = 0; content.size() < 4 * 1024 * 1024; ++i)
+      content.append("Package: pkg").append(std::to_string(i)).append("\nVersion: 1\n\n");
+
+   for (auto c : APT::Configuration::getCompressors())
+   {
+      if (c.Name != "xz" && c.Name != "zstd")
+	 continue;
+      SCOPED_TRACE(c.Name);
+      c.CompressArgs = {"-1", "-T2"};
+      auto const file = createTemporaryFile("threaded-compression");
+      FileFd f;
+      ASSERT_TRUE(f.Open(file.Name(), FileFd::WriteOnly | FileFd::Empty, c));
+      EXPECT_TRUE(f.Write(content.data(), content.size()));
+      EXPECT_TRUE(f.Close());
+
+      ASSERT_TRUE(f.Open(file.Name(), FileFd::ReadOnly, c));
+      std::string readback(content.size() + 1, '\0');
+      unsigned long long actual = 0;
+      EXPECT_TRUE(f.Read(readback.data(), readback.size(), &actual));
+      EXPECT_EQ(content.size(), actual);
+      readback.resize(actual);
+      EXPECT_EQ(content, readback);
+      EXPECT_TRUE(f.Close());
+   }
+}
 TEST(FileUtlTest, Glob)
 {
    std::vector<std::string> files;
@@ -5,9 +5,12 @@
 #include <apt-pkg/hashes.h>
 #include <apt-pkg/strutl.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "common.h"
 
@@ -303,3 +306,61 @@ TEST(HashSumsTest, HashStringList)
 
    _config->Clear("Acquire::ForceHash");
 }
+
+static std::vector<unsigned char> randomData(size_t const size)
+{
+   std::vector<unsigned char> data(size);
+   unsigned int seed = 42;
+   for (auto &c : data)
+      c = (seed = seed * 1103515245 + 12345) >> 16;
+   return data;
+}
+static double hashData(std::vector<unsigned char> const &data, bool const parallel, HashStringList &list)
+{
+   _config->Set("APT::Hashes::Parallel", parallel);
+   auto const start = std::chrono::steady_clock::now();
+   Hashes hashes;
+   for (size_t i = 0; i < data.size(); i += APT_BUFFER_SIZE)
+      EXPECT_TRUE(hashes.Add(data.data() + i, std::min<size_t>(APT_BUFFER_SIZE, data.size() - i)));
+   list = hashes.GetHashStringList();
+   std::chrono::duration<double> const duration = std::chrono::steady_clock::now() - start;
+   _config->Clear("APT::Hashes::Parallel");
+   return data.size() / duration.count() / (1024 * 1024);
+}
+TEST(HashSumsTest, Parallel)
+{
+   // hashing on worker threads must give the same result as in serial
+   auto const data = randomData(8 * 1024 * 1024);
+   HashStringList serial, parallel;
+   hashData(data, false, serial);
+   hashData(data, true, parallel);
+   EXPECT_EQ(serial, parallel);
+   EXPECT_EQ(data.size(), parallel.FileSize());
+
+   // the partially filled buffer must be hashed before a digest is taken
+   _config->Set("APT::Hashes::Parallel", true);
+   Hashes hashes;
+   hashes.Add(data.data(), 3 * 1024 * 1024 + 17);
+   HashStringList const first = hashes.GetHashStringList();
+   hashes.Add(data.data() + first.FileSize(), 1024);
+   HashStringList const second = hashes.GetHashStringList();
+   _config->Set("APT::Hashes::Parallel", false);
+   Hashes serialHashes;
+   serialHashes.Add(data.data(), 3 * 1024 * 1024 + 17);
+   EXPECT_EQ(serialHashes.GetHashStringList(), first);
+   serialHashes.Add(data.data() + first.FileSize(), 1024);
+   EXPECT_EQ(serialHashes.GetHashStringList(), second);
+   _config->Clear("APT::Hashes::Parallel");
+}
+TEST(HashSumsTest, ParallelThroughput)
+{
+   if (getenv("APT_BENCHMARK_HASHES") == nullptr)
+      GTEST_SKIP() << "APT_BENCHMARK_HASHES is not set";
+   auto const data = randomData(64 * 1024 * 1024);
+   HashStringList serial, parallel;
+   auto const serialSpeed = hashData(data, false, serial);
+   auto const parallelSpeed = hashData(data, true, parallel);
+   EXPECT_EQ(serial, parallel);
+   std::cout << "Hashed with " << serialSpeed << " MiB/s in serial and "
+	     << parallelSpeed << " MiB/s in parallel" << std::endl;
+}
@@ -222,3 +222,17 @@ TEST(TreeParserTest, ParseShortPattern)
    EXPECT_PATTERN_EQ("~napt~nfoo", "?and(?name(apt),?name(foo))");
    EXPECT_PATTERN_EQ("~napt!~nfoo", "?and(?name(apt),?not(?name(foo)))");
 }
+
+TEST(PatternTest, RegexLiteral)
+{
+   // words are matched without regexec, which must not change the result
+   for (auto const pattern : {"apt", "^apt", "apt$", "^apt$", "APT", "lib-x_y", "^Lib2", "a.t", "^", "$", "^$", "ap+t"})
+   {
+      regex_t reference;
+      ASSERT_EQ(0, regcomp(&reference, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB));
+      Patterns::BaseRegexMatcher matcher(pattern);
+      for (auto const string : {"apt", "APT", "apt-utils", "libapt", "libapt-pkg", "lib-x_y", "lib2x", "Lib2x", "ap", "", "aptt", "a.t", "aXt", "appt"})
+	 EXPECT_EQ(regexec(&reference, string, 0, nullptr, 0) == 0, matcher(string)) << pattern << " on " << string;
+      regfree(&reference);
+   }
+}
@@ -0,0 +1,107 @@
+#include <config.h>
+
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/reactor.h>
+
+#include <chrono>
+#include <vector>
+
+#include <unistd.h>
+
+#include "common.h"
+
+#include "file-helpers.h"
+
+using namespace std::chrono_literals;
+
+TEST(ReactorTest, Pipe)
+{
+   int fds[2];
+   ASSERT_EQ(0, pipe(fds));
+   APT::Reactor Events;
+   std::vector<APT::Reactor::Event> Ready;
+   int data;
+
+   // nothing to read yet, so we run into the deadline
+   EXPECT_TRUE(Events.Watch(fds[0], APT::Reactor::Read, &data));
+   auto const start = APT::Reactor::clock::now();
+   EXPECT_TRUE(Events.Wait(Ready, start + 10ms));
+   EXPECT_TRUE(Ready.empty());
+   EXPECT_LE(start + 10ms, APT::Reactor::clock::now());
+
+   EXPECT_TRUE(Events.Watch(fds[0], APT::Reactor::Read, &data));
+   EXPECT_TRUE(Events.Watch(fds[1], APT::Reactor::Write));
+   EXPECT_TRUE(Events.Wait(Ready));
+   ASSERT_EQ(1u, Ready.size());
+   EXPECT_EQ(fds[1], Ready[0].fd);
+   EXPECT_EQ(APT::Reactor::Write, Ready[0].events);
+   EXPECT_EQ(nullptr, Ready[0].data);
+
+   // the write end is dropped as it was not watched again
+   ASSERT_EQ(1, write(fds[1], "x", 1));
+   EXPECT_TRUE(Events.Watch(fds[0], APT::Reactor::Read, &data));
+   EXPECT_TRUE(Events.Wait(Ready));
+   ASSERT_EQ(1u, Ready.size());
+   EXPECT_EQ(fds[0], Ready[0].fd);
+   EXPECT_EQ(APT::Reactor::Read, Ready[0].events);
+   EXPECT_EQ(&data, Ready[0].data);
+
+   // closing the write end is reported as readable
+   close(fds[1]);
+   char c;
+   ASSERT_EQ(1, read(fds[0], &c, 1));
+   EXPECT_TRUE(Events.Watch(fds[0], APT::Reactor::Read, &data));
+   EXPECT_TRUE(Events.Wait(Ready));
+   ASSERT_EQ(1u, Ready.size());
+   EXPECT_EQ(APT::Reactor::Read, Ready[0].events);
+
+   Events.Forget(fds[0]);
+   close(fds[0]);
+   EXPECT_TRUE(Events.Wait(Ready, APT::Reactor::clock::now()));
+   EXPECT_TRUE(Ready.empty());
+}
+
+TEST(ReactorTest, EdgeTriggered)
+{
+   int fds[2];
+   ASSERT_EQ(0, pipe(fds));
+   APT::Reactor Events;
+   std::vector<APT::Reactor::Event> Ready;
+
+   ASSERT_EQ(1, write(fds[1], "x", 1));
+   EXPECT_TRUE(Events.Watch(fds[0], APT::Reactor::Read | APT::Reactor::EdgeTriggered));
+   EXPECT_TRUE(Events.Wait(Ready));
+   EXPECT_EQ(1u, Ready.size());
+
+   // the data was not consumed, but there is nothing new either
+   EXPECT_TRUE(Events.Watch(fds[0], APT::Reactor::Read | APT::Reactor::EdgeTriggered));
+   EXPECT_TRUE(Events.Wait(Ready, APT::Reactor::clock::now() + 1ms));
+#ifdef __linux__
+   EXPECT_TRUE(Ready.empty());
+#endif
+
+   ASSERT_EQ(1, write(fds[1], "y", 1));
+   EXPECT_TRUE(Events.Watch(fds[0], APT::Reactor::Read | APT::Reactor::EdgeTriggered));
+   EXPECT_TRUE(Events.Wait(Ready));
+   EXPECT_EQ(1u, Ready.size());
+
+   close(fds[0]);
+   close(fds[1]);
+}
+
+TEST(ReactorTest, RegularFile)
+{
+   FileFd fd;
+   openTemporaryFile("reactor", fd, "some content");
+   APT::Reactor Events;
+   std::vector<APT::Reactor::Event> Ready;
+
+   for (int i = 0; i < 2; ++i)
+   {
+      EXPECT_TRUE(Events.Watch(fd.Fd(), APT::Reactor::Read | APT::Reactor::Write));
+      EXPECT_TRUE(Events.Wait(Ready));
+      ASSERT_EQ(1u, Ready.size());
+      EXPECT_EQ(fd.Fd(), Ready[0].fd);
+      EXPECT_EQ(APT::Reactor::Read | APT::Reactor::Write, Ready[0].events);
+   }
+}
@@ -1,12 +1,18 @@
 #include <config.h>
 
+#include <apt-pkg/configuration.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/strutl.h>
 #include <apt-pkg/tagfile.h>
 
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <glob.h>
 #include <unistd.h>
 
 #include "common.h"
@@ -343,3 +349,132 @@ TEST(TagFileTest, EmptyTagName)
 
    EXPECT_FALSE(tfile.Step(section));
 }
+
+TEST(TagFileTest, MappedFile)
+{
+   FileFd fd;
+   openTemporaryFile("mapped", fd, "Package: pkgA\n"
+	 "Version: 1\n"
+	 "\n"
+	 "Package: pkgB\n"
+	 "Description: bbb\n"
+	 " bbb\n"
+	 "\n"
+	 "\n"
+	 "Package: pkgC\n"
+	 "\n");
+
+   for (bool const mapped : {true, false})
+   {
+      _config->Set("Debug::pkgTagFile::NoMMap", mapped == false);
+      ASSERT_TRUE(fd.Seek(0));
+      pkgTagFile tfile(&fd);
+      pkgTagSection section;
+      std::vector<unsigned long> offsets;
+      for (auto const pkg : {"pkgA", "pkgB", "pkgC"})
+      {
+	 offsets.push_back(tfile.Offset());
+	 ASSERT_TRUE(tfile.Step(section));
+	 EXPECT_EQ(pkg, section.FindS("Package"));
+      }
+      EXPECT_FALSE(tfile.Step(section));
+      EXPECT_EQ((std::vector<unsigned long>{0, 26, 64}), offsets);
+
+      ASSERT_TRUE(tfile.Jump(section, offsets[1]));
+      EXPECT_EQ("bbb\n bbb", section.FindS("Description"));
+      ASSERT_TRUE(tfile.Jump(section, offsets[2]));
+      EXPECT_EQ("pkgC", section.FindS("Package"));
+      ASSERT_TRUE(tfile.Jump(section, offsets[0]));
+      EXPECT_EQ("1", section.FindS("Version"));
+   }
+   _config->Clear("Debug::pkgTagFile::NoMMap");
+}
+
+// parses the whole file with or without the vectorized scanner, a buffer
+// size makes it read the file in parts instead of mapping it
+static std::vector<std::string> ParseTagFile(FileFd &fd, bool const SIMD, unsigned long long const Size = 0)
+{
+   _config->Set("Debug::pkgTagSection::NoSIMD", SIMD == false);
+   _config->Set("Debug::pkgTagFile::NoMMap", Size != 0);
+   std::vector<std::string> Parsed;
+   EXPECT_TRUE(fd.Seek(0));
+   pkgTagFile tfile(&fd, Size == 0 ? APT_BUFFER_SIZE : Size);
+   pkgTagSection section;
+   while (tfile.Step(section))
+   {
+      std::string Record = std::to_string(section.size()) + "|";
+      for (unsigned int I = 0; I < section.Count(); ++I)
+      {
+	 const char *Start, *Stop;
+	 section.Get(Start, Stop, I);
+	 std::string const Field(Start, Stop - Start);
+	 std::string const Tag = Field.substr(0, Field.find(':'));
+	 Record.append(Field).append("|").append(section.FindRaw(APT::String::Strip(Tag))).append("|");
+      }
+      Record.append(section.FindS("Package")).append(section.FindS("Description"));
+      Parsed.push_back(std::move(Record));
+   }
+   _config->Clear("Debug::pkgTagSection::NoSIMD");
+   _config->Clear("Debug::pkgTagFile::NoMMap");
+   return Parsed;
+}
+
+TEST(TagFileTest, VectorizedScanner)
+{
+   // fields and lines of all lengths, so that every kind of boundary
+   // ends up on and around the edges of the scanned blocks
+   std::string content;
+   for (size_t i = 0; i < 300; ++i)
+   {
+      content.append("Package: pkg").append(std::to_string(i)).append("\n");
+      content.append("Field").append(std::string(i % 70, 'x')).append(i % 3 == 0 ? " : " : ":").append(std::string(i % 130, 'v')).append("\n");
+      if (i % 5 == 0)
+	 content.append("Colons: a:b:c\r\n");
+      content.append("Description: ").append(std::string(i % 67, 'd')).append("\n");
+      for (size_t j = 0; j < i % 7; ++j)
+	 content.append(" ").append(std::string((i * j) % 90, 'l')).append("\n .\n");
+      content.append(i % 11 == 0 ? "\n\n\n" : "\n");
+   }
+   FileFd fd;
+   openTemporaryFile("vectorized", fd, content.c_str());
+
+   auto const Scalar = ParseTagFile(fd, false);
+   EXPECT_EQ(300u, Scalar.size());
+   EXPECT_EQ(Scalar, ParseTagFile(fd, true));
+   // refilling and growing the buffer must not leave stale blocks behind
+   for (unsigned long long const Size : {100, 1000, 4096})
+      EXPECT_EQ(Scalar, ParseTagFile(fd, true, Size)) << Size;
+}
+
+// Set APT_BENCHMARK_PACKAGES to a glob of (uncompressed) Packages files to
+// compare the parse time of the scalar and the vectorized scanner on them.
+TEST(TagFileTest, ScannerBenchmark)
+{
+   char const *const pattern = getenv("APT_BENCHMARK_PACKAGES");
+   if (pattern == nullptr)
+      GTEST_SKIP() << "APT_BENCHMARK_PACKAGES is not set";
+   glob_t files;
+   if (glob(pattern, 0, nullptr, &files) != 0)
+      GTEST_SKIP() << "No files match " << pattern;
+
+   for (size_t i = 0; i < files.gl_pathc; ++i)
+   {
+      FileFd fd(files.gl_pathv[i], FileFd::ReadOnly, FileFd::Extension);
+      ASSERT_TRUE(fd.IsOpen());
+      for (bool const SIMD : {false, true})
+      {
+	 _config->Set("Debug::pkgTagSection::NoSIMD", SIMD == false);
+	 ASSERT_TRUE(fd.Seek(0));
+	 auto const start = std::chrono::steady_clock::now();
+	 pkgTagFile tfile(&fd);
+	 pkgTagSection section;
+	 size_t sections = 0;
+	 while (tfile.Step(section))
+	    ++sections;
+	 auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	 std::cout << files.gl_pathv[i] << ": " << sections << " sections in " << ms << "ms" << (SIMD ? " (vectorized)" : " (scalar)") << std::endl;
+      }
+      EXPECT_EQ(ParseTagFile(fd, false), ParseTagFile(fd, true));
+   }
+   globfree(&files);
+}